@@ -0,0 +1,135 @@
+`timescale 1ns/1ns
+//
+// Checks the envelope step rate: the envelopes have to be stepped once every
+// CLK_DIV clock cycles, also when CLK_DIV is not a multiple of the
+// NUM_VOICES*VOICE_CYCLES cycles a round of voices takes. One voice is kept
+// in its attack, its level has to rise by the attack increment on every
+// step. The voice slots are stepped like sublime_voice_ctrl does.
+//
+module sublime_envelope_tb;
+
+localparam NUM_VOICES = 4;
+localparam VOICE_CYCLES = 5;
+localparam CLK_DIV = 70;
+localparam NUM_STEPS = 40;
+localparam GATED_VOICE = 2;
+localparam ATTACK_RATE = 8'h40;
+localparam ATTACK_INC = 24'h100;
+
+reg 			clk = 1'b1;
+reg 			rst = 1'b1;
+
+reg [$clog2(NUM_VOICES)-1:0] active_voice = 0;
+reg [$clog2(NUM_VOICES)-1:0] next_voice;
+reg [2:0]		slot_cycle = 0;
+reg			active_voice_changed;
+wire			slot_done;
+wire [7:0]		level;
+wire [NUM_VOICES-1:0]	active;
+
+integer			steps = 0;
+integer			visits = 0;
+reg [23:0]		expected = 0;
+integer			errors = 0;
+integer			i;
+
+vlog_tb_utils vlog_tb_utils0();
+
+always #10 clk <= ~clk;
+initial #100 rst = 0;
+
+sublime_envelope #(
+	.NUM_VOICES		(NUM_VOICES),
+	.VOICE_CYCLES		(VOICE_CYCLES),
+	.CLK_DIV		(CLK_DIV)
+) dut (
+	.clk			(clk),
+	.rst			(rst),
+	.next_voice		(next_voice),
+	.active_voice		(active_voice),
+	.active_voice_changed	(active_voice_changed),
+	.gate			(active_voice == GATED_VOICE),
+	.trigger		(1'b0),
+	.params			({ATTACK_RATE, 24'h0}),
+	.level			(level),
+	.active			(active)
+);
+
+// Voice slots of VOICE_CYCLES cycles, counting down through the voices. As in
+// sublime_voice_ctrl, active_voice_changed is asserted in the first cycle
+// of a slot.
+assign slot_done = slot_cycle == VOICE_CYCLES-1;
+
+always @(*) begin
+	next_voice = active_voice;
+	if (slot_done)
+		next_voice = active_voice == 0 ? NUM_VOICES-1 : active_voice-1;
+end
+
+always @(posedge clk)
+	if (rst) begin
+		active_voice <= 0;
+		active_voice_changed <= 1;
+		slot_cycle <= 0;
+	end else begin
+		active_voice <= next_voice;
+		active_voice_changed <= slot_done;
+		slot_cycle <= slot_done ? 0 : slot_cycle + 1;
+	end
+
+// Count the rounds that step the envelopes. The gated voice is cleared in
+// the first round and starts its attack in the second, after that it rises
+// on every step.
+always @(posedge clk)
+	if (!rst && active_voice_changed) begin
+		if (active_voice == 0 && dut.step)
+			steps = steps + 1;
+		if (active_voice == GATED_VOICE) begin
+			if (visits >= 2 && dut.step)
+				expected = expected + ATTACK_INC;
+			visits = visits + 1;
+		end
+	end
+
+initial begin
+	if ($test$plusargs("vcd")) begin
+		$dumpfile("testlog.vcd");
+		$dumpvars(0);
+	end
+
+	// Garbage in the state RAM, with the gate bit set, has to be cleared
+	for (i = 0; i < NUM_VOICES; i = i+1)
+		dut.envelope_state.mem[i] = ~0;
+
+	@(negedge rst);
+	repeat (NUM_STEPS*CLK_DIV) @(posedge clk);
+	@(negedge clk);
+
+	// A step is taken up to a round after it is requested
+	if (steps < NUM_STEPS-1 || steps > NUM_STEPS) begin
+		$display("%0d steps in %0d cycles, expected %0d",
+			 steps, NUM_STEPS*CLK_DIV, NUM_STEPS);
+		errors = errors + 1;
+	end
+
+	if (active !== 1 << GATED_VOICE) begin
+		$display("active voices %b", active);
+		errors = errors + 1;
+	end
+
+	if (dut.envelope_state.mem[GATED_VOICE][23:0] !== expected) begin
+		$display("attack level %h, expected %h",
+			 dut.envelope_state.mem[GATED_VOICE][23:0], expected);
+		errors = errors + 1;
+	end
+
+	$display("%0d steps in %0d cycles, attack level %h", steps,
+		 NUM_STEPS*CLK_DIV, expected);
+	if (errors)
+		$display("FAIL: %0d errors", errors);
+	else
+		$display("PASS");
+	$finish();
+end
+
+endmodule
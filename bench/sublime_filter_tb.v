@@ -0,0 +1,230 @@
+`timescale 1ns/1ns
+//
+// Runs the voice filter with every mode on its own voice and compares the
+// output of each voice slot with a model that computes the filter equations
+// one voice at a time, with the same fixed point rounding and saturation.
+// A DC input has to come out of the low pass unchanged and be removed by
+// the high pass. The voice slots are stepped like sublime_voice_ctrl does.
+//
+module sublime_filter_tb;
+
+localparam NUM_VOICES = 8;
+localparam CYCLES = 5;
+localparam NUM_ROUNDS = 400;
+localparam integer DC = 32'h10000000;
+
+reg 			clk = 1'b1;
+reg 			rst = 1'b1;
+
+reg [$clog2(NUM_VOICES)-1:0] active_voice = 0;
+reg [$clog2(NUM_VOICES)-1:0] next_voice;
+reg [2:0]		slot_cycle = 0;
+reg			active_voice_changed;
+wire			slot_done;
+wire [31:0]		data;
+wire			done;
+
+reg [31:0]		params[0:NUM_VOICES-1];
+reg [31:0]		in_data;
+integer			round = 0;
+integer			checked = 0;
+integer			errors = 0;
+
+// Model state
+reg signed [35:0]	m_lp[0:NUM_VOICES-1];
+reg signed [35:0]	m_bp[0:NUM_VOICES-1];
+reg [31:0]		m_out;
+
+reg [31:0]		last_out[0:NUM_VOICES-1];
+
+integer			i;
+
+vlog_tb_utils vlog_tb_utils0();
+
+always #10 clk <= ~clk;
+initial #100 rst = 0;
+
+sublime_filter #(
+	.NUM_VOICES		(NUM_VOICES),
+	.CYCLES			(CYCLES)
+) dut (
+	.clk			(clk),
+	.rst			(rst),
+	.next_voice		(next_voice),
+	.active_voice		(active_voice),
+	.active_voice_changed	(active_voice_changed),
+	.active_voice_data	(in_data),
+	.params			(params[active_voice]),
+	.data			(data),
+	.done			(done)
+);
+
+// Input of voice v in round r, DC on voices 0 and 1, a square wave on 2
+// and full scale noise on the others.
+function [31:0] stimulus;
+	input integer v;
+	input integer r;
+	begin
+		case (v)
+		0, 1:
+			stimulus = DC;
+		2:
+			stimulus = r % 32 < 16 ? 32'h40000000 : 32'hc0000000;
+		default:
+			stimulus = (r * 32'h9e3779b9) ^ (v * 32'h7f4a7c15);
+		endcase
+	end
+endfunction
+
+// Voice slots of CYCLES cycles, counting down through the voices. As in
+// sublime_voice_ctrl, active_voice_changed is asserted in the first cycle
+// of a slot.
+assign slot_done = slot_cycle == CYCLES-1;
+
+always @(*) begin
+	next_voice = active_voice;
+	if (slot_done)
+		next_voice = active_voice == 0 ? NUM_VOICES-1 : active_voice-1;
+end
+
+always @(posedge clk)
+	if (rst) begin
+		active_voice <= 0;
+		active_voice_changed <= 1;
+		slot_cycle <= 0;
+	end else begin
+		active_voice <= next_voice;
+		active_voice_changed <= slot_done;
+		slot_cycle <= slot_done ? 0 : slot_cycle + 1;
+		if (slot_done && active_voice == 1)
+			round <= round + 1;
+	end
+
+always @(*)
+	in_data = stimulus(active_voice, round);
+
+function [35:0] sat36;
+	input [37:0] val;
+	begin
+		if (val[37:35] == 3'b000 || val[37:35] == 3'b111)
+			sat36 = val[35:0];
+		else
+			sat36 = val[37] ? {1'b1, 35'h0} : {1'b0, {35{1'b1}}};
+	end
+endfunction
+
+function [31:0] sat32;
+	input [35:0] val;
+	begin
+		if (val[35:31] == 5'b00000 || val[35:31] == 5'b11111)
+			sat32 = val[31:0];
+		else
+			sat32 = val[35] ? {1'b1, 31'h0} : {1'b0, {31{1'b1}}};
+	end
+endfunction
+
+// One sample of voice v
+task model;
+	input integer v;
+	input [31:0] in;
+	input [31:0] prm;
+	reg signed [35:0] x;
+	reg signed [35:0] lp;
+	reg signed [35:0] hp;
+	reg signed [35:0] bp;
+	reg signed [53:0] p;
+	reg signed [37:0] sum;
+	begin
+		x = {{4{in[31]}}, in};
+
+		p = m_bp[v] * $signed({2'b0, prm[31:16]});
+		sum = m_lp[v] + $signed(p[52:16]);
+		lp = sat36(sum);
+
+		p = m_bp[v] * $signed({1'b0, prm[15:4], 5'h0});
+		sum = x - lp - $signed(p[52:16]);
+		hp = sat36(sum);
+
+		p = hp * $signed({2'b0, prm[31:16]});
+		sum = m_bp[v] + $signed(p[52:16]);
+		bp = sat36(sum);
+
+		case (prm[1:0])
+		0: m_out = sat32(x);
+		1: m_out = sat32(lp);
+		2: m_out = sat32(bp);
+		3: m_out = sat32(hp);
+		endcase
+
+		m_lp[v] = lp;
+		m_bp[v] = bp;
+	end
+endtask
+
+always @(posedge clk)
+	if (!rst && done) begin
+		model(active_voice, in_data, params[active_voice]);
+		if (data !== m_out) begin
+			if (errors < 10)
+				$display("round %0d voice %0d: %h, expected %h",
+					 round, active_voice, data, m_out);
+			errors = errors + 1;
+		end
+		last_out[active_voice] = data;
+		checked = checked + 1;
+	end
+
+initial begin
+	if ($test$plusargs("vcd")) begin
+		$dumpfile("testlog.vcd");
+		$dumpvars(0);
+	end
+
+	// The filter has to clear the garbage in its state RAM
+	for (i = 0; i < NUM_VOICES; i = i+1) begin
+		dut.filter_state.mem[i] = ~0;
+		m_lp[i] = 0;
+		m_bp[i] = 0;
+	end
+
+	// {f, q, mode}, f = 0x2000 is a cutoff of about fs/50, q = 0x800 a
+	// resonance of 1
+	params[0] = {16'h2000, 12'h800, 4'h1};	// low pass
+	params[1] = {16'h2000, 12'h800, 4'h3};	// high pass
+	params[2] = {16'h4000, 12'h080, 4'h2};	// band pass, resonant
+	params[3] = {16'h1234, 12'h5a5, 4'h0};	// bypass
+	params[4] = {16'hffff, 12'h001, 4'h1};	// unstable, saturates
+	params[5] = {16'h8000, 12'hfff, 4'h2};
+	params[6] = {16'h0100, 12'h400, 4'h3};
+	params[7] = {16'h6000, 12'h010, 4'h1};
+
+	@(negedge rst);
+	while (round < NUM_ROUNDS)
+		@(posedge clk);
+	@(negedge clk);
+
+	if (checked < NUM_VOICES*(NUM_ROUNDS-1)) begin
+		$display("%0d voice slots checked", checked);
+		errors = errors + 1;
+	end
+
+	// The DC voices have settled
+	if ($signed(last_out[0]) < DC - DC/100 ||
+	    $signed(last_out[0]) > DC + DC/100) begin
+		$display("low pass of DC: %h", last_out[0]);
+		errors = errors + 1;
+	end
+	if ($signed(last_out[1]) < -DC/100 || $signed(last_out[1]) > DC/100) begin
+		$display("high pass of DC: %h", last_out[1]);
+		errors = errors + 1;
+	end
+
+	$display("%0d voice slots in %0d rounds", checked, round);
+	if (errors)
+		$display("FAIL: %0d errors", errors);
+	else
+		$display("PASS");
+	$finish();
+end
+
+endmodule
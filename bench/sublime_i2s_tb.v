@@ -0,0 +1,223 @@
+`timescale 1ns/1ps
+//
+// Plays a ramp through the fixed rate output and the I2S transmitter,
+// deserializes the codec interface and checks every received frame against
+// the mixer samples that were pushed into the output FIFO.
+// The output low pass filter is bypassed (lpf_shift = 0) so the samples
+// entering the FIFO are the mixer samples.
+//
+module sublime_i2s_tb;
+
+parameter NUM_VOICES = 8;
+parameter WAVETABLE_SIZE = 8192;	// Should be a power of 2
+parameter WB_AW = 32;
+parameter WB_DW = 32;
+parameter I2S_WORD_LENGTH = 32;
+parameter I2S_LEFT_JUSTIFIED = 0;
+parameter NUM_FRAMES = 256;
+
+reg 			clk = 1'b1;
+reg 			rst = 1'b1;
+reg 			codec_clk = 1'b1;
+reg 			err;
+wire [31:0]		left_sample;
+wire [31:0]		right_sample;
+wire			codec_bclk;
+wire			codec_lrclk;
+wire			codec_dacdat;
+
+wire [WB_AW-1:0]	wb_m2s_adr;
+wire [WB_DW-1:0]	wb_m2s_dat;
+wire [WB_DW/8-1:0]	wb_m2s_sel;
+wire		 	wb_m2s_we;
+wire			wb_m2s_cyc;
+wire			wb_m2s_stb;
+wire [2:0] 		wb_m2s_cti;
+wire [1:0]		wb_m2s_bte;
+wire [WB_DW-1:0]	wb_s2m_dat;
+wire			wb_s2m_ack;
+wire			wb_s2m_err;
+wire			wb_s2m_rty;
+
+vlog_tb_utils vlog_tb_utils0();
+
+always #10 clk <= ~clk; // 50 MHz
+always #40.690 codec_clk <= ~codec_clk; // 12.288 MHz
+initial #100 rst = 0;
+
+wb_bfm_master wb_bfm_master (
+	.wb_clk_i (clk),
+	.wb_rst_i (rst),
+	.wb_adr_o (wb_m2s_adr),
+	.wb_dat_o (wb_m2s_dat),
+	.wb_sel_o (wb_m2s_sel),
+	.wb_we_o  (wb_m2s_we),
+	.wb_cyc_o (wb_m2s_cyc),
+	.wb_stb_o (wb_m2s_stb),
+	.wb_cti_o (wb_m2s_cti),
+	.wb_bte_o (wb_m2s_bte),
+	.wb_dat_i (wb_s2m_dat),
+	.wb_ack_i (wb_s2m_ack),
+	.wb_err_i (wb_s2m_err),
+	.wb_rty_i (wb_s2m_rty)
+);
+
+sublime #(
+	.NUM_VOICES(NUM_VOICES),
+	.WAVETABLE_SIZE(WAVETABLE_SIZE),	// Should be a power of 2
+	.I2S_WORD_LENGTH(I2S_WORD_LENGTH),
+	.I2S_LEFT_JUSTIFIED(I2S_LEFT_JUSTIFIED),
+	.WB_AW(WB_AW),
+	.WB_DW(WB_DW)
+) sublime0 (
+	.clk(clk),
+	.rst(rst),
+
+	// Stereo output streams
+	.left_sample(left_sample),
+	.right_sample(right_sample),
+
+	// Codec serial interface
+	.codec_clk(codec_clk),
+	.codec_rst(rst),
+	.codec_bclk(codec_bclk),
+	.codec_lrclk(codec_lrclk),
+	.codec_dacdat(codec_dacdat),
+
+	// Wishbone slave interface
+	.wb_adr_i(wb_m2s_adr),
+	.wb_dat_i(wb_m2s_dat),
+	.wb_sel_i(wb_m2s_sel),
+	.wb_we_i(wb_m2s_we),
+	.wb_cyc_i(wb_m2s_cyc),
+	.wb_stb_i(wb_m2s_stb),
+	.wb_cti_i(wb_m2s_cti),
+	.wb_bte_i(wb_m2s_bte),
+	.wb_dat_o(wb_s2m_dat),
+	.wb_ack_o(wb_s2m_ack),
+	.wb_err_o(wb_s2m_err),
+	.wb_rty_o(wb_s2m_rty)
+);
+
+localparam VOICE0_OSC0_FREQ	= 32'h00000000;
+localparam VOICE0_CTRL		= 32'h00000008;
+localparam MAIN_CONTROL		= 32'h00000808;
+localparam OUTPUT_RATE		= 32'h00000814;
+localparam WAVETABLE0_BASE	= 32'h00010000;
+
+// 2^28 * (12.288e6/128) / 50e6
+localparam OUTPUT_RATE_INC	= 32'd515396;
+
+localparam [31:0] WORD_MASK	= ~32'h0 << (32 - I2S_WORD_LENGTH);
+
+// Samples pushed into the output FIFO
+reg [63:0]		fifo_samples[0:4095];
+integer			fifo_wr_idx = 0;
+integer			fifo_rd_idx = 0;
+
+// Samples loaded into the transmitter, one per frame
+reg [63:0]		tx_frames[0:4095];
+integer			tx_idx = 1;
+
+reg			rx_lrclk_d = 0;
+reg			rx_left_d = 0;
+reg			rx_started = 0;
+reg [63:0]		rx_shift = 0;
+integer			rx_idx = 0;
+
+integer			errors = 0;
+integer			i;
+
+wire			rx_ws;
+wire			rx_left;
+
+// With the filter bypassed the filter output follows the mixer
+always @(posedge clk)
+	if (!rst && sublime0.output0.sample_valid)
+		@(posedge clk)
+		if (sublime0.output0.left_lp !== left_sample ||
+		    sublime0.output0.right_lp !== right_sample) begin
+			$display("filter output differs from mixer sample");
+			errors = errors + 1;
+		end
+
+always @(posedge clk)
+	if (!rst && sublime0.output0.tick && !sublime0.output0.fifo_full) begin
+		fifo_samples[fifo_wr_idx % 4096] = {sublime0.output0.left_lp,
+						    sublime0.output0.right_lp};
+		fifo_wr_idx = fifo_wr_idx + 1;
+	end
+
+// The first frame after reset is silence, every request loads the next
+// sample, or repeats the last one on an underrun.
+initial tx_frames[0] = 0;
+always @(posedge codec_clk)
+	if (!rst && sublime0.codec_sample_req) begin
+		if (!sublime0.output0.fifo_empty) begin
+			tx_frames[tx_idx % 4096] = fifo_samples[fifo_rd_idx % 4096];
+			fifo_rd_idx = fifo_rd_idx + 1;
+		end else begin
+			tx_frames[tx_idx % 4096] = tx_frames[(tx_idx-1) % 4096];
+		end
+		tx_idx = tx_idx + 1;
+	end
+
+// Deserializer, a channel starts with its MSB, which is sampled one BCLK
+// after the LRCLK edge in I2S format and at the edge in left justified format
+assign rx_ws = I2S_LEFT_JUSTIFIED ? codec_lrclk : rx_lrclk_d;
+assign rx_left = I2S_LEFT_JUSTIFIED ? rx_ws : !rx_ws;
+
+always @(posedge codec_bclk) begin
+	rx_lrclk_d <= codec_lrclk;
+	rx_left_d <= rx_left;
+	if (rx_left & !rx_left_d) begin
+		if (rx_started) begin
+			if (rx_shift !== {tx_frames[rx_idx % 4096][63:32] & WORD_MASK,
+					  tx_frames[rx_idx % 4096][31:0] & WORD_MASK}) begin
+				$display("frame %0d: got %h, expected %h", rx_idx,
+					 rx_shift, tx_frames[rx_idx % 4096]);
+				errors = errors + 1;
+			end
+			rx_idx = rx_idx + 1;
+		end
+		rx_started <= 1;
+		rx_shift <= {63'h0, codec_dacdat};
+	end else begin
+		rx_shift <= {rx_shift[62:0], codec_dacdat};
+	end
+end
+
+initial begin
+	wb_bfm_master.reset();
+
+	// Write a ramp to wavetable0
+	for (i = 0; i < WAVETABLE_SIZE; i = i+1)
+		wb_bfm_master.write(WAVETABLE0_BASE+i*4,
+				    i*((1<<30)/(WAVETABLE_SIZE/4)),
+				    4'hf, err);
+
+	// Enable osc0 of voice0 at ~4.4 kHz and set velocity
+	wb_bfm_master.write(VOICE0_CTRL, 32'h3f01, 4'hf, err);
+	wb_bfm_master.write(VOICE0_OSC0_FREQ, 32'd377960, 4'hf, err);
+
+	// Assert sync to all voices
+	wb_bfm_master.write(MAIN_CONTROL, 32'h1, 4'hf, err);
+	wb_bfm_master.write(MAIN_CONTROL, 32'h0, 4'hf, err);
+
+	// Start the output with the low pass filter bypassed
+	wb_bfm_master.write(OUTPUT_RATE, OUTPUT_RATE_INC, 4'hf, err);
+
+	while (fifo_rd_idx < NUM_FRAMES)
+		@(posedge codec_clk);
+
+	$display("%0d frames, %0d samples, %0d underruns, %0d overruns",
+		 rx_idx, fifo_rd_idx,
+		 sublime0.output_underruns, sublime0.output_overruns);
+	if (errors)
+		$display("FAIL: %0d errors", errors);
+	else
+		$display("PASS");
+	$finish();
+end
+
+endmodule
\ No newline at end of file
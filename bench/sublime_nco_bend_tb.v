@@ -0,0 +1,188 @@
+`timescale 1ns/1ns
+//
+// Checks the pitch bend path of the NCO: every voice has to advance by its
+// frequency scaled by bend, saturated at 2^31-1, times
+// NUM_VOICES*VOICE_CYCLES per sample, and pick its mipmap level from the
+// scaled frequency. The voice slots are stepped like sublime_voice_ctrl
+// does, advance is asserted in the last cycle of a slot.
+// The frequencies and bends are picked so that some of the products
+// overflow 2^31, which would wrap around without the saturation.
+//
+module sublime_nco_bend_tb;
+
+localparam NUM_VOICES = 4;
+localparam VOICE_CYCLES = 5;
+localparam MIP_SHIFT = 20;
+localparam NUM_BENDS = 5;
+
+reg 			clk = 1'b1;
+reg 			rst = 1'b1;
+
+reg [$clog2(NUM_VOICES)-1:0] active_voice = 0;
+reg [$clog2(NUM_VOICES)-1:0] next_voice;
+reg [2:0]		slot_cycle = 0;
+wire			advance;
+
+reg [19:0]		bend = 20'h10000;
+reg			freq_we = 0;
+reg [$clog2(NUM_VOICES)-1:0] freq_write_voice = 0;
+reg [31:0]		freq_write_data = 0;
+
+wire [31:0]		wave_addr;
+wire [5:0]		level;
+
+reg [31:0]		voice_freq[0:NUM_VOICES-1];
+reg [19:0]		bends[0:NUM_BENDS-1];
+reg [31:0]		last_addr[0:NUM_VOICES-1];
+reg [31:0]		step;
+reg [31:0]		bent;
+reg [5:0]		exp_level;
+reg [63:0]		product;
+
+integer			samples = 0;
+integer			checks = 0;
+integer			saturated = 0;
+integer			errors = 0;
+integer			b;
+integer			v;
+
+vlog_tb_utils vlog_tb_utils0();
+
+always #10 clk <= ~clk;
+initial #100 rst = 0;
+
+sublime_nco #(
+	.NUM_VOICES		(NUM_VOICES),
+	.VOICE_CYCLES		(VOICE_CYCLES)
+) dut (
+	.clk			(clk),
+	.rst			(rst),
+	.next_voice		(next_voice),
+	.advance		(advance),
+	.enable			(1'b1),
+	.sync			({NUM_VOICES{1'b0}}),
+	.offset			(32'h0),
+	.mip_shift		(MIP_SHIFT[4:0]),
+	.bend			(bend),
+	.freq_we		(freq_we),
+	.freq_write_voice	(freq_write_voice),
+	.freq_write_data	(freq_write_data),
+	.wave_addr		(wave_addr),
+	.level			(level)
+);
+
+// Voice slots of VOICE_CYCLES cycles, counting down through the voices
+assign advance = slot_cycle == VOICE_CYCLES-1;
+
+always @(*) begin
+	next_voice = active_voice;
+	if (advance)
+		next_voice = active_voice == 0 ? NUM_VOICES-1 : active_voice-1;
+end
+
+always @(posedge clk)
+	if (rst) begin
+		active_voice <= 0;
+		slot_cycle <= 0;
+	end else begin
+		active_voice <= next_voice;
+		slot_cycle <= advance ? 0 : slot_cycle + 1;
+	end
+
+// The frequency a voice is advanced by, saturated at 2^31-1
+function [31:0] bent_freq;
+	input [31:0] freq;
+	input [19:0] bend;
+	reg [63:0] p;
+	begin
+		p = freq * bend;
+		bent_freq = |p[63:47] ? 32'h7fffffff : p[47:16];
+	end
+endfunction
+
+function [5:0] bit_length;
+	input [31:0] x;
+	integer k;
+	begin
+		bit_length = 0;
+		for (k = 0; k < 32; k = k+1)
+			if (x[k])
+				bit_length = k+1;
+	end
+endfunction
+
+// Sample the phase of each voice as it is advanced, compare the step since
+// its last sample once the voices have settled on the current bend
+always @(negedge clk)
+	if (!rst && advance) begin
+		if (samples >= 2*NUM_VOICES) begin
+			bent = bent_freq(voice_freq[next_voice], bend);
+			step = bent * (NUM_VOICES*VOICE_CYCLES);
+			exp_level = bit_length(bent) > MIP_SHIFT ?
+				    bit_length(bent) - MIP_SHIFT : 0;
+			product = voice_freq[next_voice] * bend;
+			if (|product[63:47])
+				saturated = saturated + 1;
+			if (wave_addr - last_addr[next_voice] !== step ||
+			    level !== exp_level) begin
+				$display("voice %0d freq %h bend %h: step %h level %0d, expected %h level %0d",
+					 next_voice, voice_freq[next_voice], bend,
+					 wave_addr - last_addr[next_voice], level,
+					 step, exp_level);
+				errors = errors + 1;
+			end
+			checks = checks + 1;
+		end
+		last_addr[next_voice] = wave_addr;
+		samples = samples + 1;
+	end
+
+initial begin
+	if ($test$plusargs("vcd")) begin
+		$dumpfile("testlog.vcd");
+		$dumpvars(0);
+	end
+
+	voice_freq[0] = 32'h00100000;
+	voice_freq[1] = 32'h07654321;
+	voice_freq[2] = 32'h40000000;
+	voice_freq[3] = 32'h7fffffff;
+
+	bends[0] = 20'h10000;	// 1.0
+	bends[1] = 20'h08000;	// 0.5
+	bends[2] = 20'h18000;	// 1.5
+	bends[3] = 20'h20000;	// 2.0
+	bends[4] = 20'hfffff;	// ~16
+
+	@(negedge rst);
+	for (v = 0; v < NUM_VOICES; v = v+1) begin
+		@(negedge clk);
+		freq_we = 1;
+		freq_write_voice = v;
+		freq_write_data = voice_freq[v];
+	end
+	@(negedge clk);
+	freq_we = 0;
+
+	for (b = 0; b < NUM_BENDS; b = b+1) begin
+		@(negedge clk);
+		bend = bends[b];
+		samples = 0;
+		repeat (4*NUM_VOICES*VOICE_CYCLES) @(posedge clk);
+	end
+
+	if (!checks || !saturated) begin
+		$display("%0d checks, %0d saturated, expected some of both",
+			 checks, saturated);
+		errors = errors + 1;
+	end
+
+	$display("%0d steps checked, %0d saturated", checks, saturated);
+	if (errors)
+		$display("FAIL: %0d errors", errors);
+	else
+		$display("PASS");
+	$finish();
+end
+
+endmodule
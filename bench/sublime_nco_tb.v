@@ -1,31 +1,84 @@
 module sublime_nco_tb;
 
+localparam NUM_VOICES = 4;
+localparam VOICE_CYCLES = 3;
+
+reg [$clog2(NUM_VOICES)-1:0] active_voice = NUM_VOICES-1;
+reg [$clog2(NUM_VOICES)-1:0] next_voice;
+reg [1:0] slot_cycle = 0;
+wire advance;
+reg freq_we = 0;
+reg [$clog2(NUM_VOICES)-1:0] freq_write_voice = 0;
+reg [31:0] freq_write_data = 0;
 wire enable;
-wire sync;
-wire [31:0] freq;
+wire [NUM_VOICES-1:0] sync;
 wire [31:0] offset;
 wire [31:0] wave_addr;
 reg clk = 1'b1;
 reg rst = 1'b1;
 
+reg [31:0] last_addr[0:NUM_VOICES-1];
+integer samples = 0;
+integer errors = 0;
+
 always #5 clk <= ~clk;
 initial #100 rst =0;
 
-sublime_nco sublime_nco0 (
-	.clk		(clk),
-	.rst		(rst),
-	.enable		(enable),
-	.sync		(sync),
-	.freq		(freq),
-	.offset		(offset),
-	.wave_addr	(wave_addr)
+// Process the voices round robin, VOICE_CYCLES clocks per voice
+assign advance = slot_cycle == VOICE_CYCLES-1;
+
+always @(*) begin
+	next_voice = active_voice;
+	if (advance)
+		next_voice = active_voice == 0 ? NUM_VOICES-1 : active_voice-1;
+end
+
+always @(posedge clk)
+	if (rst) begin
+		active_voice <= NUM_VOICES-1;
+		slot_cycle <= 0;
+	end else begin
+		active_voice <= next_voice;
+		slot_cycle <= advance ? 0 : slot_cycle + 1;
+	end
+
+sublime_nco #(
+	.NUM_VOICES		(NUM_VOICES),
+	.VOICE_CYCLES		(VOICE_CYCLES)
+) sublime_nco0 (
+	.clk			(clk),
+	.rst			(rst),
+	.next_voice		(next_voice),
+	.advance		(advance),
+	.enable			(enable),
+	.sync			(sync),
+	.offset			(offset),
+	.mip_shift		(5'd0),
+	.bend			(20'h10000),
+	.freq_we		(freq_we),
+	.freq_write_voice	(freq_write_voice),
+	.freq_write_data	(freq_write_data),
+	.wave_addr		(wave_addr),
+	.level			()
 );
 
 assign offset = 32'h10000000;
-assign freq = 32'h08000000;
-assign sync = rst;
+assign sync = {NUM_VOICES{rst}};
 assign enable = 1;
 
+// Give each voice its own frequency, voice i at (i+1)*0x08000000
+integer i;
+initial begin
+	@(posedge clk);
+	for (i = 0; i < NUM_VOICES; i = i+1) begin
+		freq_we <= 1;
+		freq_write_voice <= i;
+		freq_write_data <= (i+1)*32'h08000000;
+		@(posedge clk);
+	end
+	freq_we <= 0;
+end
+
 initial begin
 	if($test$plusargs("vcd")) begin
 		$dumpfile("testlog.vcd");
@@ -33,4 +86,31 @@ initial begin
 	end
 end
 
-endmodule
\ No newline at end of file
+// Every voice has to step by its frequency times the clocks in a sample,
+// once its phase is no longer held by the sync after reset
+always @(negedge clk)
+	if (!rst && advance) begin
+		$display("voice %0d wave_addr %08h", next_voice, wave_addr);
+		if (samples >= 2*NUM_VOICES &&
+		    wave_addr - last_addr[next_voice] !==
+		    (next_voice+1)*32'h08000000*NUM_VOICES*VOICE_CYCLES) begin
+			$display("voice %0d stepped by %08h", next_voice,
+				 wave_addr - last_addr[next_voice]);
+			errors = errors + 1;
+		end
+		last_addr[next_voice] = wave_addr;
+		samples = samples + 1;
+	end
+
+initial begin
+	#1000;
+	if (samples < 3*NUM_VOICES)
+		errors = errors + 1;
+	if (errors)
+		$display("FAIL: %0d errors", errors);
+	else
+		$display("PASS");
+	$finish();
+end
+
+endmodule
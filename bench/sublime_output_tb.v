@@ -0,0 +1,210 @@
+`timescale 1ns/1ps
+//
+// Runs the output stage with unrelated synth and codec clocks and checks the
+// samples that cross the asynchronous FIFO and the two error counters.
+// The codec first requests samples while the output is stopped (underruns),
+// then the output runs with no requests until the FIFO is full (overruns),
+// and finally the FIFO is drained and read past its end, every sample read
+// by the codec must be the next one that was written.
+// The low pass filter is bypassed so the FIFO gets the input samples.
+//
+module sublime_output_tb;
+
+parameter FIFO_AW = 5;
+parameter UNDERRUNS = 10;
+parameter EXTRA_READS = 5;
+
+localparam DEPTH = 1 << FIFO_AW;
+
+reg 			clk = 1'b1;
+reg 			rst = 1'b1;
+reg 			codec_clk = 1'b1;
+reg 			codec_rst = 1'b1;
+
+reg [1:0]		sample_div = 0;
+reg [31:0]		left_sample = 0;
+reg [31:0]		right_sample = 0;
+reg			sample_valid = 0;
+reg [27:0]		rate_inc = 0;
+reg			codec_sample_req = 0;
+
+wire [31:0]		overruns;
+wire [31:0]		underruns;
+wire [31:0]		codec_left_sample;
+wire [31:0]		codec_right_sample;
+
+vlog_tb_utils vlog_tb_utils0();
+
+always #10 clk <= ~clk; // 50 MHz
+always #40.690 codec_clk <= ~codec_clk; // 12.288 MHz
+initial #100 rst = 0;
+initial #200 codec_rst = 0;
+
+sublime_output #(
+	.FIFO_AW		(FIFO_AW)
+) dut (
+	.clk			(clk),
+	.rst			(rst),
+	.left_sample		(left_sample),
+	.right_sample		(right_sample),
+	.sample_valid		(sample_valid),
+	.lpf_shift		(4'd0),
+	.rate_inc		(rate_inc),
+	.overruns		(overruns),
+	.underruns		(underruns),
+	.codec_clk		(codec_clk),
+	.codec_rst		(codec_rst),
+	.codec_sample_req	(codec_sample_req),
+	.codec_left_sample	(codec_left_sample),
+	.codec_right_sample	(codec_right_sample)
+);
+
+// Samples pushed into the FIFO and the ticks that found it full
+reg [63:0]		fifo_samples[0:1023];
+integer			fifo_wr_idx = 0;
+integer			fifo_rd_idx = 0;
+integer			expected_overruns = 0;
+integer			expected_underruns = 0;
+
+reg [63:0]		expected = 0;
+reg			check = 0;
+integer			errors = 0;
+
+// A new input sample every fourth clock, a counter on the left channel
+// and its complement on the right one
+always @(posedge clk)
+	if (rst) begin
+		sample_div <= 0;
+		sample_valid <= 0;
+	end else begin
+		sample_div <= sample_div + 1;
+		sample_valid <= sample_div == 3;
+		if (sample_div == 3) begin
+			left_sample <= left_sample + 1;
+			right_sample <= ~(left_sample + 1);
+		end
+	end
+
+always @(posedge clk)
+	if (!rst && dut.tick) begin
+		if (!dut.fifo_full) begin
+			fifo_samples[fifo_wr_idx % 1024] = {dut.left_lp,
+							    dut.right_lp};
+			fifo_wr_idx = fifo_wr_idx + 1;
+		end else begin
+			expected_overruns = expected_overruns + 1;
+		end
+	end
+
+// A request reads the next sample or, on an underrun, repeats the last one.
+// The read data is updated on the clock edge that takes the request.
+always @(posedge codec_clk)
+	if (!codec_rst && codec_sample_req) begin
+		if (!dut.fifo_empty) begin
+			expected = fifo_samples[fifo_rd_idx % 1024];
+			fifo_rd_idx = fifo_rd_idx + 1;
+		end else begin
+			expected_underruns = expected_underruns + 1;
+		end
+		check = 1;
+	end
+
+always @(negedge codec_clk)
+	if (check) begin
+		if ({codec_left_sample, codec_right_sample} !== expected) begin
+			$display("sample %0d: got %h, expected %h", fifo_rd_idx,
+				 {codec_left_sample, codec_right_sample},
+				 expected);
+			errors = errors + 1;
+		end
+		check = 0;
+	end
+
+task request;
+	input integer n;
+	integer k;
+	begin
+		for (k = 0; k < n; k = k+1) begin
+			@(posedge codec_clk);
+			codec_sample_req <= 1;
+			@(posedge codec_clk);
+			codec_sample_req <= 0;
+			repeat (6) @(posedge codec_clk);
+		end
+	end
+endtask
+
+// Give the pointers and counters time to cross between the clock domains
+task settle;
+	begin
+		repeat (16) @(posedge codec_clk);
+		repeat (16) @(posedge clk);
+	end
+endtask
+
+task check_counters;
+	input [8*16-1:0] phase;
+	begin
+		if (underruns !== expected_underruns ||
+		    overruns !== expected_overruns) begin
+			$display("%0s: %0d underruns, %0d overruns, expected %0d, %0d",
+				 phase, underruns, overruns,
+				 expected_underruns, expected_overruns);
+			errors = errors + 1;
+		end
+	end
+endtask
+
+initial begin
+	if ($test$plusargs("vcd")) begin
+		$dumpfile("testlog.vcd");
+		$dumpvars(0);
+	end
+
+	@(negedge codec_rst);
+	settle;
+
+	// Output stopped, every request is an underrun
+	request(UNDERRUNS);
+	settle;
+	check_counters("stopped");
+	if (expected_underruns != UNDERRUNS) begin
+		$display("stopped: %0d of %0d requests were underruns",
+			 expected_underruns, UNDERRUNS);
+		errors = errors + 1;
+	end
+
+	// A sample every other clock with no requests fills the FIFO
+	@(posedge clk);
+	rate_inc <= 1 << 27;
+	repeat (8*DEPTH) @(posedge clk);
+	rate_inc <= 0;
+	settle;
+	check_counters("full");
+	if (fifo_wr_idx != DEPTH || expected_overruns == 0) begin
+		$display("full: %0d samples written, %0d overruns",
+			 fifo_wr_idx, expected_overruns);
+		errors = errors + 1;
+	end
+
+	// Read the FIFO in order and then past its end
+	request(DEPTH + EXTRA_READS);
+	settle;
+	check_counters("drained");
+	if (fifo_rd_idx != DEPTH ||
+	    expected_underruns != UNDERRUNS + EXTRA_READS) begin
+		$display("drained: %0d samples read, %0d underruns",
+			 fifo_rd_idx, expected_underruns);
+		errors = errors + 1;
+	end
+
+	$display("%0d samples, %0d underruns, %0d overruns",
+		 fifo_rd_idx, underruns, overruns);
+	if (errors)
+		$display("FAIL: %0d errors", errors);
+	else
+		$display("PASS");
+	$finish();
+end
+
+endmodule
@@ -0,0 +1,267 @@
+`timescale 1ns/1ns
+//
+// Streams oscillator frequency writes through the pitch converter, one per
+// clock with some idle cycles in between, and checks every write that comes
+// out of it:
+// - the writes leave in the order they were taken, LATENCY clock cycles
+//   later, with their write enable and voice,
+// - writes without bit 31 set are passed through unchanged,
+// - note writes are converted to the phase increment the firmware note_table
+//   is generated from, 2^32*440*2^((pitch-6900)/1200)/clk, within 0.1 cent
+//   or one LSB, over all notes and a range of cents on both sides,
+// - pitches below 0 and above 38399 cents are clamped and increments of
+//   2^31 and more saturate at 2^31-1.
+//
+module sublime_pitch_tb;
+
+parameter NUM_VOICES = 8;
+// TABLES_NOTE_BASE of the firmware for a 50 MHz clock
+parameter NOTE_BASE = 736410503;
+parameter CLK_FREQ = 50e6;
+
+localparam LATENCY = 5;
+localparam MAX_WRITES = 2048;
+localparam NUM_CENTS = 9;
+
+reg 			clk = 1'b1;
+reg 			rst = 1'b1;
+
+reg			freq0_we_i = 0;
+reg			freq1_we_i = 0;
+reg [$clog2(NUM_VOICES)-1:0] freq_write_voice_i = 0;
+reg [31:0]		freq_write_data_i = 0;
+
+wire			freq0_we;
+wire			freq1_we;
+wire [$clog2(NUM_VOICES)-1:0] freq_write_voice;
+wire [31:0]		freq_write_data;
+
+vlog_tb_utils vlog_tb_utils0();
+
+always #10 clk <= ~clk;
+initial #100 rst = 0;
+
+sublime_pitch #(
+	.NUM_VOICES		(NUM_VOICES)
+) dut (
+	.clk			(clk),
+	.rst			(rst),
+	.note_base		(NOTE_BASE),
+	.freq0_we_i		(freq0_we_i),
+	.freq1_we_i		(freq1_we_i),
+	.freq_write_voice_i	(freq_write_voice_i),
+	.freq_write_data_i	(freq_write_data_i),
+	.freq0_we		(freq0_we),
+	.freq1_we		(freq1_we),
+	.freq_write_voice	(freq_write_voice),
+	.freq_write_data	(freq_write_data)
+);
+
+// The writes in the order they are issued
+reg [1:0]		wr_we[0:MAX_WRITES-1];
+reg [$clog2(NUM_VOICES)-1:0] wr_voice[0:MAX_WRITES-1];
+reg [31:0]		wr_data[0:MAX_WRITES-1];
+integer			wr_cycle[0:MAX_WRITES-1];
+integer			num_writes = 0;
+integer			out_idx = 0;
+
+integer			cycle = 0;
+integer			errors = 0;
+integer			saturated = 0;
+integer			clamped = 0;
+
+integer			cents_list[0:NUM_CENTS-1];
+integer			note;
+integer			c;
+integer			i;
+
+always @(posedge clk)
+	cycle <= cycle + 1;
+
+function [31:0] note_write;
+	input integer note;
+	input integer cents;
+	begin
+		note_write = {1'b1, note[6:0], 8'h0, cents[15:0]};
+	end
+endfunction
+
+task add_write;
+	input [31:0] data;
+	begin
+		wr_we[num_writes] = num_writes % 2 ? 2'b10 : 2'b01;
+		wr_voice[num_writes] = num_writes % NUM_VOICES;
+		wr_data[num_writes] = data;
+		num_writes = num_writes + 1;
+	end
+endtask
+
+// The pitch of a note write in cents, before clamping
+function integer note_pitch;
+	input [31:0] data;
+	integer note;
+	begin
+		note = data[30:24];
+		note_pitch = note*100 + $signed(data[15:0]);
+	end
+endfunction
+
+// The phase increment of a note write, before saturation
+function real expected_inc;
+	input [31:0] data;
+	integer pitch;
+	begin
+		pitch = note_pitch(data);
+		if (pitch < 0)
+			pitch = 0;
+		if (pitch > 38399)
+			pitch = 38399;
+		expected_inc = 4294967296.0*440.0*2.0**((pitch - 6900)/1200.0)/
+			       CLK_FREQ;
+	end
+endfunction
+
+task check_data;
+	input [31:0] data;
+	input [31:0] got;
+	real exp;
+	real diff;
+	integer pitch;
+	begin
+		if (!data[31]) begin
+			if (got !== data) begin
+				$display("write %0d: %h passed through as %h",
+					 out_idx, data, got);
+				errors = errors + 1;
+			end
+		end else begin
+			pitch = note_pitch(data);
+			if (pitch < 0 || pitch > 38399)
+				clamped = clamped + 1;
+
+			exp = expected_inc(data);
+			if (exp >= 2147483648.0) begin
+				saturated = saturated + 1;
+				if (got !== 32'h7fffffff) begin
+					$display("note %0d cents %0d: got %h, expected saturation",
+						 data[30:24], $signed(data[15:0]),
+						 got);
+					errors = errors + 1;
+				end
+			end else begin
+				diff = got - exp;
+				if (diff < 0)
+					diff = -diff;
+				if (diff > 1.0 + exp/16384.0) begin
+					$display("note %0d cents %0d: got %0d, expected %f",
+						 data[30:24], $signed(data[15:0]),
+						 got, exp);
+					errors = errors + 1;
+				end
+			end
+		end
+	end
+endtask
+
+// Every write has to come out in order, LATENCY cycles after it went in
+always @(negedge clk)
+	if (!rst && (freq0_we | freq1_we)) begin
+		if (out_idx >= num_writes) begin
+			$display("unexpected write %h", freq_write_data);
+			errors = errors + 1;
+		end else begin
+			if ({freq1_we, freq0_we} !== wr_we[out_idx] ||
+			    freq_write_voice !== wr_voice[out_idx] ||
+			    cycle - wr_cycle[out_idx] != LATENCY) begin
+				$display("write %0d: we %b voice %0d after %0d cycles, expected we %b voice %0d after %0d",
+					 out_idx, {freq1_we, freq0_we},
+					 freq_write_voice,
+					 cycle - wr_cycle[out_idx],
+					 wr_we[out_idx], wr_voice[out_idx],
+					 LATENCY);
+				errors = errors + 1;
+			end
+			check_data(wr_data[out_idx], freq_write_data);
+		end
+		out_idx = out_idx + 1;
+	end
+
+initial begin
+	if ($test$plusargs("vcd")) begin
+		$dumpfile("testlog.vcd");
+		$dumpvars(0);
+	end
+
+	cents_list[0] = -150;
+	cents_list[1] = -100;
+	cents_list[2] = -37;
+	cents_list[3] = 0;
+	cents_list[4] = 1;
+	cents_list[5] = 50;
+	cents_list[6] = 99;
+	cents_list[7] = 100;
+	cents_list[8] = 250;
+
+	// All notes with cents on both sides, mixed with pass through writes
+	for (note = 0; note < 128; note = note+1)
+		for (c = 0; c < NUM_CENTS; c = c+1) begin
+			add_write(note_write(note, cents_list[c]));
+			if ((note*NUM_CENTS + c) % 5 == 0)
+				add_write((note*NUM_CENTS + c)*32'h01010101 &
+					  32'h7fffffff);
+		end
+
+	// Clamping at both ends, and either side of 2^31
+	add_write(note_write(0, -32768));
+	add_write(note_write(0, -1));
+	add_write(note_write(127, 32767));
+	add_write(note_write(127, 13000));
+	add_write(note_write(127, 13200));
+	add_write(note_write(127, 0));
+	add_write(32'h7fffffff);
+	add_write(32'h0);
+
+	@(negedge rst);
+
+	// One write per clock, with an idle cycle every seventh write. The
+	// inputs change on the falling edge, so a write is taken on the next
+	// rising edge and comes out LATENCY rising edges after that.
+	for (i = 0; i < num_writes; i = i+1) begin
+		@(negedge clk);
+		if (i % 7 == 6) begin
+			freq0_we_i = 0;
+			freq1_we_i = 0;
+			@(negedge clk);
+		end
+		freq0_we_i = wr_we[i][0];
+		freq1_we_i = wr_we[i][1];
+		freq_write_voice_i = wr_voice[i];
+		freq_write_data_i = wr_data[i];
+		wr_cycle[i] = cycle;
+	end
+	@(negedge clk);
+	freq0_we_i = 0;
+	freq1_we_i = 0;
+
+	repeat (2*LATENCY) @(posedge clk);
+
+	if (out_idx != num_writes) begin
+		$display("%0d of %0d writes came out", out_idx, num_writes);
+		errors = errors + 1;
+	end
+	if (!saturated || !clamped) begin
+		$display("%0d saturated and %0d clamped writes, expected some of both",
+			 saturated, clamped);
+		errors = errors + 1;
+	end
+
+	$display("%0d writes, %0d clamped, %0d saturated", num_writes, clamped,
+		 saturated);
+	if (errors)
+		$display("FAIL: %0d errors", errors);
+	else
+		$display("PASS");
+	$finish();
+end
+
+endmodule
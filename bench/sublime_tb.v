@@ -2,6 +2,7 @@
 module sublime_tb;
 
 parameter NUM_VOICES = 8;
+parameter NUM_LANES = 2;
 parameter WAVETABLE_SIZE = 8192;	// Should be a power of 2
 parameter WB_AW = 32;
 parameter WB_DW = 32;
@@ -52,6 +53,7 @@ wb_bfm_master #(
 
 sublime #(
 	.NUM_VOICES(NUM_VOICES),
+	.NUM_LANES(NUM_LANES),
 	.WAVETABLE_SIZE(WAVETABLE_SIZE),	// Should be a power of 2
 	.WB_AW(WB_AW),
 	.WB_DW(WB_DW)
@@ -63,6 +65,13 @@ sublime #(
 	.left_sample(left_sample),
 	.right_sample(right_sample),
 
+	// Codec serial interface, not used
+	.codec_clk(clk),
+	.codec_rst(rst),
+	.codec_bclk(),
+	.codec_lrclk(),
+	.codec_dacdat(),
+
 	// Wishbone slave interface
 	.wb_adr_i(wb_m2s_adr),
 	.wb_dat_i(wb_m2s_dat),
@@ -99,6 +108,10 @@ localparam VOICE2_ENVELOPE	= VOICE2_BASE + 32'hc;
 
 localparam MAIN_CONTROL		= 32'h00000808;
 
+localparam VOICE0_WAVETABLE	= 32'h00001200;
+localparam VOICE1_WAVETABLE	= 32'h00001204;
+localparam VOICE2_WAVETABLE	= 32'h00001208;
+
 localparam WAVETABLE0_BASE	= 32'h00010000;
 localparam WAVETABLE1_BASE	= 32'h00020000;
 
@@ -146,6 +159,11 @@ initial begin
 				    4'hf, err);
 	end
 
+	// Play wavetable0 on osc0 and wavetable1 on osc1
+	wb_bfm_master.write(VOICE0_WAVETABLE, 32'h0100, 4'hf, err);
+	wb_bfm_master.write(VOICE1_WAVETABLE, 32'h0100, 4'hf, err);
+	wb_bfm_master.write(VOICE2_WAVETABLE, 32'h0100, 4'hf, err);
+
 	// Enable oscs and set velocity
 	wb_bfm_master.write(VOICE0_CTRL, 32'h3f03, 4'hf, err);
 	wb_bfm_master.write(VOICE1_CTRL, 32'h3f03, 4'hf, err);
@@ -0,0 +1,213 @@
+`timescale 1ns/1ns
+//
+// Measures the total harmonic distortion of a single sine voice, to compare
+// wavetable sizes with and without interpolation, e.g.
+// -PWAVETABLE_SIZE=8192 -PWAVETABLE_INTERPOLATE=0
+// -PWAVETABLE_SIZE=1024 -PWAVETABLE_INTERPOLATE=1
+//
+// The tone is placed on an exact DFT bin (CYCLES periods in NUM_SAMPLES
+// samples), so no window is needed. THD is computed from the harmonics up to
+// NUM_HARMONICS, THD+N from all the energy that is not in the fundamental.
+// The errors from the table lookup mostly end up in spurs that are not
+// harmonics of the tone, so THD+N is the figure to compare. NUM_SAMPLES is
+// kept well above the table size, so the samples hit phases in between the
+// table entries.
+//
+// THD+N from this bench with -PNUM_VOICES=4:
+//
+//   size  truncated  interpolated
+//   8192  -73.1 dB   below -140 dB
+//   1024  -55.0 dB   -117.0 dB
+//    256  -43.0 dB   -93.0 dB
+//
+// THD is below -184 dB in every case. With 8192 interpolated entries the
+// error is at the level of the rounding of the energies, the figure printed
+// changes with the number of voices and the simulator.
+//
+module sublime_thd_tb;
+
+parameter NUM_VOICES = 8;
+parameter WAVETABLE_SIZE = 8192;	// Should be a power of 2
+parameter WAVETABLE_INTERPOLATE = 1;
+parameter WB_AW = 32;
+parameter WB_DW = 32;
+parameter NUM_SAMPLES = 131072;
+parameter CYCLES = 1005;
+parameter NUM_HARMONICS = 9;
+
+localparam PI = 3.14159265358979;
+
+reg 			clk = 1'b1;
+reg 			rst = 1'b1;
+reg 			err;
+wire [31:0]		left_sample;
+wire [31:0]		right_sample;
+
+wire [WB_AW-1:0]	wb_m2s_adr;
+wire [WB_DW-1:0]	wb_m2s_dat;
+wire [WB_DW/8-1:0]	wb_m2s_sel;
+wire		 	wb_m2s_we;
+wire			wb_m2s_cyc;
+wire			wb_m2s_stb;
+wire [2:0] 		wb_m2s_cti;
+wire [1:0]		wb_m2s_bte;
+wire [WB_DW-1:0]	wb_s2m_dat;
+wire			wb_s2m_ack;
+wire			wb_s2m_err;
+wire			wb_s2m_rty;
+
+vlog_tb_utils vlog_tb_utils0();
+
+always #10 clk <= ~clk; // 50 MHz
+initial #100 rst = 0;
+
+wb_bfm_master wb_bfm_master (
+	.wb_clk_i (clk),
+	.wb_rst_i (rst),
+	.wb_adr_o (wb_m2s_adr),
+	.wb_dat_o (wb_m2s_dat),
+	.wb_sel_o (wb_m2s_sel),
+	.wb_we_o  (wb_m2s_we),
+	.wb_cyc_o (wb_m2s_cyc),
+	.wb_stb_o (wb_m2s_stb),
+	.wb_cti_o (wb_m2s_cti),
+	.wb_bte_o (wb_m2s_bte),
+	.wb_dat_i (wb_s2m_dat),
+	.wb_ack_i (wb_s2m_ack),
+	.wb_err_i (wb_s2m_err),
+	.wb_rty_i (wb_s2m_rty)
+);
+
+sublime #(
+	.NUM_VOICES(NUM_VOICES),
+	.WAVETABLE_SIZE(WAVETABLE_SIZE),	// Should be a power of 2
+	.WAVETABLE_INTERPOLATE(WAVETABLE_INTERPOLATE),
+	.WB_AW(WB_AW),
+	.WB_DW(WB_DW)
+) sublime0 (
+	.clk(clk),
+	.rst(rst),
+
+	// Stereo output streams
+	.left_sample(left_sample),
+	.right_sample(right_sample),
+
+	// Codec serial interface, not used
+	.codec_clk(clk),
+	.codec_rst(rst),
+	.codec_bclk(),
+	.codec_lrclk(),
+	.codec_dacdat(),
+
+	// Wishbone slave interface
+	.wb_adr_i(wb_m2s_adr),
+	.wb_dat_i(wb_m2s_dat),
+	.wb_sel_i(wb_m2s_sel),
+	.wb_we_i(wb_m2s_we),
+	.wb_cyc_i(wb_m2s_cyc),
+	.wb_stb_i(wb_m2s_stb),
+	.wb_cti_i(wb_m2s_cti),
+	.wb_bte_i(wb_m2s_bte),
+	.wb_dat_o(wb_s2m_dat),
+	.wb_ack_o(wb_s2m_ack),
+	.wb_err_o(wb_s2m_err),
+	.wb_rty_o(wb_s2m_rty)
+);
+
+localparam VOICE0_OSC0_FREQ	= 32'h00000000;
+localparam VOICE0_CTRL		= 32'h00000008;
+localparam MAIN_CONTROL		= 32'h00000808;
+localparam WAVETABLE0_BASE	= 32'h00010000;
+
+real			samples[0:NUM_SAMPLES-1];
+integer			sample_period;
+time			t0;
+reg [63:0]		freq;
+integer			i;
+integer			n;
+integer			h;
+
+real			re;
+real			im;
+real			mean;
+real			energy;
+real			fundamental;
+real			harmonics;
+real			harmonic;
+
+// Energy of bin in the captured samples
+task bin_energy;
+	input integer bin;
+	output real e;
+	begin
+		re = 0.0;
+		im = 0.0;
+		for (n = 0; n < NUM_SAMPLES; n = n+1) begin
+			re = re + samples[n] * $cos(2.0*PI*bin*n/NUM_SAMPLES);
+			im = im + samples[n] * $sin(2.0*PI*bin*n/NUM_SAMPLES);
+		end
+		e = 2.0*(re*re + im*im)/NUM_SAMPLES;
+	end
+endtask
+
+initial begin
+	wb_bfm_master.reset();
+
+	// The number of clock cycles per sample
+	@(posedge sublime0.mixed_valid);
+	t0 = $time;
+	@(posedge sublime0.mixed_valid);
+	sample_period = ($time - t0)/20;
+
+	// Write a sine to wavetable0
+	for (i = 0; i < WAVETABLE_SIZE; i = i+1)
+		wb_bfm_master.write(WAVETABLE0_BASE+i*4,
+				    $rtoi((1<<30)*$sin(2.0*PI*i/WAVETABLE_SIZE)),
+				    4'hf, err);
+
+	// Place the tone on a DFT bin, the phase advances by
+	// freq*sample_period every sample
+	freq = ((64'd1 << 32)*CYCLES)/(NUM_SAMPLES*sample_period);
+	if (freq*NUM_SAMPLES*sample_period != (64'd1 << 32)*CYCLES)
+		$display("WARNING: the tone is not on a bin");
+
+	// Enable osc0 of voice0 with full velocity
+	wb_bfm_master.write(VOICE0_CTRL, 32'hff01, 4'hf, err);
+	wb_bfm_master.write(VOICE0_OSC0_FREQ, freq[31:0], 4'hf, err);
+
+	// Assert sync to all voices
+	wb_bfm_master.write(MAIN_CONTROL, 32'h1, 4'hf, err);
+	wb_bfm_master.write(MAIN_CONTROL, 32'h0, 4'hf, err);
+
+	// Let the voice settle and capture the output
+	for (i = 0; i < 16; i = i+1)
+		@(posedge sublime0.mixed_valid);
+	for (i = 0; i < NUM_SAMPLES; i = i+1) begin
+		@(posedge sublime0.mixed_valid);
+		@(posedge clk);
+		samples[i] = $itor($signed(left_sample));
+	end
+
+	mean = 0.0;
+	for (n = 0; n < NUM_SAMPLES; n = n+1)
+		mean = mean + samples[n];
+	mean = mean/NUM_SAMPLES;
+	energy = 0.0;
+	for (n = 0; n < NUM_SAMPLES; n = n+1)
+		energy = energy + (samples[n] - mean)*(samples[n] - mean);
+
+	bin_energy(CYCLES, fundamental);
+	harmonics = 0.0;
+	for (h = 2; h <= NUM_HARMONICS && h*CYCLES < NUM_SAMPLES/2; h = h+1) begin
+		bin_energy(h*CYCLES, harmonic);
+		harmonics = harmonics + harmonic;
+	end
+
+	$display("wavetable size %0d, interpolation %0d",
+		 WAVETABLE_SIZE, WAVETABLE_INTERPOLATE);
+	$display("THD:   %f dB", 10.0*$log10(harmonics/fundamental));
+	$display("THD+N: %f dB", 10.0*$log10((energy - fundamental)/fundamental));
+	$finish();
+end
+
+endmodule
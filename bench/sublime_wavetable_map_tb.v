@@ -0,0 +1,177 @@
+`timescale 1ns/1ns
+//
+// Checks that each oscillator plays the wavetable it selects, directly from
+// its voice wavetable register or through a wavetable map entry, and that a
+// single write to the map entry switches the voice over. The tables are
+// filled with constants of different value and sign, so the output tells
+// which table is played.
+//
+module sublime_wavetable_map_tb;
+
+parameter NUM_VOICES = 8;
+parameter NUM_LANES = 2;
+parameter WAVETABLE_SIZE = 64;		// Should be a power of 2
+parameter WB_AW = 32;
+parameter WB_DW = 32;
+
+reg 			clk = 1'b1;
+reg 			rst = 1'b1;
+reg 			err;
+wire [31:0]		left_sample;
+wire [31:0]		right_sample;
+
+wire [WB_AW-1:0]	wb_m2s_adr;
+wire [WB_DW-1:0]	wb_m2s_dat;
+wire [WB_DW/8-1:0]	wb_m2s_sel;
+wire		 	wb_m2s_we;
+wire			wb_m2s_cyc;
+wire			wb_m2s_stb;
+wire [2:0] 		wb_m2s_cti;
+wire [1:0]		wb_m2s_bte;
+wire [WB_DW-1:0]	wb_s2m_dat;
+wire			wb_s2m_ack;
+wire			wb_s2m_err;
+wire			wb_s2m_rty;
+
+vlog_tb_utils vlog_tb_utils0();
+
+always #10 clk <= ~clk; // 50 MHz
+initial #100 rst = 0;
+
+wb_bfm_master wb_bfm_master (
+	.wb_clk_i (clk),
+	.wb_rst_i (rst),
+	.wb_adr_o (wb_m2s_adr),
+	.wb_dat_o (wb_m2s_dat),
+	.wb_sel_o (wb_m2s_sel),
+	.wb_we_o  (wb_m2s_we),
+	.wb_cyc_o (wb_m2s_cyc),
+	.wb_stb_o (wb_m2s_stb),
+	.wb_cti_o (wb_m2s_cti),
+	.wb_bte_o (wb_m2s_bte),
+	.wb_dat_i (wb_s2m_dat),
+	.wb_ack_i (wb_s2m_ack),
+	.wb_err_i (wb_s2m_err),
+	.wb_rty_i (wb_s2m_rty)
+);
+
+sublime #(
+	.NUM_VOICES(NUM_VOICES),
+	.NUM_LANES(NUM_LANES),
+	.WAVETABLE_SIZE(WAVETABLE_SIZE),	// Should be a power of 2
+	.WB_AW(WB_AW),
+	.WB_DW(WB_DW)
+) sublime0 (
+	.clk(clk),
+	.rst(rst),
+
+	// Stereo output streams
+	.left_sample(left_sample),
+	.right_sample(right_sample),
+
+	// Codec serial interface, not used
+	.codec_clk(clk),
+	.codec_rst(rst),
+	.codec_bclk(),
+	.codec_lrclk(),
+	.codec_dacdat(),
+
+	// Wishbone slave interface
+	.wb_adr_i(wb_m2s_adr),
+	.wb_dat_i(wb_m2s_dat),
+	.wb_sel_i(wb_m2s_sel),
+	.wb_we_i(wb_m2s_we),
+	.wb_cyc_i(wb_m2s_cyc),
+	.wb_stb_i(wb_m2s_stb),
+	.wb_cti_i(wb_m2s_cti),
+	.wb_bte_i(wb_m2s_bte),
+	.wb_dat_o(wb_s2m_dat),
+	.wb_ack_o(wb_s2m_ack),
+	.wb_err_o(wb_s2m_err),
+	.wb_rty_o(wb_s2m_rty)
+);
+
+localparam VOICE0_CTRL		= 32'h00000008;
+localparam VOICE0_WAVETABLE	= 32'h00001200;
+localparam WAVETABLE_MAP5	= 32'h00000854;
+localparam WAVETABLE_BASE	= 32'h00010000;
+
+// A table holds 2*WAVETABLE_SIZE entries with the mipmaps
+localparam TABLE_ENTRIES	= 2*WAVETABLE_SIZE;
+localparam LEVEL		= 32'h20000000;
+
+integer i;
+integer t;
+integer errors = 0;
+reg signed [31:0] full;
+
+// Table t holds LEVEL, -LEVEL, LEVEL/2 and -LEVEL/2 for t = 0..3
+function [31:0] table_level;
+	input integer t;
+	begin
+		table_level = t[0] ? -(LEVEL >> t[1]) : LEVEL >> t[1];
+	end
+endfunction
+
+// Let the change reach the output and compare it with the level of table t,
+// relative to the output of table 0
+task check;
+	input [8*32-1:0] name;
+	input integer t;
+	reg signed [31:0] want;
+	begin
+		#4000;
+		want = t[0] ? -(full >>> t[1]) : full >>> t[1];
+		if ($signed(left_sample) < want - 2 ||
+		    $signed(left_sample) > want + 2) begin
+			$display("%0s: %h, expected %h", name, left_sample, want);
+			errors = errors + 1;
+		end
+	end
+endtask
+
+initial begin
+	wb_bfm_master.reset();
+
+	// Reset all voice registers
+	for (i = 0; i < 4*NUM_VOICES; i = i+1)
+		wb_bfm_master.write(4*i, 32'd0, 4'hf, err);
+
+	for (t = 0; t < 4; t = t+1)
+		for (i = 0; i < TABLE_ENTRIES; i = i+1)
+			wb_bfm_master.write(WAVETABLE_BASE+(t*TABLE_ENTRIES+i)*4,
+					    table_level(t), 4'hf, err);
+
+	// osc0 of voice 0 only, full velocity
+	wb_bfm_master.write(VOICE0_WAVETABLE, 32'h0000, 4'hf, err);
+	wb_bfm_master.write(VOICE0_CTRL, 32'hff01, 4'hf, err);
+	#4000;
+	full = left_sample;
+	if (full <= 0) begin
+		$display("table 0: %h", full);
+		errors = errors + 1;
+	end
+
+	wb_bfm_master.write(VOICE0_WAVETABLE, 32'h0001, 4'hf, err);
+	check("table 1", 1);
+
+	// Through map entry 5, which is switched with one write
+	wb_bfm_master.write(WAVETABLE_MAP5, 32'h0002, 4'hf, err);
+	wb_bfm_master.write(VOICE0_WAVETABLE, 32'h850001, 4'hf, err);
+	check("map entry 5, table 2", 2);
+	wb_bfm_master.write(WAVETABLE_MAP5, 32'h0003, 4'hf, err);
+	check("map entry 5, table 3", 3);
+
+	// Back to the table in the voice register
+	wb_bfm_master.write(VOICE0_WAVETABLE, 32'h000001, 4'hf, err);
+	check("map off, table 1", 1);
+
+	$display("table 0 plays as %h", full);
+	if (errors)
+		$display("FAIL: %0d errors", errors);
+	else
+		$display("PASS");
+	$finish();
+end
+
+endmodule
@@ -0,0 +1,146 @@
+`timescale 1ns/1ns
+//
+// Fills the wavetable bank with random entries and reads it back at random
+// tables, phases and mipmap levels, including levels above the last one.
+// Each read is compared with the interpolated (or truncated) value computed
+// from a copy of the tables, e.g.
+// -PINTERPOLATE=0 -PMIPMAP=0
+//
+module sublime_wavetable_tb;
+
+parameter SIZE = 64;
+parameter COUNT = 4;
+parameter INTERPOLATE = 1;
+parameter MIPMAP = 1;
+parameter NUM_READS = 4096;
+
+localparam AW = $clog2(SIZE);
+localparam TW = $clog2(COUNT);
+localparam BW = AW + MIPMAP;
+localparam LEVELS = MIPMAP ? AW-1 : 1;
+localparam ENTRIES = COUNT << BW;
+
+reg 			clk = 1'b1;
+
+reg [TW-1:0]		table_sel = 0;
+reg [31:0]		phase = 0;
+reg [5:0]		level = 0;
+wire [31:0]		data;
+reg			we = 0;
+reg [TW+BW-1:0]		write_addr = 0;
+reg [31:0]		write_data = 0;
+
+reg [31:0]		entries[0:ENTRIES-1];
+reg [31:0]		expected[0:2];
+integer			reads = 0;
+integer			errors = 0;
+integer			i;
+reg [31:0]		rnd = 1;
+
+vlog_tb_utils vlog_tb_utils0();
+
+always #10 clk <= ~clk;
+
+sublime_wavetable #(
+	.SIZE		(SIZE),
+	.COUNT		(COUNT),
+	.INTERPOLATE	(INTERPOLATE),
+	.MIPMAP		(MIPMAP)
+) dut (
+	.clk		(clk),
+	.table_sel	(table_sel),
+	.phase		(phase),
+	.level		(level),
+	.data		(data),
+	.we		(we),
+	.write_addr	(write_addr),
+	.write_data	(write_data)
+);
+
+// xorshift32, so every simulator runs the same reads
+task next_rnd;
+	begin
+		rnd = rnd ^ (rnd << 13);
+		rnd = rnd ^ (rnd >> 17);
+		rnd = rnd ^ (rnd << 5);
+	end
+endtask
+
+// The value read from table t at phase p and level l
+function [31:0] lookup;
+	input integer t;
+	input [31:0] p;
+	input [5:0] l;
+	integer lvl;
+	integer n;
+	integer base;
+	integer idx;
+	reg [43:0] pe;
+	reg [11:0] frac;
+	reg signed [31:0] a;
+	reg signed [31:0] b;
+	reg signed [63:0] delta;
+	begin
+		lvl = l < LEVELS ? l : LEVELS-1;
+		n = SIZE >> lvl;
+		base = MIPMAP ? 2*SIZE - 2*n : 0;
+		pe = {p, 12'h0} >> lvl;
+		idx = pe >> (44-AW);
+		frac = INTERPOLATE ? pe >> (32-AW) : 0;
+		a = entries[(t << BW) + base + idx];
+		b = entries[(t << BW) + base + (idx+1) % n];
+		delta = (b - a) * $signed({1'b0, frac});
+		lookup = a + (delta >>> 12);
+	end
+endfunction
+
+// The data is valid two cycles after the read
+always @(posedge clk) begin
+	if (reads > 2 && data !== expected[2]) begin
+		if (errors < 10)
+			$display("read %0d: %h, expected %h", reads-2, data,
+				 expected[2]);
+		errors = errors + 1;
+	end
+	expected[2] <= expected[1];
+	expected[1] <= expected[0];
+end
+
+initial begin
+	if ($test$plusargs("vcd")) begin
+		$dumpfile("testlog.vcd");
+		$dumpvars(0);
+	end
+
+	for (i = 0; i < ENTRIES; i = i+1) begin
+		next_rnd;
+		entries[i] = rnd;
+		@(negedge clk);
+		we = 1;
+		write_addr = i;
+		write_data = entries[i];
+	end
+	@(negedge clk);
+	we = 0;
+
+	for (reads = 1; reads <= NUM_READS+2; reads = reads+1) begin
+		next_rnd;
+		table_sel = rnd;
+		next_rnd;
+		phase = rnd;
+		next_rnd;
+		level = rnd % (LEVELS+2);
+		expected[0] = lookup(table_sel, phase, level);
+		@(negedge clk);
+	end
+
+	$display("%0d reads, %0d tables of %0d entries, %0d levels",
+		 NUM_READS, COUNT, SIZE, LEVELS);
+	if (errors)
+		$display("FAIL: %0d errors", errors);
+	else
+		$display("PASS");
+	$finish();
+end
+
+endmodule
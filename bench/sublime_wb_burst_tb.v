@@ -0,0 +1,239 @@
+`timescale 1ns/1ns
+//
+// Measures the write throughput into the wavetables and voice registers,
+// with classic single cycles and with incrementing bursts. The bursts are
+// also run with the master inserting wait states, during which the slave
+// may not ack.
+//
+module sublime_wb_burst_tb;
+
+parameter NUM_VOICES = 8;
+parameter NUM_LANES = 2;
+parameter WAVETABLE_SIZE = 8192;	// Should be a power of 2
+parameter WB_AW = 32;
+parameter WB_DW = 32;
+parameter NUM_WORDS = 1024;
+
+reg 			clk = 1'b1;
+reg 			rst = 1'b1;
+wire [31:0]		left_sample;
+wire [31:0]		right_sample;
+
+reg [WB_AW-1:0]		wb_m2s_adr = 0;
+reg [WB_DW-1:0]		wb_m2s_dat = 0;
+wire [WB_DW/8-1:0]	wb_m2s_sel = 4'hf;
+reg		 	wb_m2s_we = 0;
+reg			wb_m2s_cyc = 0;
+reg			wb_m2s_stb = 0;
+reg [2:0] 		wb_m2s_cti = 0;
+wire [1:0]		wb_m2s_bte = 0;
+wire [WB_DW-1:0]	wb_s2m_dat;
+wire			wb_s2m_ack;
+wire			wb_s2m_err;
+wire			wb_s2m_rty;
+
+vlog_tb_utils vlog_tb_utils0();
+
+always #10 clk <= ~clk; // 50 MHz
+initial #100 rst = 0;
+
+sublime #(
+	.NUM_VOICES(NUM_VOICES),
+	.NUM_LANES(NUM_LANES),
+	.WAVETABLE_SIZE(WAVETABLE_SIZE),	// Should be a power of 2
+	.WB_AW(WB_AW),
+	.WB_DW(WB_DW)
+) sublime0 (
+	.clk(clk),
+	.rst(rst),
+
+	// Stereo output streams
+	.left_sample(left_sample),
+	.right_sample(right_sample),
+
+	// Codec serial interface, not used
+	.codec_clk(clk),
+	.codec_rst(rst),
+	.codec_bclk(),
+	.codec_lrclk(),
+	.codec_dacdat(),
+
+	// Wishbone slave interface
+	.wb_adr_i(wb_m2s_adr),
+	.wb_dat_i(wb_m2s_dat),
+	.wb_sel_i(wb_m2s_sel),
+	.wb_we_i(wb_m2s_we),
+	.wb_cyc_i(wb_m2s_cyc),
+	.wb_stb_i(wb_m2s_stb),
+	.wb_cti_i(wb_m2s_cti),
+	.wb_bte_i(wb_m2s_bte),
+	.wb_dat_o(wb_s2m_dat),
+	.wb_ack_o(wb_s2m_ack),
+	.wb_err_o(wb_s2m_err),
+	.wb_rty_o(wb_s2m_rty)
+);
+
+localparam CTI_CLASSIC		= 3'b000;
+localparam CTI_INC_BURST	= 3'b010;
+localparam CTI_END_OF_BURST	= 3'b111;
+
+localparam VOICE0_BASE		= 32'h00000000;
+// Wavetables 0 and 1, with 8192 entry mipmapped wavetables
+localparam WAVETABLE0_BASE	= 32'h00010000;
+localparam WAVETABLE1_BASE	= 32'h00020000;
+
+integer cycles;
+integer errors = 0;
+integer i;
+
+// Entry i of wavetable t, the wavetables are split in even and odd entries.
+// With the mipmaps a wavetable holds 2*WAVETABLE_SIZE entries.
+`define WAVETABLE_ENTRY(t, i) \
+	((i) % 2 ? sublime0.voice_ctrl0.lane_gen[0].wavetable0.odd.mem[(t)*WAVETABLE_SIZE+(i)/2] : \
+		   sublime0.voice_ctrl0.lane_gen[0].wavetable0.even.mem[(t)*WAVETABLE_SIZE+(i)/2])
+
+// Bit 31 is kept clear, in the oscillator frequency registers it would
+// select the note conversion.
+function [31:0] pattern;
+	input [31:0] idx;
+	input [31:0] seed;
+	pattern = (idx * 32'h9e3779b9 ^ seed) & 32'h7fffffff;
+endfunction
+
+//
+// Write len words starting at adr, either as one incrementing burst or as
+// back to back classic cycles. With wait_states set, stb is dropped for a
+// cycle every third cycle of a burst. The number of cycles from the start
+// of the first transfer until the last ack is returned in cycles. Returns
+// once the last write has reached the registers.
+//
+task write_words;
+	input [31:0] adr;
+	input integer len;
+	input burst;
+	input wait_states;
+	input [31:0] seed;
+	integer beat;
+	begin
+		@(posedge clk);
+		cycles = 0;
+		beat = 0;
+		wb_m2s_cyc <= 1;
+		wb_m2s_stb <= 1;
+		wb_m2s_we <= 1;
+		wb_m2s_adr <= adr;
+		wb_m2s_dat <= pattern(0, seed);
+		wb_m2s_cti <= !burst ? CTI_CLASSIC :
+			      len == 1 ? CTI_END_OF_BURST : CTI_INC_BURST;
+		while (beat < len) begin
+			@(posedge clk);
+			cycles = cycles + 1;
+			if (wb_s2m_ack & wb_m2s_stb) begin
+				beat = beat + 1;
+				wb_m2s_adr <= adr + 4*beat;
+				wb_m2s_dat <= pattern(beat, seed);
+				wb_m2s_cti <= !burst ? CTI_CLASSIC :
+					      beat == len-1 ? CTI_END_OF_BURST :
+					      CTI_INC_BURST;
+			end
+			if (burst & wait_states)
+				wb_m2s_stb <= cycles % 3 != 2;
+		end
+		wb_m2s_cyc <= 0;
+		wb_m2s_stb <= 0;
+		wb_m2s_we <= 0;
+		wb_m2s_cti <= CTI_CLASSIC;
+		@(posedge clk);
+	end
+endtask
+
+// Acks are only allowed while stb is asserted
+always @(posedge clk)
+	if (wb_s2m_ack & !wb_m2s_stb) begin
+		$display("ack without stb at %0t", $time);
+		errors = errors + 1;
+	end
+
+task report;
+	input [8*40-1:0] name;
+	input integer len;
+	begin
+		$display("%0s: %0d words in %0d cycles, %f words/cycle",
+			 name, len, cycles, len*1.0/cycles);
+	end
+endtask
+
+// The frequencies are checked in the NCOs of lane 0, which hold the voices
+// slot*NUM_LANES.
+task check_voices;
+	input [31:0] seed;
+	begin
+		// The frequency writes pass through the pitch conversion pipeline
+		repeat (8) @(posedge clk);
+		for (i = 0; i < NUM_VOICES; i = i+1) begin
+			if ((i % NUM_LANES == 0 &&
+			     (sublime0.voice_ctrl0.lane_gen[0].nco0.freq_ram.mem[i/NUM_LANES] !==
+			      pattern(4*i, seed) ||
+			      sublime0.voice_ctrl0.lane_gen[0].nco1.freq_ram.mem[i/NUM_LANES] !==
+			      pattern(4*i+1, seed))) ||
+			    sublime0.wb_slave0.voice_ctrl[i] !==
+			    pattern(4*i+2, seed) ||
+			    sublime0.wb_slave0.voice_envelope[i] !==
+			    pattern(4*i+3, seed)) begin
+				$display("voice%0d registers mismatch", i);
+				errors = errors + 1;
+			end
+		end
+	end
+endtask
+
+initial begin
+	@(negedge rst);
+
+	write_words(WAVETABLE0_BASE, NUM_WORDS, 0, 0, 32'h0);
+	report("wavetable0 classic", NUM_WORDS);
+	for (i = 0; i < NUM_WORDS; i = i+1) begin
+		if (`WAVETABLE_ENTRY(0, i) !==
+		    pattern(i, 0)) begin
+			$display("wavetable0[%0d] mismatch", i);
+			errors = errors + 1;
+		end
+	end
+
+	write_words(WAVETABLE1_BASE, NUM_WORDS, 1, 0, 32'h5a5a5a5a);
+	report("wavetable1 burst", NUM_WORDS);
+	for (i = 0; i < NUM_WORDS; i = i+1) begin
+		if (`WAVETABLE_ENTRY(1, i) !==
+		    pattern(i, 32'h5a5a5a5a)) begin
+			$display("wavetable1[%0d] mismatch", i);
+			errors = errors + 1;
+		end
+	end
+
+	write_words(WAVETABLE1_BASE, NUM_WORDS, 1, 1, 32'h3c3c3c3c);
+	report("wavetable1 burst, wait states", NUM_WORDS);
+	for (i = 0; i < NUM_WORDS; i = i+1) begin
+		if (`WAVETABLE_ENTRY(1, i) !==
+		    pattern(i, 32'h3c3c3c3c)) begin
+			$display("wavetable1[%0d] mismatch with wait states", i);
+			errors = errors + 1;
+		end
+	end
+
+	// Stream all voice register blocks in one burst
+	write_words(VOICE0_BASE, 4*NUM_VOICES, 1, 0, 32'h0);
+	report("voice registers burst", 4*NUM_VOICES);
+	check_voices(32'h0);
+
+	write_words(VOICE0_BASE, 4*NUM_VOICES, 1, 1, 32'h1234567);
+	report("voice registers burst, wait states", 4*NUM_VOICES);
+	check_voices(32'h1234567);
+
+	if (errors)
+		$display("FAIL: %0d errors", errors);
+	else
+		$display("PASS");
+	$finish();
+end
+
+endmodule
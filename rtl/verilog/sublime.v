@@ -27,7 +27,17 @@
 
 module sublime #(
 	parameter NUM_VOICES = 8,
-	parameter WAVETABLE_SIZE = 8192,	// Should be a power of 2
+	parameter NUM_LANES = 2,		// Voices processed in parallel
+	parameter WAVETABLE_SIZE = 2048,	// Should be a power of 2
+	parameter WAVETABLE_COUNT = 8,		// Should be a power of 2
+	parameter WAVETABLE_INTERPOLATE = 1,	// Interpolate wavetable reads
+	parameter WAVETABLE_MIPMAP = 1,		// Band limited octave copies
+	parameter ENVELOPE_CLK_DIV = 1024,	// Clocks per envelope step, at
+						// least 5*NUM_VOICES/NUM_LANES
+	parameter OUTPUT_FIFO_AW = 5,		// log2 of the output FIFO depth
+	parameter I2S_WORD_LENGTH = 32,		// Codec word length, 16-32 bits
+	parameter I2S_BCLK_DIV = 2,		// codec_clk cycles per BCLK
+	parameter I2S_LEFT_JUSTIFIED = 0,	// 0 = I2S, 1 = left justified
 	parameter WB_AW = 32,
 	parameter WB_DW = 32
 )(
@@ -38,6 +48,13 @@ module sublime #(
 	output [31:0] 	    left_sample,
 	output [31:0] 	    right_sample,
 
+	// Codec serial interface, codec_clk is the codec master clock
+	input 		    codec_clk,
+	input 		    codec_rst,
+	output 		    codec_bclk,
+	output 		    codec_lrclk,
+	output 		    codec_dacdat,
+
 	// Wishbone slave interface
 	input [WB_AW-1:0]   wb_adr_i,
 	input [WB_DW-1:0]   wb_dat_i,
@@ -52,32 +69,77 @@ module sublime #(
 	output 		    wb_err_o,
 	output 		    wb_rty_o
 );
-wire [$clog2(NUM_VOICES)-1:0]		active_voice;
+localparam NUM_SLOTS = NUM_VOICES/NUM_LANES;
+// Clock cycles spent on each voice slot, set by the filter. A sample takes
+// NUM_SLOTS*VOICE_CYCLES clock cycles, five times as many as before the
+// filters were added, so NUM_LANES defaults to 2 to win back a factor of
+// two. Each lane holds its own copy of the wavetables.
+localparam VOICE_CYCLES = 5;
+
+// Voice slot processed by each lane
+wire [$clog2(NUM_SLOTS)-1:0]		next_voice;
+wire [$clog2(NUM_SLOTS)-1:0]		active_voice;
 wire					active_voice_changed;
 
 wire [NUM_VOICES-1:0]			nco0_enable;
 wire [NUM_VOICES-1:0]			nco0_sync;
 wire [NUM_VOICES*8-1:0]			nco0_offset;
-wire [NUM_VOICES*32-1:0]		nco0_freq;
 
 wire [NUM_VOICES-1:0]			nco1_enable;
 wire [NUM_VOICES-1:0]			nco1_sync;
 wire [NUM_VOICES*8-1:0]			nco1_offset;
-wire [NUM_VOICES*32-1:0]		nco1_freq;
+
+wire					nco0_freq_we;
+wire					nco1_freq_we;
+wire [$clog2(NUM_VOICES)-1:0]		nco_freq_write_voice;
+wire [31:0]				nco_freq_write_data;
+wire					bus_nco0_freq_we;
+wire					bus_nco1_freq_we;
+wire [$clog2(NUM_VOICES)-1:0]		bus_nco_freq_write_voice;
+wire [31:0]				bus_nco_freq_write_data;
+wire [31:0]				note_base;
+wire [19:0]				pitch_bend;
 
 wire [NUM_VOICES*3-1:0]			nco_mixmode;
 
-wire 					wavetable0_we;
-wire 				 	wavetable1_we;
-wire [$clog2(WAVETABLE_SIZE)-1:0]	wavetable_write_addr;
+wire [NUM_VOICES*24-1:0]			wavetable_sel;
+wire [16*16-1:0]			wavetable_map;
+wire 					wavetable_we;
+wire [$clog2(WAVETABLE_COUNT)+$clog2(WAVETABLE_SIZE)+WAVETABLE_MIPMAP-1:0] wavetable_write_addr;
 wire [31:0] 				wavetable_write_data;
+wire [4:0]				wavetable_mip_shift;
 
 wire [NUM_VOICES*8-1:0]			velocity;
 wire [7:0] 				voice_velocity[NUM_VOICES-1:0];
-wire [31:0] 				active_voice_data;
+wire [NUM_LANES*32-1:0]			active_voice_data;
+wire [NUM_LANES*8-1:0]			active_voice_velocity;
 wire [31:0] 				mixed_data;
+wire					mixed_valid;
+
+wire [3:0]				output_lpf_shift;
+wire [27:0]				output_rate_inc;
+wire [31:0]				output_overruns;
+wire [31:0]				output_underruns;
+
+wire					codec_sample_req;
+wire [31:0]				codec_left_sample;
+wire [31:0]				codec_right_sample;
+
+wire [NUM_VOICES-1:0]			note_on;
+wire [NUM_VOICES*32-1:0]		envelope;
+wire [31:0]				voice_envelope[NUM_VOICES-1:0];
+wire [NUM_VOICES-1:0]			envelope_trigger;
+wire [NUM_VOICES-1:0]			envelope_active;
+wire					envelope_enable;
+wire [NUM_LANES*9-1:0]			envelope_gain;
+
+wire [NUM_VOICES*32-1:0]		filter;
+wire [31:0]				voice_filter[NUM_VOICES-1:0];
+wire [NUM_LANES-1:0]			filter_done;
+wire [NUM_LANES*32-1:0]			filtered_data;
 
 genvar i;
+genvar l;
 
 assign left_sample = mixed_data;
 assign right_sample = mixed_data;
@@ -85,21 +147,49 @@ assign right_sample = mixed_data;
 generate
 for (i = 0; i < NUM_VOICES; i = i+1) begin : velocity_gen
 	assign voice_velocity[i] = velocity[8*(i+1)-1:8*i];
+	assign voice_envelope[i] = envelope[32*(i+1)-1:32*i];
+	assign voice_filter[i] = filter[32*(i+1)-1:32*i];
 end
 endgenerate
 
 // Signal that indicates that all modules are done processing the
-// the current active voice.
-wire active_voice_done = 1'b1;
+// the current active voice, the filters take the longest.
+wire active_voice_done = &filter_done;
+
+// The oscillator frequency writes go through the note conversion
+sublime_pitch #(
+	.NUM_VOICES			(NUM_VOICES)
+) pitch0 (
+	.clk				(clk),
+	.rst				(rst),
+
+	.note_base			(note_base),
+	// Inputs
+	.freq0_we_i			(bus_nco0_freq_we),
+	.freq1_we_i			(bus_nco1_freq_we),
+	.freq_write_voice_i		(bus_nco_freq_write_voice),
+	.freq_write_data_i		(bus_nco_freq_write_data),
+	// Outputs
+	.freq0_we			(nco0_freq_we),
+	.freq1_we			(nco1_freq_we),
+	.freq_write_voice		(nco_freq_write_voice),
+	.freq_write_data		(nco_freq_write_data)
+);
 
 sublime_voice_ctrl #(
 	.NUM_VOICES			(NUM_VOICES),
-	.WAVETABLE_SIZE			(WAVETABLE_SIZE)
+	.NUM_LANES			(NUM_LANES),
+	.VOICE_CYCLES			(VOICE_CYCLES),
+	.WAVETABLE_SIZE			(WAVETABLE_SIZE),
+	.WAVETABLE_COUNT		(WAVETABLE_COUNT),
+	.INTERPOLATE			(WAVETABLE_INTERPOLATE),
+	.MIPMAP				(WAVETABLE_MIPMAP)
 ) voice_ctrl0 (
 	.clk				(clk),
 	.rst				(rst),
 
 	// Outputs
+	.next_voice			(next_voice),
 	.active_voice			(active_voice),
 	.active_voice_changed		(active_voice_changed),
 	.active_voice_data		(active_voice_data),
@@ -107,38 +197,151 @@ sublime_voice_ctrl #(
 	.active_voice_done		(active_voice_done),
 	.nco0_enable			(nco0_enable),
 	.nco0_sync			(nco0_sync),
-	.nco0_freq			(nco0_freq),
 	.nco0_offset			(nco0_offset),
 	.nco1_enable			(nco1_enable),
 	.nco1_sync			(nco1_sync),
-	.nco1_freq			(nco1_freq),
 	.nco1_offset			(nco1_offset),
+	.nco0_freq_we			(nco0_freq_we),
+	.nco1_freq_we			(nco1_freq_we),
+	.nco_freq_write_voice		(nco_freq_write_voice),
+	.nco_freq_write_data		(nco_freq_write_data),
 	.nco_mixmode			(nco_mixmode),
-	.wavetable0_we			(wavetable0_we),
-	.wavetable0_write_addr		(wavetable_write_addr),
-	.wavetable0_write_data		(wavetable_write_data),
-	.wavetable1_we			(wavetable1_we),
-	.wavetable1_write_addr		(wavetable_write_addr),
-	.wavetable1_write_data		(wavetable_write_data)
+	.wavetable_sel			(wavetable_sel),
+	.wavetable_map			(wavetable_map),
+	.wavetable_we			(wavetable_we),
+	.wavetable_write_addr		(wavetable_write_addr),
+	.wavetable_write_data		(wavetable_write_data),
+	.wavetable_mip_shift		(wavetable_mip_shift),
+	.pitch_bend			(pitch_bend)
 );
 
+// Each lane has its own envelope generator and filter for the voices in the
+// lane
+generate
+for (l = 0; l < NUM_LANES; l = l+1) begin : lane_gen
+	wire [$clog2(NUM_VOICES)-1:0]	voice;
+	wire [NUM_SLOTS-1:0]		lane_envelope_active;
+	wire [7:0]			envelope_level;
+
+	assign voice = active_voice*NUM_LANES + l;
+
+	for (i = 0; i < NUM_SLOTS; i = i+1) begin : active_gen
+		assign envelope_active[i*NUM_LANES + l] =
+			lane_envelope_active[i];
+	end
+
+	assign active_voice_velocity[8*(l+1)-1:8*l] = voice_velocity[voice];
+
+	// Map the envelope level to a gain where 256 is unity
+	assign envelope_gain[9*(l+1)-1:9*l] = envelope_enable ?
+		envelope_level + envelope_level[7] : 9'h100;
+
+	sublime_envelope #(
+		.NUM_VOICES			(NUM_SLOTS),
+		.VOICE_CYCLES			(VOICE_CYCLES),
+		.CLK_DIV			(ENVELOPE_CLK_DIV)
+	) envelope0 (
+		.clk				(clk),
+		.rst				(rst),
+
+		// Outputs
+		.level				(envelope_level),
+		.active				(lane_envelope_active),
+		// Inputs
+		.next_voice			(next_voice),
+		.active_voice			(active_voice),
+		.active_voice_changed		(active_voice_changed),
+		.gate				(note_on[voice]),
+		.trigger			(envelope_trigger[voice]),
+		.params				(voice_envelope[voice])
+	);
+
+	sublime_filter #(
+		.NUM_VOICES			(NUM_SLOTS),
+		.CYCLES				(VOICE_CYCLES)
+	) filter0 (
+		.clk				(clk),
+		.rst				(rst),
+
+		// Outputs
+		.data				(filtered_data[32*(l+1)-1:32*l]),
+		.done				(filter_done[l]),
+		// Inputs
+		.next_voice			(next_voice),
+		.active_voice			(active_voice),
+		.active_voice_changed		(active_voice_changed),
+		.active_voice_data		(active_voice_data[32*(l+1)-1:32*l]),
+		.params				(voice_filter[voice])
+	);
+end
+endgenerate
+
+// The filtered voices are valid in the last cycle of each voice slot
+
 sublime_voice_mixer #(
-	.NUM_VOICES			(NUM_VOICES)
+	.NUM_VOICES			(NUM_VOICES),
+	.NUM_LANES			(NUM_LANES)
 ) voice_mixer0 (
 	// Outputs
 	.mixed_data			(mixed_data),
+	.mixed_valid			(mixed_valid),
 	// Inputs
 	.clk				(clk),
 	.rst				(rst),
 	.active_voice			(active_voice),
-	.active_voice_changed		(active_voice_changed),
-	.active_voice_velocity		(voice_velocity[active_voice]),
-	.active_voice_data		(active_voice_data)
+	.active_voice_changed		(active_voice_done),
+	.active_voice_velocity		(active_voice_velocity),
+	.active_voice_envelope		(envelope_gain),
+	.active_voice_data		(filtered_data)
+);
+
+sublime_output #(
+	.FIFO_AW			(OUTPUT_FIFO_AW)
+) output0 (
+	.clk				(clk),
+	.rst				(rst),
+
+	// Outputs
+	.overruns			(output_overruns),
+	.underruns			(output_underruns),
+	.codec_left_sample		(codec_left_sample),
+	.codec_right_sample		(codec_right_sample),
+	// Inputs
+	.left_sample			(left_sample),
+	.right_sample			(right_sample),
+	.sample_valid			(mixed_valid),
+	.lpf_shift			(output_lpf_shift),
+	.rate_inc			(output_rate_inc),
+	.codec_clk			(codec_clk),
+	.codec_rst			(codec_rst),
+	.codec_sample_req		(codec_sample_req)
+);
+
+sublime_i2s_tx #(
+	.WORD_LENGTH			(I2S_WORD_LENGTH),
+	.BCLK_DIV			(I2S_BCLK_DIV),
+	.LEFT_JUSTIFIED			(I2S_LEFT_JUSTIFIED)
+) i2s_tx0 (
+	.clk				(codec_clk),
+	.rst				(codec_rst),
+
+	// Outputs
+	.sample_req			(codec_sample_req),
+	.bclk				(codec_bclk),
+	.lrclk				(codec_lrclk),
+	.dacdat				(codec_dacdat),
+	// Inputs
+	.left_sample			(codec_left_sample),
+	.right_sample			(codec_right_sample)
 );
 
 sublime_wb_slave #(
 	.NUM_VOICES			(NUM_VOICES),
-	.WAVETABLE_SIZE			(WAVETABLE_SIZE)
+	.WAVETABLE_SIZE			(WAVETABLE_SIZE),
+	.WAVETABLE_COUNT		(WAVETABLE_COUNT),
+	.WAVETABLE_INTERPOLATE		(WAVETABLE_INTERPOLATE),
+	.WAVETABLE_MIPMAP		(WAVETABLE_MIPMAP),
+	.SAMPLE_PERIOD			(NUM_SLOTS*VOICE_CYCLES)
 ) wb_slave0 (
 	.clk				(clk),
 	.rst				(rst),
@@ -146,17 +349,33 @@ sublime_wb_slave #(
 	.nco0_enable			(nco0_enable),
 	.nco0_sync			(nco0_sync),
 	.nco0_offset			(nco0_offset),
-	.nco0_freq			(nco0_freq),
 	.nco1_enable			(nco1_enable),
 	.nco1_sync			(nco1_sync),
 	.nco1_offset			(nco1_offset),
-	.nco1_freq			(nco1_freq),
-	.wavetable0_we			(wavetable0_we),
-	.wavetable1_we			(wavetable1_we),
+	.nco0_freq_we			(bus_nco0_freq_we),
+	.nco1_freq_we			(bus_nco1_freq_we),
+	.nco_freq_write_voice		(bus_nco_freq_write_voice),
+	.nco_freq_write_data		(bus_nco_freq_write_data),
+	.wavetable_sel			(wavetable_sel),
+	.wavetable_map			(wavetable_map),
+	.wavetable_we			(wavetable_we),
 	.wavetable_write_addr		(wavetable_write_addr),
 	.wavetable_write_data		(wavetable_write_data),
+	.wavetable_mip_shift		(wavetable_mip_shift),
 	.velocity			(velocity),
 	.nco_mixmode			(nco_mixmode),
+	.note_on			(note_on),
+	.envelope			(envelope),
+	.envelope_trigger		(envelope_trigger),
+	.envelope_enable		(envelope_enable),
+	.envelope_active		(envelope_active),
+	.filter				(filter),
+	.output_lpf_shift		(output_lpf_shift),
+	.output_rate_inc		(output_rate_inc),
+	.note_base			(note_base),
+	.pitch_bend			(pitch_bend),
+	.output_overruns		(output_overruns),
+	.output_underruns		(output_underruns),
 
 	.left_sample			(left_sample),
 	.right_sample			(right_sample),
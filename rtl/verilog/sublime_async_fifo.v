@@ -0,0 +1,116 @@
+/*
+ * Sublime - Subtractive synthesizer
+ *
+ * Copyright (c) 2013, Stefan Kristiansson <stefan.kristiansson@saunalahti.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and non-source forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in non-source form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS WORK IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * WORK, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// Asynchronous FIFO.
+// The read and write pointers are passed between the clock domains as gray
+// code through two flop synchronizers, so the full and empty flags are
+// conservative: a slot freed by a read (or filled by a write) is seen by the
+// other side a few clock cycles later.
+// The read data is registered and updated on the clock after rd_en.
+//
+
+module sublime_async_fifo #(
+	parameter DATA_WIDTH = 32,
+	parameter ADDR_WIDTH = 4
+)(
+	input 			    wr_clk,
+	input 			    wr_rst,
+	input 			    wr_en,
+	input [DATA_WIDTH-1:0] 	    wr_data,
+	output reg 		    full,
+
+	input 			    rd_clk,
+	input 			    rd_rst,
+	input 			    rd_en,
+	output reg [DATA_WIDTH-1:0] rd_data,
+	output reg 		    empty
+);
+
+reg [DATA_WIDTH-1:0]	mem[(1<<ADDR_WIDTH)-1:0];
+
+reg [ADDR_WIDTH:0]	wr_bin;
+reg [ADDR_WIDTH:0]	wr_gray;
+reg [ADDR_WIDTH:0]	rd_gray_wr1;
+reg [ADDR_WIDTH:0]	rd_gray_wr2;
+
+reg [ADDR_WIDTH:0]	rd_bin;
+reg [ADDR_WIDTH:0]	rd_gray;
+reg [ADDR_WIDTH:0]	wr_gray_rd1;
+reg [ADDR_WIDTH:0]	wr_gray_rd2;
+
+wire [ADDR_WIDTH:0]	wr_bin_next = wr_bin + (wr_en & !full);
+wire [ADDR_WIDTH:0]	wr_gray_next = (wr_bin_next >> 1) ^ wr_bin_next;
+wire [ADDR_WIDTH:0]	rd_bin_next = rd_bin + (rd_en & !empty);
+wire [ADDR_WIDTH:0]	rd_gray_next = (rd_bin_next >> 1) ^ rd_bin_next;
+
+// Write side
+always @(posedge wr_clk)
+	if (wr_en & !full)
+		mem[wr_bin[ADDR_WIDTH-1:0]] <= wr_data;
+
+always @(posedge wr_clk)
+	if (wr_rst) begin
+		wr_bin <= 0;
+		wr_gray <= 0;
+		rd_gray_wr1 <= 0;
+		rd_gray_wr2 <= 0;
+		full <= 0;
+	end else begin
+		wr_bin <= wr_bin_next;
+		wr_gray <= wr_gray_next;
+		rd_gray_wr1 <= rd_gray;
+		rd_gray_wr2 <= rd_gray_wr1;
+		// Full when the pointers differ only in the wrap bit, which
+		// in gray code are the two top bits
+		full <= wr_gray_next == {~rd_gray_wr2[ADDR_WIDTH:ADDR_WIDTH-1],
+					 rd_gray_wr2[ADDR_WIDTH-2:0]};
+	end
+
+// Read side
+always @(posedge rd_clk)
+	if (rd_rst)
+		rd_data <= 0;
+	else if (rd_en & !empty)
+		rd_data <= mem[rd_bin[ADDR_WIDTH-1:0]];
+
+always @(posedge rd_clk)
+	if (rd_rst) begin
+		rd_bin <= 0;
+		rd_gray <= 0;
+		wr_gray_rd1 <= 0;
+		wr_gray_rd2 <= 0;
+		empty <= 1;
+	end else begin
+		rd_bin <= rd_bin_next;
+		rd_gray <= rd_gray_next;
+		wr_gray_rd1 <= wr_gray;
+		wr_gray_rd2 <= wr_gray_rd1;
+		empty <= rd_gray_next == wr_gray_rd2;
+	end
+
+endmodule
\ No newline at end of file
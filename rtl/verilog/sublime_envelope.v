@@ -0,0 +1,206 @@
+/*
+ * Sublime - Subtractive synthesizer
+ *
+ * Copyright (c) 2013, Stefan Kristiansson <stefan.kristiansson@saunalahti.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and non-source forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in non-source form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS WORK IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * WORK, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// ADSR envelope generator.
+// The envelopes of all voices are processed by the same logic, one voice at
+// a time in the same order as the voices are handled by the voice control.
+// The envelope state of each voice is kept in a RAM that is read one clock
+// ahead (at next_voice), in the same manner as the wavetables.
+//
+// The envelopes are stepped once every CLK_DIV clock cycles, with the
+// increment per step given by the 8-bit rate values in the envelope
+// register. A free running divider requests the steps, each request steps
+// the next round of NUM_VOICES*VOICE_CYCLES cycles, so the steps jitter by
+// up to a round but keep the exact rate. CLK_DIV has to be at least a
+// round long, or requests are lost.
+// The rates are encoded as a 4-bit exponent and a 4-bit mantissa
+// with an implicit leading one:
+// increment = {1, rate[3:0]} << rate[7:4]
+// where the envelope level is 24 bits wide.
+//
+// A new attack is started on the rising edge of the gate, or when the
+// trigger input toggles while the gate is high.
+//
+
+module sublime_envelope #(
+	parameter NUM_VOICES = 8,
+	parameter VOICE_CYCLES = 1,
+	parameter CLK_DIV = 1024
+)(
+	input 				clk,
+	input 				rst,
+
+	input [$clog2(NUM_VOICES)-1:0] 	next_voice,
+	input [$clog2(NUM_VOICES)-1:0] 	active_voice,
+	input 				active_voice_changed,
+
+	// Inputs of the active voice
+	input 				gate,
+	input 				trigger,
+	input [31:0] 			params,
+
+	// Envelope level of the active voice
+	output [7:0] 			level,
+	// One bit per voice, asserted when the envelope is not idle
+	output reg [NUM_VOICES-1:0] 	active
+);
+
+localparam IDLE		= 2'd0;
+localparam ATTACK	= 2'd1;
+localparam DECAY	= 2'd2;
+localparam RELEASE	= 2'd3;
+
+
+// Envelope state RAM layout
+// +------------+--------------+-------+-------+
+// |         27 |           26 | 25:24 |  23:0 |
+// +------------+--------------+-------+-------+
+// | trigger    | gate of last | state | level |
+// | last visit | visit        |       |       |
+// +------------+--------------+-------+-------+
+wire [27:0]	rdata;
+wire [27:0]	wdata;
+
+wire		last_trigger = rdata[27];
+wire		last_gate = rdata[26];
+wire [1:0]	state = rdata[25:24];
+wire [23:0]	cur_level = rdata[23:0];
+
+reg [1:0]	next_state;
+reg [23:0]	next_level;
+
+wire [7:0]	attack_rate = params[31:24];
+wire [7:0]	decay_rate = params[23:16];
+wire [23:0]	sustain_level = {params[15:8], 16'h0};
+wire [7:0]	release_rate = params[7:0];
+
+wire [19:0]	attack_inc = {15'h0, 1'b1, attack_rate[3:0]} << attack_rate[7:4];
+wire [19:0]	decay_inc = {15'h0, 1'b1, decay_rate[3:0]} << decay_rate[7:4];
+wire [19:0]	release_inc = {15'h0, 1'b1, release_rate[3:0]} <<
+			      release_rate[7:4];
+
+wire [24:0]	attack_sum = cur_level + attack_inc;
+wire [24:0]	decay_limit = sustain_level + decay_inc;
+
+// The state RAM holds garbage after reset, so it is cleared during the
+// first round of voices. The round starts with voice 0 and the voices are
+// counted down, so voice 1 is the last one to be cleared.
+reg		clearing;
+
+always @(posedge clk)
+	if (rst)
+		clearing <= 1;
+	else if (active_voice_changed && active_voice == 1)
+		clearing <= 0;
+
+// A step requested by the divider is taken during the round of voices
+// that starts next.
+reg [$clog2(CLK_DIV)-1:0] clk_cnt;
+reg		step_req;
+reg		step;
+
+always @(posedge clk)
+	if (rst) begin
+		clk_cnt <= 0;
+		step_req <= 0;
+		step <= 0;
+	end else begin
+		clk_cnt <= (clk_cnt == CLK_DIV-1) ? 0 : clk_cnt + 1;
+		if (clk_cnt == CLK_DIV-1)
+			step_req <= 1;
+		else if (active_voice_changed && active_voice == 0)
+			step_req <= 0;
+		if (active_voice_changed && active_voice == 0)
+			step <= step_req;
+	end
+
+always @(*) begin
+	next_state = state;
+	next_level = cur_level;
+
+	if (gate & (!last_gate | (trigger != last_trigger))) begin
+		next_state = ATTACK;
+	end else if (!gate & (state == ATTACK | state == DECAY)) begin
+		next_state = RELEASE;
+	end else if (step) begin
+		case (state)
+		ATTACK:
+			if (attack_sum[24]) begin
+				next_level = 24'hffffff;
+				next_state = DECAY;
+			end else begin
+				next_level = attack_sum[23:0];
+			end
+
+		// The envelope stays in decay when it has reached the
+		// sustain level
+		DECAY:
+			if (cur_level > decay_limit)
+				next_level = cur_level - decay_inc;
+			else
+				next_level = sustain_level;
+
+		RELEASE:
+			if (cur_level > release_inc) begin
+				next_level = cur_level - release_inc;
+			end else begin
+				next_level = 0;
+				next_state = IDLE;
+			end
+
+		default:
+			;
+		endcase
+	end
+end
+
+assign wdata = clearing ? 0 : {trigger, gate, next_state, next_level};
+assign level = clearing ? 0 : cur_level[23:16];
+
+always @(posedge clk)
+	if (rst)
+		active <= 0;
+	else if (active_voice_changed)
+		active[active_voice] <= !clearing && next_state != IDLE;
+
+sublime_simple_dpram_sclk
+      #(
+	.ADDR_WIDTH($clog2(NUM_VOICES)),
+	.DATA_WIDTH(28)
+	)
+envelope_state
+       (
+	.clk			(clk),
+	.raddr			(next_voice),
+	.waddr			(active_voice),
+	.we			(active_voice_changed),
+	.din			(wdata),
+	.dout			(rdata)
+);
+
+endmodule
@@ -0,0 +1,231 @@
+/*
+ * Sublime - Subtractive synthesizer
+ *
+ * Copyright (c) 2013, Stefan Kristiansson <stefan.kristiansson@saunalahti.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and non-source forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in non-source form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS WORK IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * WORK, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// Voice filter.
+// A state variable filter that is time multiplexed between the voices, in
+// the same manner as the envelopes. The low pass and band pass state of each
+// voice is kept in a RAM that is read one clock ahead (at next_voice) and the
+// three multiplications per sample share a single multiplier:
+//
+// lp = lp + f*bp
+// hp = x - lp - q*bp
+// bp = bp + f*hp
+//
+// The filter coefficients are given per voice in params, the frequency
+// coefficient f = 2*sin(pi*cutoff/sample rate) as an unsigned 0.16 fixed
+// point number and the damping q = 1/resonance as an unsigned 1.11 fixed
+// point number. The state is kept with 4 bits of headroom and all sums
+// saturate.
+//
+// params
+// +--------+---------+----------+------+
+// |  31:16 |    15:4 |      3:2 |  1:0 |
+// +--------+---------+----------+------+
+// | f      | q       | reserved | mode |
+// +--------+---------+----------+------+
+//
+// mode - 0 = bypass, 1 = low pass, 2 = band pass, 3 = high pass
+//
+// A voice is processed over CYCLES clock cycles, starting with the cycle
+// active_voice_changed is asserted. The input is taken in the third cycle
+// and done is asserted in the last cycle, when the filtered output of the
+// active voice is valid.
+// CYCLES has to be at least 5.
+//
+
+module sublime_filter #(
+	parameter NUM_VOICES = 8,
+	parameter CYCLES = 5
+)(
+	input 				clk,
+	input 				rst,
+
+	input [$clog2(NUM_VOICES)-1:0] 	next_voice,
+	input [$clog2(NUM_VOICES)-1:0] 	active_voice,
+	input 				active_voice_changed,
+
+	// Inputs of the active voice
+	input [31:0] 			active_voice_data,
+	input [31:0] 			params,
+
+	output reg [31:0] 		data,
+	output 				done
+);
+
+localparam BYPASS	= 2'd0;
+localparam LOW_PASS	= 2'd1;
+localparam BAND_PASS	= 2'd2;
+localparam HIGH_PASS	= 2'd3;
+
+reg [$clog2(CYCLES)-1:0]	step_r;
+wire [$clog2(CYCLES)-1:0]	step;
+
+// Filter state RAM layout
+// +-------+------+
+// | 71:36 | 35:0 |
+// +-------+------+
+// | lp    | bp   |
+// +-------+------+
+wire [71:0]		rdata;
+wire [71:0]		wdata;
+
+wire signed [35:0]	lp;
+wire signed [35:0]	bp;
+wire signed [35:0]	x_in;
+reg signed [35:0]	x;
+reg signed [35:0]	lp_next;
+reg signed [35:0]	hp;
+wire signed [35:0]	hp_next;
+wire signed [35:0]	bp_sum;
+reg signed [35:0]	bp_next;
+
+wire [15:0]		f = params[31:16];
+wire [11:0]		q = params[15:4];
+wire [1:0]		mode = params[1:0];
+
+reg signed [35:0]	mul_a;
+reg signed [17:0]	mul_b;
+reg signed [53:0]	mul_res;
+wire signed [36:0]	prod;
+
+function [35:0] sat36;
+	input [37:0] val;
+	begin
+		if (val[37:35] == 3'b000 || val[37:35] == 3'b111)
+			sat36 = val[35:0];
+		else
+			sat36 = val[37] ? {1'b1, 35'h0} : {1'b0, {35{1'b1}}};
+	end
+endfunction
+
+function [31:0] sat32;
+	input [35:0] val;
+	begin
+		if (val[35:31] == 5'b00000 || val[35:31] == 5'b11111)
+			sat32 = val[31:0];
+		else
+			sat32 = val[35] ? {1'b1, 31'h0} : {1'b0, {31{1'b1}}};
+	end
+endfunction
+
+// The state RAM holds garbage after reset, so it is cleared during the
+// first round of voices.
+reg		clearing;
+
+always @(posedge clk)
+	if (rst)
+		clearing <= 1;
+	else if (done && next_voice == 0)
+		clearing <= 0;
+
+assign lp = clearing ? 0 : rdata[71:36];
+assign bp = clearing ? 0 : rdata[35:0];
+
+// Step through the processing of the active voice
+assign step = active_voice_changed ? 0 : step_r;
+assign done = step == CYCLES-1;
+
+always @(posedge clk)
+	if (rst)
+		step_r <= 0;
+	else
+		step_r <= step + 1;
+
+// Shared multiplier, the products are available the cycle after the
+// operands are presented.
+// step 0: f*bp
+// step 1: q*bp
+// step 2: f*hp
+assign prod = mul_res[52:16];
+assign x_in = {{4{active_voice_data[31]}}, active_voice_data};
+assign hp_next = sat36(x_in - lp_next - prod);
+assign bp_sum = sat36(bp + prod);
+
+always @(*) begin
+	mul_a = bp;
+	mul_b = {2'b0, f};
+	case (step)
+	1: begin
+		mul_a = bp;
+		mul_b = {1'b0, q, 5'h0};
+	end
+	2: begin
+		mul_a = hp_next;
+		mul_b = {2'b0, f};
+	end
+	default:
+		;
+	endcase
+end
+
+always @(posedge clk)
+	mul_res <= mul_a * mul_b;
+
+always @(posedge clk) begin
+	if (step == 2)
+		x <= x_in;
+	if (step == 1)
+		lp_next <= sat36(lp + prod);
+	if (step == 2)
+		hp <= hp_next;
+	if (step == 3)
+		bp_next <= bp_sum;
+end
+
+always @(posedge clk)
+	if (step == 3) begin
+		case (mode)
+		BYPASS:
+			data <= sat32(x);
+		LOW_PASS:
+			data <= sat32(lp_next);
+		BAND_PASS:
+			data <= sat32(bp_sum);
+		HIGH_PASS:
+			data <= sat32(hp);
+		endcase
+	end
+
+assign wdata = {lp_next, bp_next};
+
+sublime_simple_dpram_sclk
+      #(
+	.ADDR_WIDTH($clog2(NUM_VOICES)),
+	.DATA_WIDTH(72)
+	)
+filter_state
+       (
+	.clk			(clk),
+	.raddr			(next_voice),
+	.waddr			(active_voice),
+	.we			(step == 4),
+	.din			(wdata),
+	.dout			(rdata)
+);
+
+endmodule
\ No newline at end of file
@@ -0,0 +1,109 @@
+/*
+ * Sublime - Subtractive synthesizer
+ *
+ * Copyright (c) 2013, Stefan Kristiansson <stefan.kristiansson@saunalahti.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and non-source forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in non-source form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS WORK IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * WORK, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// I2S transmitter.
+// Serializes the stereo samples to the codec, the transmitter is the master
+// of the serial interface and generates BCLK and LRCLK from the codec master
+// clock.
+//
+// A frame consists of two 32 bit channel slots, left first, and BCLK runs at
+// clk/BCLK_DIV, which gives a sample rate of clk/(64*BCLK_DIV), i.e. mclk/128
+// with the default BCLK_DIV of 2.
+// The WORD_LENGTH most significant bits of the samples are sent, MSB first,
+// the remaining bits of the slot are zero. WORD_LENGTH should match the word
+// length the codec is configured for, 16, 20, 24 or 32 bits.
+//
+// In I2S format (LEFT_JUSTIFIED = 0) LRCLK is low for the left channel and
+// the MSB follows one BCLK after the LRCLK edge. In left justified format
+// LRCLK is high for the left channel and the MSB is aligned with the edge.
+// The data changes on the falling edge of BCLK and is sampled by the codec
+// on the rising edge.
+//
+// sample_req is asserted for one clock cycle at the end of each frame, the
+// next samples are expected on left_sample/right_sample the cycle after.
+//
+// BCLK_DIV has to be a power of 2 and at least 2.
+//
+
+module sublime_i2s_tx #(
+	parameter WORD_LENGTH = 32,
+	parameter BCLK_DIV = 2,
+	parameter LEFT_JUSTIFIED = 0
+)(
+	input 	     clk,
+	input 	     rst,
+
+	output 	     sample_req,
+	input [31:0] left_sample,
+	input [31:0] right_sample,
+
+	output reg   bclk,
+	output reg   lrclk,
+	output reg   dacdat
+);
+
+localparam DIV_BITS = $clog2(BCLK_DIV);
+
+reg [DIV_BITS+5:0]	cnt;
+wire [5:0]		bit_slot;
+wire [5:0]		next_slot;
+wire [31:0]		word_mask;
+reg [62:0]		shift;
+
+assign bit_slot = cnt[DIV_BITS+5:DIV_BITS];
+assign next_slot = bit_slot + 1;
+assign word_mask = ~32'h0 << (32 - WORD_LENGTH);
+
+assign sample_req = &cnt;
+
+always @(posedge clk)
+	if (rst)
+		cnt <= 0;
+	else
+		cnt <= cnt + 1;
+
+always @(posedge clk)
+	if (rst) begin
+		bclk <= 0;
+		lrclk <= LEFT_JUSTIFIED ? 1'b1 : 1'b0;
+		dacdat <= 0;
+		shift <= 0;
+	end else begin
+		bclk <= cnt[DIV_BITS-1];
+		// Falling edge of BCLK
+		if (cnt[DIV_BITS-1:0] == 0) begin
+			lrclk <= LEFT_JUSTIFIED ? !bit_slot[5] : next_slot[5];
+			if (bit_slot == 0)
+				{dacdat, shift} <= {left_sample & word_mask,
+						    right_sample & word_mask};
+			else
+				{dacdat, shift} <= {shift, 1'b0};
+		end
+	end
+
+endmodule
\ No newline at end of file
@@ -26,26 +26,155 @@
  */
 
 //
-// Numerically Controlled Oscillator
+// Numerically Controlled Oscillators
+// Time multiplexed phase accumulators for all voices. The phase and the
+// frequency of each voice are kept in RAM and the voices share a single
+// adder, each voice is advanced when it is processed, i.e. once per sample.
+// Since a voice is processed for VOICE_CYCLES clock cycles, a sample takes
+// NUM_VOICES*VOICE_CYCLES clock cycles and the frequency is scaled by that
+// to give the same pitch as a phase accumulator that is advanced every clock
+// cycle.
 //
-module sublime_nco (
-	input 	      clk,
-	input 	      rst,
-	input 	      enable,
-	input 	      sync,
-	input [31:0]  freq,
-	input [31:0]  offset,
-	output [31:0] wave_addr
+// The RAMs are read one voice ahead, so that the wavetable address of
+// next_voice is available in the cycle it is needed. When the voice isn't
+// changed (advance is low), the last wavetable address is held.
+//
+// The mipmap level of the wavetable is picked from the frequency, it is
+// the number of octaves the frequency is above 2^mip_shift, so level L is
+// used for frequencies up to 2^(mip_shift+L). The level is 0 when mip_shift
+// is 0. It is held together with the wavetable address.
+//
+// The frequency of every voice is scaled by bend, a multiplier in 4.16
+// fixed point that is common to all voices, so that pitch bend and tuning
+// don't need any frequency writes. The scaled frequency saturates at
+// 2^31-1, as the output of sublime_pitch does. It is registered, the
+// frequency RAM output is stable from the second cycle of a voice slot, so
+// a voice slot has to last at least three clock cycles.
+//
+// A sync request is remembered until the voice has been processed, the
+// phase is held at zero while sync is asserted. All phases are zeroed
+// after reset.
+//
+module sublime_nco #(
+	parameter NUM_VOICES = 8,
+	parameter VOICE_CYCLES = 1
+)(
+	input 				   clk,
+	input 				   rst,
+
+	input [$clog2(NUM_VOICES)-1:0] 	   next_voice,
+	input 				   advance,
+
+	input 				   enable,
+	input [NUM_VOICES-1:0] 		   sync,
+	input [31:0] 			   offset,
+	input [4:0] 			   mip_shift,
+	input [19:0] 			   bend,
+
+	input 				   freq_we,
+	input [$clog2(NUM_VOICES)-1:0] 	   freq_write_voice,
+	input [31:0] 			   freq_write_data,
+
+	output [31:0] 			   wave_addr,
+	output [5:0] 			   level
 );
 
-// Phase accumulator
-reg [31:0] phase_acc;
+wire [$clog2(NUM_VOICES)-1:0]	prefetch_voice;
+wire [31:0]			phase_rdata;
+wire [31:0]			freq_rdata;
+wire [51:0]			freq_product;
+reg [31:0]			freq;
+wire [31:0]			phase;
+wire [31:0]			next_phase;
+wire				voice_sync;
+reg [NUM_VOICES-1:0]		sync_pending;
+reg [31:0]			wave_addr_r;
+wire [5:0]			freq_bits;
+reg [5:0]			level_r;
+
+// Number of bits needed to represent v
+function [5:0] bit_length;
+	input [31:0] v;
+	integer k;
+	begin
+		bit_length = 0;
+		for (k = 0; k < 32; k = k+1)
+			if (v[k])
+				bit_length = k+1;
+	end
+endfunction
+
+// The voice following next_voice
+assign prefetch_voice = (next_voice == 0) ? NUM_VOICES-1 : next_voice - 1;
+
+assign voice_sync = sync[next_voice] | sync_pending[next_voice];
+
+always @(posedge clk)
+	if (rst) begin
+		sync_pending <= {NUM_VOICES{1'b1}};
+	end else begin
+		sync_pending <= sync_pending | sync;
+		if (advance)
+			sync_pending[next_voice] <= sync[next_voice];
+	end
+
+// Bent frequency
+assign freq_product = freq_rdata * bend;
+
 always @(posedge clk)
-	if (rst | sync)
-		phase_acc <= 0;
+	if (|freq_product[51:47])
+		freq <= 32'h7fffffff;
 	else
-		phase_acc <= phase_acc + freq;
+		freq <= freq_product[47:16];
+
+// Phase accumulator
+assign phase = voice_sync ? 0 : phase_rdata;
+assign next_phase = voice_sync ? 0 : phase + freq * (NUM_VOICES*VOICE_CYCLES);
+
+always @(posedge clk)
+	wave_addr_r <= wave_addr;
+
+assign wave_addr = !advance ? wave_addr_r :
+		   enable ? phase + offset : 0;
 
-assign wave_addr = enable ? phase_acc + offset : 0;
+// Mipmap level
+assign freq_bits = bit_length(freq);
+
+always @(posedge clk)
+	level_r <= level;
+
+assign level = !advance ? level_r :
+	       (mip_shift != 0 && freq_bits > mip_shift) ?
+	       freq_bits - mip_shift : 0;
+
+sublime_simple_dpram_sclk
+      #(
+	.ADDR_WIDTH($clog2(NUM_VOICES)),
+	.DATA_WIDTH(32)
+	)
+phase_ram
+       (
+	.clk			(clk),
+	.raddr			(prefetch_voice),
+	.waddr			(next_voice),
+	.we			(advance),
+	.din			(next_phase),
+	.dout			(phase_rdata)
+);
+
+sublime_simple_dpram_sclk
+      #(
+	.ADDR_WIDTH($clog2(NUM_VOICES)),
+	.DATA_WIDTH(32)
+	)
+freq_ram
+       (
+	.clk			(clk),
+	.raddr			(prefetch_voice),
+	.waddr			(freq_write_voice),
+	.we			(freq_we),
+	.din			(freq_write_data),
+	.dout			(freq_rdata)
+);
 
 endmodule
\ No newline at end of file
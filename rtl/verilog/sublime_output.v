@@ -0,0 +1,167 @@
+/*
+ * Sublime - Subtractive synthesizer
+ *
+ * Copyright (c) 2013, Stefan Kristiansson <stefan.kristiansson@saunalahti.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and non-source forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in non-source form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS WORK IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * WORK, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// Output stage.
+// Resamples the synth output, produced at clk/NUM_VOICES, to the fixed
+// rate of the codec and passes it over to the codec clock domain through
+// an asynchronous FIFO.
+//
+// The samples are low pass filtered at the synth rate by a one pole filter,
+// y += (x - y) >> lpf_shift, and the filter output is sampled at the output
+// rate. The output rate is given as the increment of a 28-bit phase
+// accumulator that is stepped every clock cycle, i.e.
+// rate_inc = 2^28 * output rate / clk frequency
+// An output rate of zero stops the output.
+//
+// A sample that is produced while the FIFO is full is counted as an
+// overrun, a sample requested by the codec while the FIFO is empty is
+// counted as an underrun, in which case the last sample is repeated.
+// The underrun counter is kept in the codec clock domain and passed to the
+// clk domain as gray code.
+//
+
+module sublime_output #(
+	parameter FIFO_AW = 5
+)(
+	input 		  clk,
+	input 		  rst,
+
+	input [31:0] 	  left_sample,
+	input [31:0] 	  right_sample,
+	input 		  sample_valid,
+
+	input [3:0] 	  lpf_shift,
+	input [27:0] 	  rate_inc,
+
+	output reg [31:0] overruns,
+	output [31:0] 	  underruns,
+
+	// Codec clock domain
+	input 		  codec_clk,
+	input 		  codec_rst,
+	input 		  codec_sample_req,
+	output [31:0] 	  codec_left_sample,
+	output [31:0] 	  codec_right_sample
+);
+
+reg [31:0]		left_lp;
+reg [31:0]		right_lp;
+reg [27:0]		rate_acc;
+reg			tick;
+
+wire signed [32:0]	left_diff;
+wire signed [32:0]	right_diff;
+wire signed [32:0]	left_step;
+wire signed [32:0]	right_step;
+
+wire			fifo_full;
+wire			fifo_empty;
+
+reg [31:0]		codec_underruns;
+reg [31:0]		codec_underruns_gray;
+reg [31:0]		underruns_gray1;
+reg [31:0]		underruns_gray2;
+
+function [31:0] gray2bin;
+	input [31:0] gray;
+	integer i;
+	begin
+		gray2bin[31] = gray[31];
+		for (i = 30; i >= 0; i = i - 1)
+			gray2bin[i] = gray2bin[i+1] ^ gray[i];
+	end
+endfunction
+
+// Low pass filter
+assign left_diff = $signed({left_sample[31], left_sample}) -
+		   $signed({left_lp[31], left_lp});
+assign right_diff = $signed({right_sample[31], right_sample}) -
+		    $signed({right_lp[31], right_lp});
+assign left_step = left_diff >>> lpf_shift;
+assign right_step = right_diff >>> lpf_shift;
+
+always @(posedge clk)
+	if (rst) begin
+		left_lp <= 0;
+		right_lp <= 0;
+	end else if (sample_valid) begin
+		left_lp <= left_lp + left_step[31:0];
+		right_lp <= right_lp + right_step[31:0];
+	end
+
+// Output rate
+always @(posedge clk)
+	if (rst) begin
+		rate_acc <= 0;
+		tick <= 0;
+	end else begin
+		{tick, rate_acc} <= rate_acc + rate_inc;
+	end
+
+always @(posedge clk)
+	if (rst)
+		overruns <= 0;
+	else if (tick & fifo_full)
+		overruns <= overruns + 1;
+
+sublime_async_fifo #(
+	.DATA_WIDTH	(64),
+	.ADDR_WIDTH	(FIFO_AW)
+) fifo0 (
+	.wr_clk		(clk),
+	.wr_rst		(rst),
+	.wr_en		(tick),
+	.wr_data	({left_lp, right_lp}),
+	.full		(fifo_full),
+
+	.rd_clk		(codec_clk),
+	.rd_rst		(codec_rst),
+	.rd_en		(codec_sample_req),
+	.rd_data	({codec_left_sample, codec_right_sample}),
+	.empty		(fifo_empty)
+);
+
+// Underrun counter, passed to the clk domain as gray code
+always @(posedge codec_clk)
+	if (codec_rst) begin
+		codec_underruns <= 0;
+		codec_underruns_gray <= 0;
+	end else begin
+		if (codec_sample_req & fifo_empty)
+			codec_underruns <= codec_underruns + 1;
+		codec_underruns_gray <= (codec_underruns >> 1) ^ codec_underruns;
+	end
+
+always @(posedge clk) begin
+	underruns_gray1 <= codec_underruns_gray;
+	underruns_gray2 <= underruns_gray1;
+end
+
+assign underruns = gray2bin(underruns_gray2);
+
+endmodule
\ No newline at end of file
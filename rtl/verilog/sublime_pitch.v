@@ -0,0 +1,241 @@
+/*
+ * Sublime - Subtractive synthesizer
+ *
+ * Copyright (c) 2013, Stefan Kristiansson <stefan.kristiansson@saunalahti.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and non-source forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in non-source form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS WORK IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * WORK, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// Pitch converter.
+// Sits in the write path of the oscillator frequency registers and converts
+// the writes given as a note into a phase increment. A frequency write with
+// bit 31 set is a note:
+//
+// +------+-------+----------+------------------+
+// |   31 | 30:24 |    23:16 |             15:0 |
+// +------+-------+----------+------------------+
+// | 1    | note  | reserved | cents (signed)   |
+// +------+-------+----------+------------------+
+//
+// The pitch is note*100 + cents cents above MIDI note 0, it is clamped to
+// 0 - 38399 cents (32 octaves) and converted to octaves in 5.26 fixed point
+// by a multiplication with 2^26/1200. The fraction of an octave is raised to
+// 2^fraction by linear interpolation in a 64 entry table, and the phase
+// increment is
+//
+// note_base * 2^fraction * 2^octave
+//
+// where note_base is the phase increment of MIDI note 0 in 12.20 fixed
+// point. The result saturates at 2^31-1.
+// All other writes are passed through unchanged.
+//
+// The conversion is pipelined over LATENCY clock cycles, all writes are
+// delayed by that, so they stay in order and one write can be taken every
+// clock cycle.
+//
+
+module sublime_pitch #(
+	parameter NUM_VOICES = 8
+)(
+	input 				   clk,
+	input 				   rst,
+
+	input [31:0] 			   note_base,
+
+	// Writes from the bus
+	input 				   freq0_we_i,
+	input 				   freq1_we_i,
+	input [$clog2(NUM_VOICES)-1:0] 	   freq_write_voice_i,
+	input [31:0] 			   freq_write_data_i,
+
+	// Writes to the oscillators
+	output 				   freq0_we,
+	output 				   freq1_we,
+	output [$clog2(NUM_VOICES)-1:0]    freq_write_voice,
+	output reg [31:0] 		   freq_write_data
+);
+
+localparam LATENCY = 5;
+localparam VW = $clog2(NUM_VOICES);
+
+// 2^(i/64) in 2.22 fixed point
+function [23:0] exp2_table;
+	input [6:0] i;
+	begin
+		case (i)
+	7'd0:	exp2_table = 24'h400000;
+	7'd1:	exp2_table = 24'h40b269;
+	7'd2:	exp2_table = 24'h4166c3;
+	7'd3:	exp2_table = 24'h421d14;
+	7'd4:	exp2_table = 24'h42d562;
+	7'd5:	exp2_table = 24'h438fb1;
+	7'd6:	exp2_table = 24'h444c07;
+	7'd7:	exp2_table = 24'h450a6b;
+	7'd8:	exp2_table = 24'h45cae1;
+	7'd9:	exp2_table = 24'h468d70;
+	7'd10:	exp2_table = 24'h47521d;
+	7'd11:	exp2_table = 24'h4818ee;
+	7'd12:	exp2_table = 24'h48e1ea;
+	7'd13:	exp2_table = 24'h49ad16;
+	7'd14:	exp2_table = 24'h4a7a78;
+	7'd15:	exp2_table = 24'h4b4a17;
+	7'd16:	exp2_table = 24'h4c1bf8;
+	7'd17:	exp2_table = 24'h4cf023;
+	7'd18:	exp2_table = 24'h4dc69d;
+	7'd19:	exp2_table = 24'h4e9f6d;
+	7'd20:	exp2_table = 24'h4f7a99;
+	7'd21:	exp2_table = 24'h505829;
+	7'd22:	exp2_table = 24'h513822;
+	7'd23:	exp2_table = 24'h521a8b;
+	7'd24:	exp2_table = 24'h52ff6b;
+	7'd25:	exp2_table = 24'h53e6ca;
+	7'd26:	exp2_table = 24'h54d0ad;
+	7'd27:	exp2_table = 24'h55bd1d;
+	7'd28:	exp2_table = 24'h56ac1f;
+	7'd29:	exp2_table = 24'h579dbc;
+	7'd30:	exp2_table = 24'h5891fb;
+	7'd31:	exp2_table = 24'h5988e2;
+	7'd32:	exp2_table = 24'h5a827a;
+	7'd33:	exp2_table = 24'h5b7ec9;
+	7'd34:	exp2_table = 24'h5c7dd8;
+	7'd35:	exp2_table = 24'h5d7fad;
+	7'd36:	exp2_table = 24'h5e8452;
+	7'd37:	exp2_table = 24'h5f8bcd;
+	7'd38:	exp2_table = 24'h609626;
+	7'd39:	exp2_table = 24'h61a366;
+	7'd40:	exp2_table = 24'h62b395;
+	7'd41:	exp2_table = 24'h63c6ba;
+	7'd42:	exp2_table = 24'h64dcdf;
+	7'd43:	exp2_table = 24'h65f60a;
+	7'd44:	exp2_table = 24'h671246;
+	7'd45:	exp2_table = 24'h68319a;
+	7'd46:	exp2_table = 24'h69540f;
+	7'd47:	exp2_table = 24'h6a79ad;
+	7'd48:	exp2_table = 24'h6ba27e;
+	7'd49:	exp2_table = 24'h6cce8b;
+	7'd50:	exp2_table = 24'h6dfddc;
+	7'd51:	exp2_table = 24'h6f307a;
+	7'd52:	exp2_table = 24'h70666f;
+	7'd53:	exp2_table = 24'h719fc5;
+	7'd54:	exp2_table = 24'h72dc83;
+	7'd55:	exp2_table = 24'h741cb5;
+	7'd56:	exp2_table = 24'h756063;
+	7'd57:	exp2_table = 24'h76a798;
+	7'd58:	exp2_table = 24'h77f25d;
+	7'd59:	exp2_table = 24'h7940bc;
+	7'd60:	exp2_table = 24'h7a92bf;
+	7'd61:	exp2_table = 24'h7be870;
+	7'd62:	exp2_table = 24'h7d41d9;
+	7'd63:	exp2_table = 24'h7e9f06;
+	7'd64:	exp2_table = 24'h800000;
+		default:	exp2_table = 0;
+		endcase
+	end
+endfunction
+
+// Write enables, voice and the unconverted data of the writes in the
+// pipeline, stage 0 is the bus
+reg [LATENCY:1]			we0_d;
+reg [LATENCY:1]			we1_d;
+reg [VW-1:0]			voice_d[LATENCY:1];
+reg [31:0]			data_d[LATENCY:1];
+
+wire signed [16:0]		cents;
+wire signed [18:0]		pitch;
+reg [15:0]			pitch1;
+reg [30:0]			octaves2;
+reg [4:0]			octave3;
+reg [23:0]			exp_a3;
+reg [16:0]			exp_d3;
+reg [11:0]			exp_f3;
+wire [28:0]			exp_delta;
+reg [4:0]			octave4;
+reg [23:0]			exp4;
+wire [55:0]			inc;
+wire [86:0]			inc_scaled;
+
+integer k;
+
+always @(posedge clk)
+	if (rst) begin
+		we0_d <= 0;
+		we1_d <= 0;
+	end else begin
+		we0_d <= {we0_d[LATENCY-1:1], freq0_we_i};
+		we1_d <= {we1_d[LATENCY-1:1], freq1_we_i};
+	end
+
+always @(posedge clk) begin
+	voice_d[1] <= freq_write_voice_i;
+	data_d[1] <= freq_write_data_i;
+	for (k = 2; k <= LATENCY; k = k+1) begin
+		voice_d[k] <= voice_d[k-1];
+		data_d[k] <= data_d[k-1];
+	end
+end
+
+// Stage 1: pitch in cents, clamped
+assign cents = {freq_write_data_i[15], freq_write_data_i[15:0]};
+assign pitch = $signed({12'h0, freq_write_data_i[30:24]})*19'sd100 + cents;
+
+always @(posedge clk)
+	pitch1 <= pitch < 0 ? 0 : pitch > 38399 ? 38399 : pitch[15:0];
+
+// Stage 2: octaves, 2^26/1200 = 55924.05
+always @(posedge clk)
+	octaves2 <= pitch1 * 16'd55924;
+
+// Stage 3: table lookup for the fraction
+always @(posedge clk) begin
+	octave3 <= octaves2[30:26];
+	exp_a3 <= exp2_table({1'b0, octaves2[25:20]});
+	exp_d3 <= exp2_table({1'b0, octaves2[25:20]} + 1) -
+		  exp2_table({1'b0, octaves2[25:20]});
+	exp_f3 <= octaves2[19:8];
+end
+
+// Stage 4: interpolation
+assign exp_delta = exp_d3 * exp_f3;
+
+always @(posedge clk) begin
+	octave4 <= octave3;
+	exp4 <= exp_a3 + exp_delta[28:12];
+end
+
+// Stage 5: scale the note base, 12.20 * 2.22 fixed point gives 14.42
+assign inc = note_base * exp4;
+assign inc_scaled = inc << octave4;
+
+always @(posedge clk)
+	if (!data_d[LATENCY-1][31])
+		freq_write_data <= data_d[LATENCY-1];
+	else if (|inc_scaled[86:73])
+		freq_write_data <= 32'h7fffffff;
+	else
+		freq_write_data <= inc_scaled[72:42];
+
+assign freq0_we = we0_d[LATENCY];
+assign freq1_we = we1_d[LATENCY];
+assign freq_write_voice = voice_d[LATENCY];
+
+endmodule
\ No newline at end of file
@@ -27,68 +27,98 @@
 
 //
 // Voice control.
-// Instantiates the NCOs for each voice and handle the wavetable sharing
+// Instantiates the time multiplexed NCOs and handle the wavetable sharing
 // between voices.
 // Outputs the current wavetable data and the voice it is associated with
 // for both NCOs.
-// Write ports into the wavetables are exposed to higher level for wave
+// The write port into the wavetables is exposed to higher level for wave
 // initialization.
+// The wavetables are kept in one bank of WAVETABLE_COUNT tables, each
+// oscillator of each voice picks its table through wavetable_sel, which
+// holds {map[23], map entry[19:16], osc1 table[15:8], osc0 table[7:0]} per
+// voice. With map set the two tables are taken from that entry of
+// wavetable_map instead, which holds {osc1 table[15:8], osc0 table[7:0]}.
+//
+// The voices are processed in NUM_LANES parallel lanes, each lane has its
+// own NCOs and its own copy of the wavetables. Lane l handles the voices
+// slot*NUM_LANES + l, where the slot is what next_voice and active_voice
+// count through, so a sample takes NUM_VOICES/NUM_LANES voice slots.
+// NUM_LANES has to be a power of 2 and each lane needs at least two voices.
+//
+// A voice slot lasts until active_voice_done is asserted, which has to happen
+// every VOICE_CYCLES clock cycles for the oscillators to keep their pitch.
+//
+// The wavetables are read with linear interpolation between the entries
+// around the oscillator phase (see sublime_wavetable). Both oscillators read
+// the same bank, osc0 in the cycle before the voice slot and osc1 in the
+// first cycle of the slot, so active_voice_data is valid in the third cycle
+// of a voice slot.
+// With MIPMAP = 1 the wavetables hold band limited copies of every octave,
+// the NCOs pick the copy from their frequency and wavetable_mip_shift.
+// All oscillator frequencies are scaled by pitch_bend (see sublime_nco).
 //
 
 module sublime_voice_ctrl #(
 	parameter NUM_VOICES = 8,
-	parameter WAVETABLE_SIZE = 8192
+	parameter NUM_LANES = 1,
+	parameter VOICE_CYCLES = 1,
+	parameter WAVETABLE_SIZE = 8192,
+	parameter WAVETABLE_COUNT = 8,
+	parameter INTERPOLATE = 1,
+	parameter MIPMAP = 1
 )(
-	input 				    clk,
-	input 				    rst,
-
-	input [NUM_VOICES-1:0] 		    nco0_enable,
-	input [NUM_VOICES-1:0] 		    nco0_sync,
-	input [NUM_VOICES*32-1:0] 	    nco0_freq,
-	input [NUM_VOICES*8-1:0] 	    nco0_offset,
-
-	input [NUM_VOICES-1:0] 		    nco1_enable,
-	input [NUM_VOICES-1:0] 		    nco1_sync,
-	input [NUM_VOICES*32-1:0] 	    nco1_freq,
-	input [NUM_VOICES*8-1:0] 	    nco1_offset,
+	input 						clk,
+	input 						rst,
 
-	input [NUM_VOICES*3-1:0] 	    nco_mixmode,
+	input [NUM_VOICES-1:0] 				nco0_enable,
+	input [NUM_VOICES-1:0] 				nco0_sync,
+	input [NUM_VOICES*8-1:0] 			nco0_offset,
 
-	output reg [$clog2(NUM_VOICES)-1:0] active_voice,
-	output reg 			    active_voice_changed,
-	input 				    active_voice_done,
+	input [NUM_VOICES-1:0] 				nco1_enable,
+	input [NUM_VOICES-1:0] 				nco1_sync,
+	input [NUM_VOICES*8-1:0] 			nco1_offset,
 
-	input 				    wavetable0_we,
-	input [$clog2(WAVETABLE_SIZE)-1:0]  wavetable0_write_addr,
-	input [31:0] 			    wavetable0_write_data,
+	input 						nco0_freq_we,
+	input 						nco1_freq_we,
+	input [$clog2(NUM_VOICES)-1:0] 			nco_freq_write_voice,
+	input [31:0] 					nco_freq_write_data,
 
-	input 				    wavetable1_we,
-	input [$clog2(WAVETABLE_SIZE)-1:0]  wavetable1_write_addr,
-	input [31:0] 			    wavetable1_write_data,
+	input [NUM_VOICES*3-1:0] 			nco_mixmode,
 
-	output reg [31:0] 		    active_voice_data
-);
+	// Voice slots, common to all lanes
+	output reg [$clog2(NUM_VOICES/NUM_LANES)-1:0] 	next_voice,
+	output reg [$clog2(NUM_VOICES/NUM_LANES)-1:0] 	active_voice,
+	output reg 					active_voice_changed,
+	input 						active_voice_done,
 
-genvar i;
+	input [NUM_VOICES*24-1:0] 			wavetable_sel,
+	input [16*16-1:0] 				wavetable_map,
+	input 						wavetable_we,
+	input [$clog2(WAVETABLE_COUNT)+$clog2(WAVETABLE_SIZE)+MIPMAP-1:0] wavetable_write_addr,
+	input [31:0] 					wavetable_write_data,
 
-reg [$clog2(NUM_VOICES)-1:0]		next_voice;
+	input [4:0] 					wavetable_mip_shift,
+	input [19:0] 					pitch_bend,
 
-wire [31:0]				nco0_wave_addr[NUM_VOICES-1:0];
-wire [31:0]				nco1_wave_addr[NUM_VOICES-1:0];
+	// Output of the active voice in each lane
+	output [NUM_LANES*32-1:0] 			active_voice_data
+);
 
-wire [$clog2(WAVETABLE_SIZE)-1:0] 	wavetable0_read_addr;
-wire [$clog2(WAVETABLE_SIZE)-1:0] 	wavetable1_read_addr;
+localparam NUM_SLOTS = NUM_VOICES/NUM_LANES;
+localparam TW = $clog2(WAVETABLE_COUNT);
 
-wire [31:0]				wavetable0_read_data;
-wire [31:0]				wavetable1_read_data;
+genvar i;
+genvar l;
 
 wire [2:0]				mixmode[NUM_VOICES-1:0];
 
+reg					osc0_valid;
+
 always @(*) begin
 	next_voice = active_voice;
 	if (active_voice_done) begin
 		if (active_voice == 0)
-			next_voice = NUM_VOICES-1;
+			next_voice = NUM_SLOTS-1;
 		else
 			next_voice = active_voice - 1;
 	end
@@ -102,39 +132,17 @@ always @(posedge clk)
 	else
 		active_voice <= next_voice;
 
+// The first voice is started right after reset
 always @(posedge clk)
 	if (rst)
-		active_voice_changed <= 0;
+		active_voice_changed <= 1;
 	else
 		active_voice_changed <= active_voice_done;
 
 
-// Mix output from the two wavetables according to the mixmode
-wire [31:0] osc0_output = nco0_enable[active_voice] ? wavetable0_read_data : 0;
-wire [31:0] osc1_output = nco1_enable[active_voice] ? wavetable1_read_data : 0;
-
-always @(*) begin
-	case(mixmode[active_voice])
-	3'h0:
-		active_voice_data = osc0_output + osc1_output;
-	3'h1:
-		active_voice_data = osc0_output - osc1_output;
-	3'h2:
-		active_voice_data = osc0_output | osc1_output;
-	3'h3:
-		active_voice_data = osc0_output ^ osc1_output;
-	3'h4:
-		active_voice_data = osc0_output & osc1_output;
-	default:
-		active_voice_data = 0;
-	endcase
-end
-
-assign wavetable0_read_addr =
-	nco0_wave_addr[next_voice][31:32-$clog2(WAVETABLE_SIZE)];
-
-assign wavetable1_read_addr =
-	nco1_wave_addr[next_voice][31:32-$clog2(WAVETABLE_SIZE)];
+// The osc0 wavetable data is valid in the second cycle of a voice slot
+always @(posedge clk)
+	osc0_valid <= active_voice_changed;
 
 // I'm certain you should be able to do get a bit vector by
 // doing something like this: ($clog2(WAVETABLE_SIZE)-8)'h0
@@ -143,67 +151,152 @@ wire [32-$clog2(WAVETABLE_SIZE):1] OFFSET_HI_PAD = 0;
 wire [$clog2(WAVETABLE_SIZE)-8:1] OFFSET_LO_PAD = 0;
 
 generate
-for (i = 0; i < NUM_VOICES; i=i+1) begin : nco_gen
+for (i = 0; i < NUM_VOICES; i=i+1) begin : mixmode_gen
 	assign mixmode[i] = nco_mixmode[3*(i+1)-1:3*i];
+end
+endgenerate
+
+generate
+for (l = 0; l < NUM_LANES; l=l+1) begin : lane_gen
+	wire [$clog2(NUM_VOICES)-1:0]	next_idx;
+	wire [$clog2(NUM_VOICES)-1:0]	active_idx;
+	wire [NUM_SLOTS-1:0]		nco0_lane_sync;
+	wire [NUM_SLOTS-1:0]		nco1_lane_sync;
+	wire				lane_freq_we;
 
-	sublime_nco nco0 (
-		.clk		(clk),
-		.rst		(rst),
-		.enable		(nco0_enable[i]),
-		.sync		(nco0_sync[i]),
-		.freq		(nco0_freq[32*(i+1)-1:32*i]),
-		.offset		({
-				  OFFSET_HI_PAD,
-				  nco0_offset[8*(i+1)-1:8*i],
-				  OFFSET_LO_PAD
-				  }),
-		.wave_addr	(nco0_wave_addr[i])
+	wire [31:0]			nco0_wave_addr;
+	wire [31:0]			nco1_wave_addr;
+	wire [5:0]			nco0_level;
+	wire [5:0]			nco1_level;
+
+	wire				read_osc1;
+	wire [23:0]			voice_sel;
+	wire [15:0]			voice_tables;
+	wire [TW-1:0]			wavetable_table_sel;
+	wire [31:0]			wavetable_phase;
+	wire [5:0]			wavetable_level;
+	wire [31:0]			wavetable_read_data;
+	reg [31:0]			osc0_data;
+
+	wire [31:0]			osc0_output;
+	wire [31:0]			osc1_output;
+	reg [31:0]			voice_data;
+
+	assign next_idx = next_voice*NUM_LANES + l;
+	assign active_idx = active_voice*NUM_LANES + l;
+
+	for (i = 0; i < NUM_SLOTS; i=i+1) begin : sync_gen
+		assign nco0_lane_sync[i] = nco0_sync[i*NUM_LANES + l];
+		assign nco1_lane_sync[i] = nco1_sync[i*NUM_LANES + l];
+	end
+
+	assign lane_freq_we = nco_freq_write_voice % NUM_LANES == l;
+
+	// The oscillators take turns reading the wavetable bank, osc0 is read
+	// along with the advance of the NCOs and osc1 in the cycle after
+	assign read_osc1 = active_voice_changed;
+	assign voice_sel = read_osc1 ? wavetable_sel[24*active_idx+:24] :
+			   wavetable_sel[24*next_idx+:24];
+	assign voice_tables = voice_sel[23] ?
+			      wavetable_map[16*voice_sel[19:16]+:16] :
+			      voice_sel[15:0];
+	assign wavetable_table_sel = read_osc1 ? voice_tables[8+:TW] :
+				     voice_tables[0+:TW];
+	assign wavetable_phase = read_osc1 ? nco1_wave_addr : nco0_wave_addr;
+	assign wavetable_level = read_osc1 ? nco1_level : nco0_level;
+
+	always @(posedge clk)
+		if (osc0_valid)
+			osc0_data <= wavetable_read_data;
+
+	// Mix output from the two oscillators according to the mixmode
+	assign osc0_output = nco0_enable[active_idx] ? osc0_data : 0;
+	assign osc1_output = nco1_enable[active_idx] ? wavetable_read_data : 0;
+
+	always @(*) begin
+		case(mixmode[active_idx])
+		3'h0:
+			voice_data = osc0_output + osc1_output;
+		3'h1:
+			voice_data = osc0_output - osc1_output;
+		3'h2:
+			voice_data = osc0_output | osc1_output;
+		3'h3:
+			voice_data = osc0_output ^ osc1_output;
+		3'h4:
+			voice_data = osc0_output & osc1_output;
+		default:
+			voice_data = 0;
+		endcase
+	end
+
+	assign active_voice_data[32*(l+1)-1:32*l] = voice_data;
+
+	sublime_nco #(
+		.NUM_VOICES		(NUM_SLOTS),
+		.VOICE_CYCLES		(VOICE_CYCLES)
+	) nco0 (
+		.clk			(clk),
+		.rst			(rst),
+		.next_voice		(next_voice),
+		.advance		(active_voice_done),
+		.enable			(nco0_enable[next_idx]),
+		.sync			(nco0_lane_sync),
+		.offset			({
+					  OFFSET_HI_PAD,
+					  nco0_offset[8*next_idx+:8],
+					  OFFSET_LO_PAD
+					  }),
+		.mip_shift		(wavetable_mip_shift),
+		.bend			(pitch_bend),
+		.freq_we		(nco0_freq_we & lane_freq_we),
+		.freq_write_voice	(nco_freq_write_voice / NUM_LANES),
+		.freq_write_data	(nco_freq_write_data),
+		.wave_addr		(nco0_wave_addr),
+		.level			(nco0_level)
+	);
+
+	sublime_nco #(
+		.NUM_VOICES		(NUM_SLOTS),
+		.VOICE_CYCLES		(VOICE_CYCLES)
+	) nco1 (
+		.clk			(clk),
+		.rst			(rst),
+		.next_voice		(next_voice),
+		.advance		(active_voice_done),
+		.enable			(nco1_enable[next_idx]),
+		.sync			(nco1_lane_sync),
+		.offset			({
+					  OFFSET_HI_PAD,
+					  nco1_offset[8*next_idx+:8],
+					  OFFSET_LO_PAD
+					  }),
+		.mip_shift		(wavetable_mip_shift),
+		.bend			(pitch_bend),
+		.freq_we		(nco1_freq_we & lane_freq_we),
+		.freq_write_voice	(nco_freq_write_voice / NUM_LANES),
+		.freq_write_data	(nco_freq_write_data),
+		.wave_addr		(nco1_wave_addr),
+		.level			(nco1_level)
 	);
 
-	sublime_nco nco1 (
-		.clk		(clk),
-		.rst		(rst),
-		.enable		(nco1_enable[i]),
-		.sync		(nco1_sync[i]),
-		.freq		(nco1_freq[32*(i+1)-1:32*i]),
-		.offset		({
-				  OFFSET_HI_PAD,
-				  nco1_offset[8*(i+1)-1:8*i],
-				  OFFSET_LO_PAD
-				  }),
-		.wave_addr	(nco1_wave_addr[i])
+	// Every lane has its own copy of the wavetables, all written at once
+	sublime_wavetable #(
+		.SIZE			(WAVETABLE_SIZE),
+		.COUNT			(WAVETABLE_COUNT),
+		.INTERPOLATE		(INTERPOLATE),
+		.MIPMAP			(MIPMAP)
+	) wavetable0 (
+		.clk			(clk),
+		.table_sel		(wavetable_table_sel),
+		.phase			(wavetable_phase),
+		.level			(wavetable_level),
+		.data			(wavetable_read_data),
+		.we			(wavetable_we),
+		.write_addr		(wavetable_write_addr),
+		.write_data		(wavetable_write_data)
 	);
 end
 endgenerate
 
-sublime_simple_dpram_sclk
-      #(
-	.ADDR_WIDTH($clog2(WAVETABLE_SIZE)),
-	.DATA_WIDTH(32)
-	)
-wavetable0
-       (
-	.clk			(clk),
-	.raddr			(wavetable0_read_addr),
-	.waddr			(wavetable0_write_addr),
-	.we			(wavetable0_we),
-	.din			(wavetable0_write_data),
-	.dout			(wavetable0_read_data)
-);
-
-sublime_simple_dpram_sclk
-      #(
-	.ADDR_WIDTH($clog2(WAVETABLE_SIZE)),
-	.DATA_WIDTH(32)
-	)
-wavetable1
-       (
-	.clk			(clk),
-	.raddr			(wavetable1_read_addr),
-	.waddr			(wavetable1_write_addr),
-	.we			(wavetable1_we),
-	.din			(wavetable1_write_data),
-	.dout			(wavetable1_read_data)
-);
-
 endmodule
\ No newline at end of file
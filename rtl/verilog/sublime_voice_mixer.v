@@ -25,61 +25,138 @@
  * WORK, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+//
+// Voice mixer.
+// Scales the output of the active voice in each lane by its velocity and
+// envelope, sums the lanes in a pipelined adder tree and accumulates the
+// voice slots into the mixed sample.
+//
+
 module sublime_voice_mixer #(
-	parameter NUM_VOICES = 8
+	parameter NUM_VOICES = 8,
+	parameter NUM_LANES = 1
 )(
-	input 			       clk,
-	input 			       rst,
+	input 					       clk,
+	input 					       rst,
 
-	input [$clog2(NUM_VOICES)-1:0] active_voice,
-	input 			       active_voice_changed,
+	input [$clog2(NUM_VOICES/NUM_LANES)-1:0]       active_voice,
+	input 					       active_voice_changed,
 
-	input [7:0] 		       active_voice_velocity,
-	input [31:0] 		       active_voice_data,
+	input [NUM_LANES*8-1:0] 		       active_voice_velocity,
+	// Envelope gain, 256 = unity
+	input [NUM_LANES*9-1:0] 		       active_voice_envelope,
+	input [NUM_LANES*32-1:0] 		       active_voice_data,
 
-	output reg [31:0] 	       mixed_data
+	output reg [31:0] 			       mixed_data,
+	// Asserted for one clock cycle when mixed_data is updated
+	output reg 				       mixed_valid
 );
 
+localparam TREE_DEPTH = $clog2(NUM_LANES);
+
+genvar i;
+
 reg		last_voice;
+reg		last_voice_d;
 reg [31:0]	mix;
 
-wire [31:0]	mul_op1;
-wire [8:0]	mul_op2;
-wire [31:0]	mul_op1_unsigned;
-wire [8:0]	mul_op2_unsigned;
-reg [40:0]	mul_res;
-reg		mul_res_neg;
 reg		mul_valid;
-wire [31:0]	scaled_voice;
+reg		env_valid;
 
-always @(posedge clk)
+// The adder tree nodes, node 1 is the root and the lanes are the leaves
+wire [31:0]	node[2*NUM_LANES-1:1];
+wire [TREE_DEPTH:0] tree_valid;
+wire [TREE_DEPTH:0] tree_last_voice;
+
+always @(posedge clk) begin
 	last_voice <= active_voice_changed && active_voice == 0;
+	last_voice_d <= last_voice;
+end
 
-always @(posedge clk)
+always @(posedge clk) begin
 	mul_valid <= active_voice_changed;
+	env_valid <= mul_valid;
+end
+
+generate
+for (i = 0; i < NUM_LANES; i = i + 1) begin : lane_gen
+	wire [31:0]	mul_op1;
+	wire [8:0]	mul_op2;
+	wire [31:0]	mul_op1_unsigned;
+	wire [8:0]	mul_op2_unsigned;
+	reg [40:0]	mul_res;
+	reg		mul_res_neg;
+	reg [8:0]	env_gain;
+	reg [40:0]	env_res;
+	reg		env_res_neg;
+
+	assign mul_op1 = active_voice_data[32*(i+1)-1:32*i];
+	assign mul_op2 = {1'b0, active_voice_velocity[8*(i+1)-1:8*i]};
+
+	assign mul_op1_unsigned = mul_op1[31] ? ~mul_op1 + 32'd1 : mul_op1;
+	assign mul_op2_unsigned = mul_op2[8] ? ~mul_op2 + 9'd1 : mul_op2;
+
+	always @(posedge clk) begin
+		mul_res_neg <= mul_op1[31] ^ mul_op2[8];
+		mul_res <= mul_op1_unsigned * mul_op2_unsigned;
+	end
+
+	// Second stage, scale the (unsigned) velocity scaled voice by the
+	// envelope
+	always @(posedge clk)
+		env_gain <= active_voice_envelope[9*(i+1)-1:9*i];
+
+	always @(posedge clk) begin
+		env_res_neg <= mul_res_neg;
+		env_res <= mul_res[39:8] * env_gain;
+	end
 
-assign scaled_voice = mul_res_neg ? ~mul_res[39:8] + 32'd1 : mul_res[39:8];
+	assign node[NUM_LANES+i] = env_res_neg ? ~env_res[39:8] + 32'd1 :
+				   env_res[39:8];
+end
+
+for (i = 1; i < NUM_LANES; i = i + 1) begin : tree_gen
+	reg [31:0] sum;
+
+	always @(posedge clk)
+		sum <= node[2*i] + node[2*i+1];
+
+	assign node[i] = sum;
+end
+
+// Delay the control signals along with the adder tree
+assign tree_valid[0] = env_valid;
+assign tree_last_voice[0] = last_voice_d;
+
+for (i = 0; i < TREE_DEPTH; i = i + 1) begin : tree_delay_gen
+	reg valid;
+	reg last;
+
+	always @(posedge clk) begin
+		valid <= tree_valid[i];
+		last <= tree_last_voice[i];
+	end
+
+	assign tree_valid[i+1] = valid;
+	assign tree_last_voice[i+1] = last;
+end
+endgenerate
+
+always @(posedge clk)
+	if (rst)
+		mixed_valid <= 0;
+	else
+		mixed_valid <= tree_last_voice[TREE_DEPTH];
 
 always @(posedge clk)
 	if (rst) begin
 		mix <= 0;
 		mixed_data <= 0;
-	end else if (last_voice) begin
+	end else if (tree_last_voice[TREE_DEPTH]) begin
 		mixed_data <= mix;
-		mix <= scaled_voice;
-	end else if (mul_valid) begin
-		mix <= mix + scaled_voice;
+		mix <= node[1];
+	end else if (tree_valid[TREE_DEPTH]) begin
+		mix <= mix + node[1];
 	end
 
-assign mul_op1 = active_voice_data;
-assign mul_op2 = {1'b0, active_voice_velocity};
-
-assign mul_op1_unsigned = mul_op1[31] ? ~mul_op1 + 32'd1 : mul_op1;
-assign mul_op2_unsigned = mul_op2[8] ? ~mul_op2 + 9'd1 : mul_op2;
-
-always @(posedge clk) begin
-	mul_res_neg <= mul_op1[31] ^ mul_op2[8];
-	mul_res <= mul_op1_unsigned * mul_op2_unsigned;
-end
-
 endmodule
\ No newline at end of file
@@ -0,0 +1,163 @@
+/*
+ * Sublime - Subtractive synthesizer
+ *
+ * Copyright (c) 2013, Stefan Kristiansson <stefan.kristiansson@saunalahti.fi>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and non-source forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in non-source form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS WORK IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * WORK, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+//
+// Wavetable bank.
+// Holds COUNT tables of SIZE 32-bit entries in one RAM, the table that is
+// read is selected per read by table_sel.
+//
+// With MIPMAP = 1 every table also holds band limited copies of itself,
+// one per octave, each half the size of the one before it:
+//
+// +-----------------+-----------------+-----------------+-----+
+// | level 0         | level 1         | level 2         | ... |
+// | SIZE entries    | SIZE/2 entries  | SIZE/4 entries  |     |
+// +-----------------+-----------------+-----------------+-----+
+//
+// i.e. level L starts at entry 2*SIZE - 2*SIZE/2^L and the last level
+// holds 4 entries, so a table takes 2*SIZE entries. The level is picked per
+// voice by the oscillator from its frequency (see sublime_nco) and clamped
+// to the levels that exist. Level L is indexed by the top log2(SIZE)-L bits
+// of the phase.
+//
+// The tables are written through write_addr, which is {table, entry}.
+//
+// The table is read with linear interpolation between the two entries around
+// the phase, the entry selected by the phase and the one following it,
+// weighted by the INTERP_BITS phase bits below the index.
+// To get both entries in the same cycle, the even and the odd entries are
+// kept in separate RAMs.
+// A read can be started every clock cycle, the output is registered, so
+// data is valid two clock cycles after table_sel, phase and level.
+// With INTERPOLATE = 0 the entry selected by the phase is output as is.
+//
+
+module sublime_wavetable #(
+	parameter SIZE = 8192,
+	parameter COUNT = 8,
+	parameter INTERPOLATE = 1,
+	parameter MIPMAP = 1
+)(
+	input 			    clk,
+
+	input [$clog2(COUNT)-1:0]   table_sel,
+	input [31:0] 		    phase,
+	input [5:0] 		    level,
+	output reg [31:0] 	    data,
+
+	input 			    we,
+	input [$clog2(COUNT)+$clog2(SIZE)+MIPMAP-1:0] write_addr,
+	input [31:0] 		    write_data
+);
+
+localparam AW = $clog2(SIZE);
+localparam TW = $clog2(COUNT);
+// Address width of a table, in entries
+localparam BW = AW + MIPMAP;
+localparam LEVELS = MIPMAP ? AW-1 : 1;
+localparam INTERP_BITS = 12;
+
+wire [5:0]			lvl;
+wire [31+INTERP_BITS:0]		phase_ext;
+wire [AW-1:0]			mask;
+wire [BW-1:0]			base;
+wire [AW-1:0]			idx;
+wire [INTERP_BITS-1:0]		frac;
+wire [BW-1:0]			even_entry;
+wire [BW-1:0]			odd_entry;
+wire [31:0]			even_rdata;
+wire [31:0]			odd_rdata;
+
+reg				odd_r;
+reg [INTERP_BITS-1:0]		frac_r;
+
+wire signed [31:0]		a;
+wire signed [31:0]		b;
+wire signed [32:0]		diff;
+wire signed [45:0]		delta;
+
+assign lvl = level < LEVELS ? level : LEVELS-1;
+
+// Level L has SIZE/2^L entries, starting at 2*SIZE - 2*SIZE/2^L
+assign mask = {AW{1'b1}} >> lvl;
+assign base = MIPMAP ? ({BW{1'b1}} << (BW-lvl)) : 0;
+
+// Index and interpolation weight from the phase, shifted down by the level
+assign phase_ext = {phase, {INTERP_BITS{1'b0}}} >> lvl;
+assign idx = phase_ext[31+INTERP_BITS:32+INTERP_BITS-AW];
+assign frac = INTERPOLATE ? phase_ext[31+INTERP_BITS-AW:32-AW] : 0;
+
+// When the index is odd, the following entry is the next even one, which
+// wraps around to the start of the level
+assign even_entry = base + ((idx + idx[0]) & mask);
+assign odd_entry = base + idx;
+
+always @(posedge clk) begin
+	odd_r <= idx[0];
+	frac_r <= frac;
+end
+
+assign a = odd_r ? odd_rdata : even_rdata;
+assign b = odd_r ? even_rdata : odd_rdata;
+
+assign diff = b - a;
+assign delta = diff * $signed({1'b0, frac_r});
+
+always @(posedge clk)
+	data <= a + delta[INTERP_BITS+31:INTERP_BITS];
+
+sublime_simple_dpram_sclk
+      #(
+	.ADDR_WIDTH(TW+BW-1),
+	.DATA_WIDTH(32)
+	)
+even
+       (
+	.clk			(clk),
+	.raddr			({table_sel, even_entry[BW-1:1]}),
+	.waddr			(write_addr[TW+BW-1:1]),
+	.we			(we & !write_addr[0]),
+	.din			(write_data),
+	.dout			(even_rdata)
+);
+
+sublime_simple_dpram_sclk
+      #(
+	.ADDR_WIDTH(TW+BW-1),
+	.DATA_WIDTH(32)
+	)
+odd
+       (
+	.clk			(clk),
+	.raddr			({table_sel, odd_entry[BW-1:1]}),
+	.waddr			(write_addr[TW+BW-1:1]),
+	.we			(we & write_addr[0]),
+	.din			(write_data),
+	.dout			(odd_rdata)
+);
+
+endmodule
\ No newline at end of file
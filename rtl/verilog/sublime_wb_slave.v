@@ -33,6 +33,10 @@
 module sublime_wb_slave #(
 	parameter NUM_VOICES = 8,
 	parameter WAVETABLE_SIZE = 8192,
+	parameter WAVETABLE_COUNT = 8,
+	parameter WAVETABLE_INTERPOLATE = 1,
+	parameter WAVETABLE_MIPMAP = 1,
+	parameter SAMPLE_PERIOD = 8,	// Clock cycles per sample
 	parameter WB_AW = 32,
 	parameter WB_DW = 32
 )(
@@ -42,22 +46,42 @@ module sublime_wb_slave #(
 	output [NUM_VOICES-1:0] 	    nco0_enable,
 	output [NUM_VOICES-1:0] 	    nco0_sync,
 	output [NUM_VOICES*8-1:0] 	    nco0_offset,
-	output [NUM_VOICES*32-1:0] 	    nco0_freq,
 
 	output [NUM_VOICES-1:0] 	    nco1_enable,
 	output [NUM_VOICES-1:0] 	    nco1_sync,
 	output [NUM_VOICES*8-1:0] 	    nco1_offset,
-	output [NUM_VOICES*32-1:0] 	    nco1_freq,
+
+	output 				    nco0_freq_we,
+	output 				    nco1_freq_we,
+	output [$clog2(NUM_VOICES)-1:0]     nco_freq_write_voice,
+	output [31:0] 			    nco_freq_write_data,
 
 	output [NUM_VOICES*3-1:0] 	    nco_mixmode,
 
-	output 				    wavetable0_we,
-	output 				    wavetable1_we,
-	output [$clog2(WAVETABLE_SIZE)-1:0] wavetable_write_addr,
+	output [NUM_VOICES*24-1:0] 	    wavetable_sel,
+	output [16*16-1:0] 		    wavetable_map,
+	output 				    wavetable_we,
+	output [$clog2(WAVETABLE_COUNT)+$clog2(WAVETABLE_SIZE)+WAVETABLE_MIPMAP-1:0] wavetable_write_addr,
 	output [31:0] 			    wavetable_write_data,
+	output [4:0] 			    wavetable_mip_shift,
 
 	output [NUM_VOICES*8-1:0] 	    velocity,
 
+	output [NUM_VOICES-1:0] 	    note_on,
+	output [NUM_VOICES*32-1:0] 	    envelope,
+	output reg [NUM_VOICES-1:0] 	    envelope_trigger,
+	output 				    envelope_enable,
+	input [NUM_VOICES-1:0] 		    envelope_active,
+
+	output [NUM_VOICES*32-1:0] 	    filter,
+
+	output [3:0] 			    output_lpf_shift,
+	output [27:0] 			    output_rate_inc,
+	output reg [31:0] 		    note_base,
+	output [19:0] 			    pitch_bend,
+	input [31:0] 			    output_overruns,
+	input [31:0] 			    output_underruns,
+
 	input [31:0] 			    left_sample,
 	input [31:0] 			    right_sample,
 
@@ -71,7 +95,7 @@ module sublime_wb_slave #(
 	input [2:0] 			    wb_cti_i,
 	input [1:0] 			    wb_bte_i,
 	output [WB_DW-1:0] 		    wb_dat_o,
-	output reg 			    wb_ack_o,
+	output 				    wb_ack_o,
 	output 				    wb_err_o,
 	output 				    wb_rty_o
 );
@@ -85,7 +109,7 @@ module sublime_wb_slave #(
 // +--------------+-------------------------+
 // | 0x00000008   | voice0 control          |
 // +--------------+-------------------------+
-// | 0x0000000c   | reserved                |
+// | 0x0000000c   | voice0 envelope         |
 // +--------------+-------------------------+
 // | 0x00000010   | voice1 osc0 frequency   |
 // +--------------+-------------------------+
@@ -93,7 +117,7 @@ module sublime_wb_slave #(
 // +--------------+-------------------------+
 // | 0x00000018   | voice1 control          |
 // +--------------+-------------------------+
-// | 0x0000001c   | reserved                |
+// | 0x0000001c   | voice1 envelope         |
 // +--------------+-------------------------+
 // | ...          | ...                     |
 // +--------------+-------------------------+
@@ -103,7 +127,7 @@ module sublime_wb_slave #(
 // +--------------+-------------------------+
 // | 0x000007f8   | voice127 control        |
 // +--------------+-------------------------+
-// | 0x000007fc   | reserved                |
+// | 0x000007fc   | voice127 envelope       |
 // +--------------+-------------------------+
 // | 0x00000800   | left audio sample       |
 // +--------------+-------------------------+
@@ -113,25 +137,89 @@ module sublime_wb_slave #(
 // +--------------+-------------------------+
 // | 0x0000080c   | configuration           |
 // +--------------+-------------------------+
-// | 0x00000810 - | reserved                |
-// | 0x0000fffc   |                         |
+// | 0x00000810   | envelope trigger        |
+// +--------------+-------------------------+
+// | 0x00000814   | output rate             |
+// +--------------+-------------------------+
+// | 0x00000818   | output underruns        |
+// +--------------+-------------------------+
+// | 0x0000081c   | output overruns         |
+// +--------------+-------------------------+
+// | 0x00000820   | envelope active 0-31    |
+// +--------------+-------------------------+
+// | 0x00000824   | envelope active 32-63   |
+// +--------------+-------------------------+
+// | 0x00000828   | envelope active 64-95   |
+// +--------------+-------------------------+
+// | 0x0000082c   | envelope active 96-127  |
+// +--------------+-------------------------+
+// | 0x00000830   | sample period           |
+// +--------------+-------------------------+
+// | 0x00000834   | note base               |
+// +--------------+-------------------------+
+// | 0x00000838   | pitch bend              |
+// +--------------+-------------------------+
+// | 0x0000083c   | reserved                |
+// +--------------+-------------------------+
+// | 0x00000840   | wavetable map 0         |
+// +--------------+-------------------------+
+// | ...          | ...                     |
+// +--------------+-------------------------+
+// | 0x0000087c   | wavetable map 15        |
+// +--------------+-------------------------+
+// | 0x00000880 - | reserved                |
+// | 0x00000ffc   |                         |
+// +--------------+-------------------------+
+// | 0x00001000   | voice0 filter           |
+// +--------------+-------------------------+
+// | 0x00001004   | voice1 filter           |
+// +--------------+-------------------------+
+// | ...          | ...                     |
 // +--------------+-------------------------+
-// | 0x00010000 - | wavetable0              |
-// | 0x0001fffc   |                         |
+// | 0x000011fc   | voice127 filter         |
 // +--------------+-------------------------+
-// | 0x00020000 - | wavetable1              |
-// | 0x0002fffc   |                         |
+// | 0x00001200   | voice0 wavetable        |
+// +--------------+-------------------------+
+// | 0x00001204   | voice1 wavetable        |
+// +--------------+-------------------------+
+// | ...          | ...                     |
+// +--------------+-------------------------+
+// | 0x000013fc   | voice127 wavetable      |
+// +--------------+-------------------------+
+// | 0x00001400 - | reserved                |
+// | 0x0000fffc   |                         |
+// +--------------+-------------------------+
+// | 0x00010000 - | wavetables              |
+// | 0x0008fffc   |                         |
 // +--------------+-------------------------+
 //
 // NOTE 1: Even though register addresses for voices up to 127 are defined,
 // only voice registers 0 - (NUM_VOICES-1) will actually be present.
 //
-// NOTE 2: The largest possible wavetable size is 16K entries, but when
-// smaller wavetables implemented in the hardware (i.e. WAVETABLE_SIZE is
-// smaller), there will be empty address space in each wavetable.
+// NOTE 2: The WAVETABLE_COUNT wavetables follow each other, wavetable t
+// starts at 0x00010000 + 4*t*WAVETABLE_SIZE, or at
+// 0x00010000 + 8*t*WAVETABLE_SIZE with mipmapped wavetables, where the
+// octave copies follow each table. All wavetables together can hold at
+// most 128K entries.
 //
 // Register descripions:
 //
+// voiceX oscY frequency (write only)
+// +------+------------------------------------------+
+// |   31 |                                     30:0 |
+// +------+------------------------------------------+
+// | 0    | phase increment                          |
+// +------+-------+----------+-----------------------+
+// |   31 | 30:24 |    23:16 |                  15:0 |
+// +------+-------+----------+-----------------------+
+// | 1    | note  | reserved | cents (signed)        |
+// +------+-------+----------+-----------------------+
+//
+// The oscillator advances its phase by phase increment/2^32 cycles every
+// clock cycle. With bit 31 set, the phase increment is calculated from a
+// MIDI note and a pitch offset in cents, relative to note base. See
+// sublime_pitch for details.
+//
 // voiceX control
 // +-------------+-------------+---------------+-----------+-----------+
 // |       31:24 |       23:16 |          15:8 |         7 |         6 |
@@ -148,19 +236,130 @@ module sublime_wb_slave #(
 // restart. The most useful use case for this is to assert them at the
 // same time to get them in sync with each other.
 //
+// note on - Gates the voice envelope, a rising edge starts the attack and
+// a falling edge the release.
+//
+// voiceX envelope
+// +-------------+------------+---------------+--------------+
+// |       31:24 |      23:16 |          15:8 |          7:0 |
+// +-------------+------------+---------------+--------------+
+// | attack rate | decay rate | sustain level | release rate |
+// +-------------+------------+---------------+--------------+
+//
+// The rates are given as {exponent[3:0], mantissa[3:0]}, see
+// sublime_envelope for details.
+//
+// voiceX wavetable
+// +----------+-----+----------+-----------+-------------+-------------+
+// |    31:24 |  23 |    22:20 |     19:16 |        15:8 |         7:0 |
+// +----------+-----+----------+-----------+-------------+-------------+
+// | reserved | map | reserved | map entry | osc1 table  | osc0 table  |
+// +----------+-----+----------+-----------+-------------+-------------+
+//
+// The wavetables the oscillators of the voice play, only the
+// log2(WAVETABLE_COUNT) low bits of each are used. When map is set the
+// tables are instead taken from the wavetable map entry, so that the voices
+// sharing an entry all switch tables with a single write to it.
+//
+// Wavetable map 0-15
+// +----------+-------------+-------------+
+// |    31:16 |        15:8 |         7:0 |
+// +----------+-------------+-------------+
+// | reserved | osc1 table  | osc0 table  |
+// +----------+-------------+-------------+
+//
+// voiceX filter
+// +--------+---------+----------+------+
+// |  31:16 |    15:4 |      3:2 |  1:0 |
+// +--------+---------+----------+------+
+// | f      | q       | reserved | mode |
+// +--------+---------+----------+------+
+//
+// f - Cutoff coefficient, 2*sin(pi*cutoff/sample rate) in 0.16 fixed point.
+// q - Damping, 1/resonance in 1.11 fixed point.
+// mode - 0 = bypass, 1 = low pass, 2 = band pass, 3 = high pass
+// See sublime_filter for details.
+//
 // Main control
-// +----------+----------+
-// |  31:1    | 0        |
-// +----------+----------+
-// | reserved | sync all |
-// +----------+----------+
+// +----------+-------------+----------+-----------------+----------+
+// |    31:13 |        12:8 |      7:2 |               1 |        0 |
+// +----------+-------------+----------+-----------------+----------+
+// | reserved | mipmap      | reserved | envelope enable | sync all |
+// |          | shift       |          |                 |          |
+// +----------+-------------+----------+-----------------+----------+
+//
+// envelope enable - When asserted the voices are scaled by their envelope,
+// otherwise only by their velocity.
+//
+// mipmap shift - Oscillators with a frequency below 2^mipmap shift read
+// the full wavetable, every octave above that reads the next band limited
+// copy. 0 disables the mipmaps, only the full wavetable is read.
+// See sublime_nco for details.
+//
+// Envelope trigger (write only)
+// +----------+-------+
+// |    31:7  |   6:0 |
+// +----------+-------+
+// | reserved | voice |
+// +----------+-------+
+//
+// Restarts the attack of a voice that already has note on asserted.
+//
+// Envelope active (read only)
+// One bit per voice, set while the voice envelope is not idle.
+//
+// Output rate
+// +------------+-------------------+
+// |      31:28 |              27:0 |
+// +------------+-------------------+
+// | lpf shift  | rate increment    |
+// +------------+-------------------+
+//
+// The codec output is produced at clk * rate increment / 2^28 samples per
+// second, from the synth output low pass filtered by a one pole filter with
+// coefficient 2^-lpf_shift. See sublime_output for details.
+//
+// Sample period (read only)
+// Number of clock cycles it takes to produce a sample, the rate of the
+// synth output is clk/sample period.
+//
+// Note base
+// The phase increment of MIDI note 0 (8.176 Hz) in 12.20 fixed point, i.e.
+// 2^52*8.176/clk. Used for the frequency writes given as notes.
+//
+// Pitch bend
+// +----------+------------------------------+
+// |    31:20 |                         19:0 |
+// +----------+------------------------------+
+// | reserved | frequency multiplier         |
+// +----------+------------------------------+
+//
+// All oscillator frequencies are multiplied by this, in 4.16 fixed point,
+// so 0x10000 (the reset value) leaves them unchanged. Pitch bend and master
+// tuning go here instead of into the voice frequencies.
+//
+// Output underruns/overruns (read only)
+// Number of samples the codec requested while the output FIFO was empty and
+// the number of samples that were dropped because it was full.
 //
 // Configuration
-// +----------+----------------------+-------------+
-// |    31:11 |                 10:7 |         6:0 |
-// +----------+----------------------+-------------+
-// | reserved | log2(wavetable size) | voice count |
-// +----------+----------------------+-------------+
+// +----------+-----------+-------+------------+-----------------+------------+
+// |    31:24 |        23 |    22 |         21 |           20:17 |         16 |
+// +----------+-----------+-------+------------+-----------------+------------+
+// | reserved | wavetable | pitch | note       | log2(wavetable  | wavetable  |
+// |          | map       | bend  | conversion | count)          | mipmaps    |
+// +----------+-----------+-------+------------+-----------------+------------+
+// +---------------+---------------+---------------+----------+------------------+
+// |            15 |            14 |            13 |       12 |               11 |
+// +---------------+---------------+---------------+----------+------------------+
+// | wavetable     | voice filter  | output FIFO   | reserved | envelope present |
+// | interpolation |               |               |          |                  |
+// +---------------+---------------+---------------+----------+------------------+
+// +----------------------+-------------+
+// |                 10:7 |         6:0 |
+// +----------------------+-------------+
+// | log2(wavetable size) | voice count |
+// +----------------------+-------------+
 
 localparam OSC0_SYNC	= 7;
 localparam OSC1_SYNC	= 6;
@@ -171,47 +370,111 @@ localparam OSC0_EN	= 0;
 genvar i;
 
 wire wb_write_req;
+wire wb_burst;
+
+wire voice_ce = wb_adr_i[WB_AW-1:11] == 0;
+wire wavetable_ce = wb_adr_i[WB_AW-1:16] >= 1 && wb_adr_i[WB_AW-1:16] <= 8;
+wire filter_ce = wb_adr_i[WB_AW-1:11] == 2 && wb_adr_i[10:9] == 0;
+wire wavetable_sel_ce = wb_adr_i[WB_AW-1:11] == 2 && wb_adr_i[10:9] == 1;
 
-assign wb_write_req = wb_cyc_i & wb_stb_i & wb_we_i & !wb_ack_o;
+// Writes are done on the cycles where ack is asserted, which makes it
+// possible to do one write per cycle during bursts.
+assign wb_write_req = wb_cyc_i & wb_stb_i & wb_we_i & wb_ack_o;
 assign wb_err_o = 0;
 assign wb_rty_o = 0;
 
+// Incrementing bursts (registered feedback) to the voice registers and the
+// wavetables are acked on every cycle, all other accesses every other cycle.
+// Both the read data and the write address are taken directly from the bus,
+// so the burst type (wb_bte_i) is of no concern.
+// The ack is registered, and masked with stb so that it is not asserted in
+// the wait states a master inserts into a burst by dropping stb. It is held
+// through the wait states, so the burst goes on where it stopped.
+reg wb_ack_r;
+
+assign wb_burst = wb_cti_i == 3'b010 &
+		  (voice_ce | filter_ce | wavetable_sel_ce | wavetable_ce);
+
 always @(posedge clk)
 	if (rst)
-		wb_ack_o <= 0;
-	else
-		wb_ack_o <= wb_cyc_i & wb_stb_i & !wb_ack_o;
+		wb_ack_r <= 0;
+	else if (wb_stb_i | !wb_cyc_i)
+		wb_ack_r <= wb_cyc_i & wb_stb_i & (wb_burst | !wb_ack_o);
+
+assign wb_ack_o = wb_ack_r & wb_stb_i;
 
 // Voice registers
-wire voice_ce = wb_adr_i[WB_AW-1:11] == 0;
 wire [$clog2(NUM_VOICES)-1:0] voice_idx = wb_adr_i[10:4];
 
-reg [31:0] voice_osc0_freq[NUM_VOICES-1:0];
-reg [31:0] voice_osc1_freq[NUM_VOICES-1:0];
 reg [31:0] voice_ctrl[NUM_VOICES-1:0];
+reg [31:0] voice_envelope[NUM_VOICES-1:0];
+
+// The oscillator frequencies are stored in the NCO RAMs
+assign nco0_freq_we = voice_ce & wb_write_req & wb_adr_i[3:2] == 2'h0;
+assign nco1_freq_we = voice_ce & wb_write_req & wb_adr_i[3:2] == 2'h1;
+assign nco_freq_write_voice = voice_idx;
+assign nco_freq_write_data = wb_dat_i;
 
 always @(posedge clk) begin
 	if (voice_ce & wb_write_req) begin
 		case (wb_adr_i[3:2])
-		2'h0:
-			voice_osc0_freq[voice_idx] <= wb_dat_i;
-		2'h1:
-			voice_osc1_freq[voice_idx] <= wb_dat_i;
 		2'h2:
 			voice_ctrl[voice_idx] <= wb_dat_i;
 		2'h3:
-			;
+			voice_envelope[voice_idx] <= wb_dat_i;
 		endcase
 	end
 end
 
-// Wavetable access
-wire wavetable0_ce = wb_adr_i[WB_AW-1:16] == 1;
-wire wavetable1_ce = wb_adr_i[WB_AW-1:16] == 2;
+// Filter registers
+wire [$clog2(NUM_VOICES)-1:0] filter_idx = wb_adr_i[8:2];
+
+reg [31:0] voice_filter[NUM_VOICES-1:0];
+integer j;
+
+// The filters are bypassed after reset
+always @(posedge clk)
+	if (rst) begin
+		for (j = 0; j < NUM_VOICES; j = j + 1)
+			voice_filter[j] <= 0;
+	end else if (filter_ce & wb_write_req) begin
+		voice_filter[filter_idx] <= wb_dat_i;
+	end
+
+// Wavetable select registers
+wire [$clog2(NUM_VOICES)-1:0] wavetable_sel_idx = wb_adr_i[8:2];
+
+reg [23:0] voice_wavetable[NUM_VOICES-1:0];
+
+always @(posedge clk)
+	if (rst) begin
+		for (j = 0; j < NUM_VOICES; j = j + 1)
+			voice_wavetable[j] <= 0;
+	end else if (wavetable_sel_ce & wb_write_req) begin
+		voice_wavetable[wavetable_sel_idx] <= {wb_dat_i[23], 3'h0,
+						       wb_dat_i[19:0]};
+	end
+
+// Wavetable map, resolved in sublime_voice_ctrl for the voice being read
+wire wavetable_map_ce = wb_adr_i[WB_AW-1:11] == 1 && wb_adr_i[10:6] == 1;
+
+reg [15:0] wavetable_map_r[15:0];
+
+always @(posedge clk)
+	if (rst) begin
+		for (j = 0; j < 16; j = j + 1)
+			wavetable_map_r[j] <= 0;
+	end else if (wavetable_map_ce & wb_write_req) begin
+		wavetable_map_r[wb_adr_i[5:2]] <= wb_dat_i[15:0];
+	end
+
+// Wavetable access, the address is {table, entry}
+wire [WB_AW-1:0] wavetable_offset = wb_adr_i - 32'h00010000;
 
-assign wavetable0_we = wavetable0_ce & wb_write_req;
-assign wavetable1_we = wavetable1_ce & wb_write_req;
-assign wavetable_write_addr = wb_adr_i[$clog2(WAVETABLE_SIZE)+2-1:2];
+assign wavetable_we = wavetable_ce & wb_write_req;
+assign wavetable_write_addr =
+	wavetable_offset[$clog2(WAVETABLE_COUNT)+$clog2(WAVETABLE_SIZE)+
+			 WAVETABLE_MIPMAP+2-1:2];
 assign wavetable_write_data = wb_dat_i;
 
 // Read access to the synth output
@@ -230,12 +493,78 @@ always @(posedge clk)
 		main_control <= wb_dat_i;
 
 assign sync_all = main_control[0];
+assign envelope_enable = main_control[1];
+assign wavetable_mip_shift = WAVETABLE_MIPMAP ? main_control[12:8] : 0;
+
+// Envelope trigger, each write toggles the trigger of the addressed voice
+wire envelope_trigger_ce = wb_adr_i[WB_AW-1:11] == 1 && wb_adr_i[10:2] == 4;
+
+always @(posedge clk)
+	if (rst)
+		envelope_trigger <= 0;
+	else if (envelope_trigger_ce & wb_write_req)
+		envelope_trigger[wb_dat_i[$clog2(NUM_VOICES)-1:0]] <=
+			~envelope_trigger[wb_dat_i[$clog2(NUM_VOICES)-1:0]];
+
+// Envelope active status
+wire envelope_active_ce = wb_adr_i[WB_AW-1:11] == 1 && wb_adr_i[10:4] == 2;
+wire [127:0] envelope_active_pad = envelope_active;
+wire [31:0] envelope_active_word = envelope_active_pad[32*wb_adr_i[3:2]+:32];
+
+// Output stage
+wire output_rate_ce = wb_adr_i[WB_AW-1:11] == 1 && wb_adr_i[10:2] == 5;
+wire output_underruns_ce = wb_adr_i[WB_AW-1:11] == 1 && wb_adr_i[10:2] == 6;
+wire output_overruns_ce = wb_adr_i[WB_AW-1:11] == 1 && wb_adr_i[10:2] == 7;
+reg [31:0] output_rate;
+
+always @(posedge clk)
+	if (rst)
+		output_rate <= 0;
+	else if (output_rate_ce & wb_write_req)
+		output_rate <= wb_dat_i;
+
+assign output_lpf_shift = output_rate[31:28];
+assign output_rate_inc = output_rate[27:0];
+
+// Sample period
+wire sample_period_ce = wb_adr_i[WB_AW-1:11] == 1 && wb_adr_i[10:2] == 12;
+
+// Note base
+wire note_base_ce = wb_adr_i[WB_AW-1:11] == 1 && wb_adr_i[10:2] == 13;
+
+always @(posedge clk)
+	if (rst)
+		note_base <= 0;
+	else if (note_base_ce & wb_write_req)
+		note_base <= wb_dat_i;
+
+// Pitch bend
+reg [19:0] pitch_bend_r;
+wire pitch_bend_ce = wb_adr_i[WB_AW-1:11] == 1 && wb_adr_i[10:2] == 14;
+
+always @(posedge clk)
+	if (rst)
+		pitch_bend_r <= 20'h10000;
+	else if (pitch_bend_ce & wb_write_req)
+		pitch_bend_r <= wb_dat_i[19:0];
+
+assign pitch_bend = pitch_bend_r;
 
 // Configuration
 wire config_ce = wb_adr_i[WB_AW-1:11] == 1 && wb_adr_i[10:2] == 3;
 wire [31:0] configuration;
 
-assign configuration[31:11] = 0;
+assign configuration[31:24] = 0;
+assign configuration[23] = 1;
+assign configuration[22] = 1;
+assign configuration[21] = 1;
+assign configuration[20:17] = $clog2(WAVETABLE_COUNT);
+assign configuration[16] = WAVETABLE_MIPMAP != 0;
+assign configuration[15] = WAVETABLE_INTERPOLATE != 0;
+assign configuration[14] = 1;
+assign configuration[13] = 1;
+assign configuration[12] = 0;
+assign configuration[11] = 1;
 assign configuration[10:7] = $clog2(WAVETABLE_SIZE);
 assign configuration[6:0] = NUM_VOICES;
 
@@ -243,7 +572,15 @@ assign configuration[6:0] = NUM_VOICES;
 // Wishbone data output mux
 assign wb_dat_o = left_ce ? left_sample :
 		  right_ce ? right_sample :
+		  main_control_ce ? main_control :
 		  config_ce ? configuration :
+		  envelope_active_ce ? envelope_active_word :
+		  output_rate_ce ? output_rate :
+		  output_underruns_ce ? output_underruns :
+		  output_overruns_ce ? output_overruns :
+		  sample_period_ce ? SAMPLE_PERIOD :
+		  note_base_ce ? note_base :
+		  pitch_bend_ce ? {12'h0, pitch_bend_r} :
 		  0;
 
 // Flatten registers and map them to the out ports
@@ -254,16 +591,23 @@ for (i = 0; i < NUM_VOICES; i = i + 1) begin : register_flattening
 	assign nco0_enable[i] = voice_ctrl[i][OSC0_EN];
 	assign nco0_sync[i] = voice_ctrl[i][OSC0_SYNC] | sync_all;
 	assign nco0_offset[8*(i+1)-1:8*i] = voice_ctrl[i][31:24];
-	assign nco0_freq[32*(i+1)-1:32*i] = voice_osc0_freq[i];
 
 	assign nco1_enable[i] = voice_ctrl[i][OSC1_EN];
 	assign nco1_sync[i] = voice_ctrl[i][OSC1_SYNC] | sync_all;
 	assign nco1_offset[8*(i+1)-1:8*i] = voice_ctrl[i][23:16];
-	assign nco1_freq[32*(i+1)-1:32*i] = voice_osc1_freq[i];
 
 	assign nco_mixmode[3*(i+1)-1:3*i] = voice_ctrl[i][5:3];
 
 	assign velocity[8*(i+1)-1:8*i] = voice_ctrl[i][15:8];
+
+	assign note_on[i] = voice_ctrl[i][NOTE_ON];
+	assign envelope[32*(i+1)-1:32*i] = voice_envelope[i];
+	assign filter[32*(i+1)-1:32*i] = voice_filter[i];
+	assign wavetable_sel[24*(i+1)-1:24*i] = voice_wavetable[i];
+end
+
+for (i = 0; i < 16; i = i + 1) begin : wavetable_map_flattening
+	assign wavetable_map[16*(i+1)-1:16*i] = wavetable_map_r[i];
 end
 endgenerate
 
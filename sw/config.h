@@ -7,8 +7,15 @@
 #define BOARD_UART_BASE		0x90000000
 #define BOARD_UART_BAUD		115200
 #define BOARD_UART_IRQ		2
+#define BOARD_I2C_BASE		0xa0000000
+/*
+ * Has to match the interrupt line of the I2C core in the SoC, i2c_task()
+ * reports it and polls the core if no interrupt arrives on it
+ */
+#define BOARD_I2C_IRQ		10
 
 #define BOARD_SUBLIME_BASE	0x9a000000
+#define BOARD_CODEC_MCLK_FREQ	12.288e6
 
 /* Driver config */
 #define I2C_DRIVER		oci2c
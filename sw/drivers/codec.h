@@ -1,11 +1,20 @@
 #ifndef _CODEC_H_
 #define _CODEC_H_
+#include <stdint.h>
 #include <config.h>
 
 #if (CODEC_DRIVER == ssm2603)
 #define codec_init	ssm2603_init
+#define codec_set_volume	ssm2603_set_volume
+#define codec_set_mute		ssm2603_set_mute
+#define codec_task		ssm2603_task
 #endif
 
 extern void codec_init(void);
+/* These only queue up the register updates, they don't wait for the bus */
+extern void codec_set_volume(uint8_t volume);
+extern void codec_set_mute(int mute);
+/* Report the failed register writes, called from the main loop */
+extern void codec_task(void);
 
 #endif
@@ -1,15 +1,39 @@
 #ifndef _I2C_H_
 #define _I2C_H_
+#include <stdint.h>
 #include <config.h>
 
 #if (I2C_DRIVER == oci2c)
 #define i2c_init	oci2c_init
-#define i2c_write	oci2c_write
-#define i2c_read	oci2c_read
+#define i2c_submit	oci2c_submit
+#define i2c_flush	oci2c_flush
+#define i2c_task	oci2c_task
 #endif
 
+/* Most bytes written by one transaction */
+#define I2C_MAX_WRITE	4
+
+/*
+ * A transaction writes write_len bytes to the device and then, after a
+ * repeated start, reads read_len bytes into read_buf, either part may be
+ * empty. done is called with 0 when the transaction has finished and with a
+ * negative value if it failed, from the I2C interrupt, i2c_flush() or
+ * i2c_task(). -3 means the I2C core didn't finish a step in time.
+ */
+struct i2c_xfer {
+	uint8_t address;
+	uint8_t write_len;
+	uint8_t write_buf[I2C_MAX_WRITE];
+	uint8_t read_len;
+	uint8_t *read_buf;
+	void (*done)(void *private_data, int err);
+	void *private_data;
+};
+
 extern void i2c_init(void);
-extern void i2c_write(uint8_t address, uint8_t *buf, uint32_t len, int stop);
-extern void i2c_read(uint8_t address, uint8_t *buf, uint32_t len, int stop);
+extern int i2c_submit(const struct i2c_xfer *xfer);
+extern void i2c_flush(void);
+/* Report the failed transactions, called from the main loop */
+extern void i2c_task(void);
 
 #endif
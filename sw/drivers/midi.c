@@ -1,61 +1,152 @@
 #include <stdint.h>
 #include <midi.h>
 
-/* Increase this when needed... */
-#define MAX_CALLBACKS	10
+/* Number of parsed events that can be queued, must be a power of 2 */
+#define MIDI_QUEUE_SIZE	64
 
+/* SysEx bytes that can be buffered, must be a power of 2 */
+#define MIDI_SYSEX_BUF_SIZE	256
 
-struct midi_event {
-	void (*cb[MAX_CALLBACKS])(struct midi *midi);
-	uint8_t listen_chan[MAX_CALLBACKS];
-	void *private_data[MAX_CALLBACKS];
-	int cb_cnt;
+#define barrier()	__asm__ __volatile__("" : : : "memory")
+
+struct midi_handler {
+	void (*cb)(struct midi *midi);
+	void *private_data;
+};
+
+struct midi_queue_entry {
+	int event_type;
+	struct midi midi;
 };
 
-static struct midi_event midi_events[MIDI_EVENT_MAX];
-static struct midi_msg midi_msg;
+/*
+ * State of the byte parser, only touched by the receiving interrupt.
+ * status is kept after a channel message for running status, and cleared
+ * by the system messages. len is the number of data bytes the message takes
+ * and pos the number received so far.
+ */
+struct midi_parser {
+	uint8_t status;
+	uint8_t len;
+	uint8_t pos;
+	uint8_t data[2];
+	/* Receiving a SysEx message */
+	uint8_t sysex;
+	/* Bytes and flags of the SysEx chunk being received */
+	uint8_t sysex_len;
+	uint8_t sysex_flags;
+};
+
+/*
+ * Data bytes that follow each status byte, indexed by status - 0x80.
+ * SysEx data is not counted, it runs until the next status byte.
+ */
+static const uint8_t midi_msg_len[0x80] = {
+	[0x00 ... 0x3f]	= 2,	/* note off/on, poly pressure, control change */
+	[0x40 ... 0x5f]	= 1,	/* program change, channel pressure */
+	[0x60 ... 0x6f]	= 2,	/* pitchwheel change */
+	[0x71]		= 1,	/* time code quarter frame */
+	[0x72]		= 2,	/* song position */
+	[0x73]		= 1,	/* song select */
+};
 
-static void midi_handle_event(struct midi_event *event, struct midi *midi)
+/* Passed as the data of the messages that have none */
+static const uint8_t midi_no_data[2];
+
+/* The callbacks, looked up directly by event type and channel */
+static struct midi_handler midi_handlers[MIDI_EVENT_MAX][MIDI_NUM_CHANNELS];
+static struct midi_parser midi_parser;
+
+/*
+ * Single producer, single consumer queue of parsed events.
+ * The head is only written by the receiving interrupt and the tail only
+ * by midi_task(), both are free running and wrap around.
+ */
+static struct midi_queue_entry midi_queue[MIDI_QUEUE_SIZE];
+static volatile uint32_t midi_queue_head;
+static volatile uint32_t midi_queue_tail;
+static struct midi_stats midi_stats;
+
+/*
+ * The SysEx bytes, in the same way as the event queue. The bytes of a chunk
+ * are pushed as they arrive and handed to the consumer by the
+ * MIDI_EVENT_SYSEX event that is queued when the chunk is complete.
+ */
+static uint8_t midi_sysex_buf[MIDI_SYSEX_BUF_SIZE];
+static volatile uint32_t midi_sysex_head;
+static volatile uint32_t midi_sysex_tail;
+
+static void midi_handle_event(int event_type, struct midi *midi)
 {
-	int i;
+	struct midi_handler *handler = &midi_handlers[event_type][midi->chan];
 
-	for (i = 0; i < event->cb_cnt; i++) {
-		if (event->cb[i] && (event->listen_chan[i] == 0xff ||
-				     event->listen_chan[i] == midi->chan)) {
-			midi->private_data = event->private_data[i];
-			event->cb[i](midi);
-		}
+	if (!handler->cb)
+		return;
+
+	midi->private_data = handler->private_data;
+	handler->cb(midi);
+}
+
+/*
+ * Queue up an event for midi_task().
+ * Returns 0 on success, -1 if the queue is full.
+ */
+static int midi_queue_event(int event_type, struct midi *midi)
+{
+	uint32_t head = midi_queue_head;
+	uint32_t used = head - midi_queue_tail;
+	struct midi_queue_entry *entry;
+
+	if (used >= MIDI_QUEUE_SIZE) {
+		midi_stats.queue_overflows++;
+		return -1;
 	}
+
+	entry = &midi_queue[head & (MIDI_QUEUE_SIZE - 1)];
+	entry->event_type = event_type;
+	entry->midi = *midi;
+
+	/* The entry has to be in place before it is made visible */
+	barrier();
+	midi_queue_head = head + 1;
+
+	if (used + 1 > midi_stats.queue_high_water)
+		midi_stats.queue_high_water = used + 1;
+
+	return 0;
 }
 
 /*
- * Parse the midi msg type
+ * Turn a complete message into an event and queue it up
  */
-void midi_handle_msg(struct midi_msg *msg)
+static void midi_handle_msg(uint8_t status, const uint8_t *data)
 {
 	struct midi midi;
-	uint8_t status_byte = msg->data[0];
 
-	midi.chan = get_chan(status_byte);
+	if (status >= SYSEX_MSG) {
+		midi.chan = 0;
+		midi.system.status = status;
+		midi.system.data[0] = data[0];
+		midi.system.data[1] = data[1];
+		midi_queue_event(MIDI_EVENT_SYSTEM, &midi);
+		return;
+	}
+
+	midi.chan = get_chan(status);
 
-	switch (status_byte & 0xf0) {
+	switch (status & 0xf0) {
 	case NOTE_ON:
 		/* Treat note on with 0 velocity as note off */
-		if (msg->data[2] == 0) {
-			msg->data[0] = (status_byte & 0x0f) | NOTE_OFF;
-			midi_handle_msg(msg);
-			break;
-		}
-
-		midi.note.key = msg->data[1];
-		midi.note.velocity = msg->data[2];
-		midi_handle_event(&midi_events[MIDI_EVENT_NOTE_ON], &midi);
+		midi.note.key = data[0];
+		midi.note.velocity = data[1];
+		midi_queue_event(data[1] ? MIDI_EVENT_NOTE_ON :
+				 MIDI_EVENT_NOTE_OFF, &midi);
 		break;
 
 	case NOTE_OFF:
-		midi.note.key = msg->data[1];
-		midi.note.velocity = msg->data[2];
-		midi_handle_event(&midi_events[MIDI_EVENT_NOTE_OFF], &midi);
+		midi.note.key = data[0];
+		midi.note.velocity = data[1];
+		midi_queue_event(MIDI_EVENT_NOTE_OFF, &midi);
 		break;
 
 	case PITCHWHEEL_CHANGE:
@@ -63,14 +154,14 @@ void midi_handle_msg(struct midi_msg *msg)
 		 * pitchwheel change data is a 14 bit unsigned value with 0x2000
 		 * representing 0
 		 */
-		midi.pitchwheel = ((msg->data[2] << 7) | msg->data[1]) - 0x2000;
-		midi_handle_event(&midi_events[MIDI_EVENT_PW_CHANGE], &midi);
+		midi.pitchwheel = ((data[1] << 7) | data[0]) - 0x2000;
+		midi_queue_event(MIDI_EVENT_PW_CHANGE, &midi);
 		break;
 
 	case CONTROL_CHANGE:
-		midi.cc.controller = msg->data[1];
-		midi.cc.value = msg->data[2];
-		midi_handle_event(&midi_events[MIDI_EVENT_CC], &midi);
+		midi.cc.controller = data[0];
+		midi.cc.value = data[1];
+		midi_queue_event(MIDI_EVENT_CC, &midi);
 		break;
 
 	default:
@@ -78,61 +169,167 @@ void midi_handle_msg(struct midi_msg *msg)
 	}
 }
 
+/*
+ * Queue up the SysEx chunk received so far. If the event can not be
+ * queued, its bytes are taken back out of the buffer, midi_task() has not
+ * seen them yet.
+ */
+static void midi_sysex_flush(struct midi_parser *p, uint8_t flags)
+{
+	struct midi midi;
+
+	midi.chan = 0;
+	midi.sysex.data = NULL;
+	midi.sysex.len = p->sysex_len;
+	midi.sysex.flags = p->sysex_flags | flags;
+
+	if (midi_queue_event(MIDI_EVENT_SYSEX, &midi)) {
+		midi_sysex_head -= p->sysex_len;
+		p->sysex_flags = MIDI_SYSEX_ERROR;
+	} else {
+		p->sysex_flags = 0;
+	}
+	p->sysex_len = 0;
+}
+
+static void midi_sysex_byte(struct midi_parser *p, uint8_t data)
+{
+	uint32_t head = midi_sysex_head;
+
+	if (head - midi_sysex_tail >= MIDI_SYSEX_BUF_SIZE) {
+		midi_stats.sysex_overflows++;
+		p->sysex_flags |= MIDI_SYSEX_ERROR;
+		return;
+	}
+
+	midi_sysex_buf[head & (MIDI_SYSEX_BUF_SIZE - 1)] = data;
+	midi_sysex_head = head + 1;
+
+	if (++p->sysex_len == MIDI_SYSEX_CHUNK)
+		midi_sysex_flush(p, 0);
+}
+
 /*
  * Receives one byte in the midi stream and organizes it into
- * the current message.
+ * the current message. Realtime bytes may come in the middle of another
+ * message and are passed on right away. A status byte ends an unfinished
+ * SysEx message, anything else that is not SYSEX_END marks it as cut short.
  */
 void midi_receive_byte(uint8_t data)
 {
-	static int pos = 0;
-	static uint8_t status_byte = 0;
-	int msg_done = 0;
+	struct midi_parser *p = &midi_parser;
 
-	struct midi_msg *msg = &midi_msg;
+	if (data >= REALTIME_MASK) {
+		midi_handle_msg(data, midi_no_data);
+		return;
+	}
 
-	msg->data[0] = status_byte;
 	if (data & STATUS_BYTE_MASK) {
-		msg->data[0] = status_byte = data;
-		pos = 1;
-		if ((data & REALTIME_MASK) == REALTIME_MASK || data > 0xf3)
-			msg_done = 1;
-	} else {
-		msg->data[pos++] = data;
-		if ((pos > 2) || (status_byte > 0xbf && status_byte < 0xe0) ||
-		    (status_byte == 0xf3))
-			msg_done = 1;
+		if (p->sysex) {
+			p->sysex = 0;
+			midi_sysex_flush(p, MIDI_SYSEX_END |
+					 (data == SYSEX_END ? 0 :
+					  MIDI_SYSEX_ERROR));
+		}
+
+		p->pos = 0;
+		p->len = midi_msg_len[data - 0x80];
+		p->status = data;
+
+		if (data == SYSEX_MSG) {
+			p->sysex = 1;
+			p->sysex_len = 0;
+			p->sysex_flags = MIDI_SYSEX_START;
+			p->status = 0;
+		} else if (data >= SYSEX_MSG && !p->len) {
+			/* System common messages cancel running status */
+			if (data != SYSEX_END)
+				midi_handle_msg(data, midi_no_data);
+			p->status = 0;
+		}
+		return;
 	}
 
-	msg->len = pos;
-	if (msg_done) {
-		pos = 1;
-		/*
-		 * TODO: create msg queue and move this out of interrupt context
-		 */
-		midi_handle_msg(msg);
+	if (p->sysex) {
+		midi_sysex_byte(p, data);
+		return;
+	}
+
+	if (!p->status) {
+		midi_stats.stray_bytes++;
+		return;
+	}
+
+	p->data[p->pos++] = data;
+	if (p->pos < p->len)
+		return;
+
+	midi_handle_msg(p->status, p->data);
+	p->pos = 0;
+	if (p->status >= SYSEX_MSG)
+		p->status = 0;
+}
+
+/*
+ * Dispatch the events queued up by the receiving interrupt to the
+ * registered callbacks, this is called from the main loop.
+ */
+void midi_task(void)
+{
+	uint32_t tail = midi_queue_tail;
+	struct midi_queue_entry *entry;
+
+	uint8_t sysex[MIDI_SYSEX_CHUNK];
+	uint32_t sysex_tail;
+	int i;
+
+	while (tail != midi_queue_head) {
+		barrier();
+		entry = &midi_queue[tail & (MIDI_QUEUE_SIZE - 1)];
+		if (entry->event_type == MIDI_EVENT_SYSEX) {
+			/* Copy the chunk out of the SysEx buffer */
+			sysex_tail = midi_sysex_tail;
+			for (i = 0; i < entry->midi.sysex.len; i++)
+				sysex[i] = midi_sysex_buf[(sysex_tail + i) &
+							  (MIDI_SYSEX_BUF_SIZE - 1)];
+			barrier();
+			midi_sysex_tail = sysex_tail + entry->midi.sysex.len;
+			entry->midi.sysex.data = sysex;
+		}
+		midi_handle_event(entry->event_type, &entry->midi);
+		midi_queue_tail = ++tail;
 	}
 }
 
+void midi_get_stats(struct midi_stats *stats)
+{
+	*stats = midi_stats;
+}
+
 /*
- * Register a callback for a midi event.
+ * Register a callback for a midi event on listen_chan, or on all channels
+ * with MIDI_ALL_CHANNELS. There is one callback per event and channel, it
+ * replaces the one registered before, a NULL cb removes it.
  * Returns 0 on success.
  */
 int midi_register_cb(int event_type, void *private_data, uint8_t listen_chan,
 		     void (*cb)(struct midi *midi))
 {
-	struct midi_event *event;
+	int chan;
 
-	if (event_type > MIDI_EVENT_MAX || event_type < 0)
+	if (event_type >= MIDI_EVENT_MAX || event_type < 0)
 		return -1;
 
-	event = &midi_events[event_type];
-	if (event->cb_cnt >= MAX_CALLBACKS)
+	if (listen_chan != MIDI_ALL_CHANNELS &&
+	    listen_chan >= MIDI_NUM_CHANNELS)
 		return -2;
 
-	event->cb[event->cb_cnt] = cb;
-	event->private_data[event->cb_cnt] = private_data;
-	event->listen_chan[event->cb_cnt] = listen_chan;
-	event->cb_cnt++;
+	for (chan = 0; chan < MIDI_NUM_CHANNELS; chan++) {
+		if (listen_chan != MIDI_ALL_CHANNELS && chan != listen_chan)
+			continue;
+		midi_handlers[event_type][chan].cb = cb;
+		midi_handlers[event_type][chan].private_data = private_data;
+	}
 
 	return 0;
 }
@@ -16,19 +16,32 @@
 #define CONTROL_CHANGE		0xb0
 #define PITCHWHEEL_CHANGE	0xe0
 #define SYSEX_MSG		0xf0
+#define SYSEX_END		0xf7
+
+#define MIDI_NUM_CHANNELS	16
+/* listen_chan value that registers a callback on all channels */
+#define MIDI_ALL_CHANNELS	0xff
 
 enum {
 	MIDI_EVENT_NOTE_ON,
 	MIDI_EVENT_NOTE_OFF,
 	MIDI_EVENT_CC,
 	MIDI_EVENT_PW_CHANGE,
+	/* System common and realtime messages, dispatched on channel 0 */
+	MIDI_EVENT_SYSTEM,
+	/* SysEx chunks, dispatched on channel 0 */
+	MIDI_EVENT_SYSEX,
 	MIDI_EVENT_MAX
 };
 
-struct midi_msg {
-	size_t len;
-	uint8_t data[128];
-};
+/* Largest SysEx chunk passed to the consumer */
+#define MIDI_SYSEX_CHUNK	32
+
+/* SysEx chunk flags */
+#define MIDI_SYSEX_START	(1 << 0)	/* first chunk of a message */
+#define MIDI_SYSEX_END		(1 << 1)	/* last chunk of a message */
+#define MIDI_SYSEX_ERROR	(1 << 2)	/* bytes were lost or the
+						   message was cut short */
 
 struct midi_note {
 	uint8_t key;
@@ -40,24 +53,52 @@ struct midi_control_change {
 	uint8_t value;
 };
 
+struct midi_system {
+	uint8_t status;
+	uint8_t data[2];
+};
+
+/*
+ * A piece of a SysEx message, without the SYSEX_MSG and SYSEX_END bytes.
+ * data is only valid during the callback.
+ */
+struct midi_sysex {
+	const uint8_t *data;
+	uint8_t len;
+	uint8_t flags;
+};
+
 struct midi {
 	uint8_t chan;
 	union {
 		struct midi_note note;
 		int16_t pitchwheel;
 		struct midi_control_change cc;
+		struct midi_system system;
+		struct midi_sysex sysex;
 	};
 	void *private_data;
 };
 
+struct midi_stats {
+	uint32_t queue_high_water;
+	uint32_t queue_overflows;
+	/* SysEx bytes dropped because the SysEx buffer was full */
+	uint32_t sysex_overflows;
+	/* Data bytes received without a status byte */
+	uint32_t stray_bytes;
+};
+
 static inline uint8_t get_chan(uint8_t status_byte)
 {
-	return (status_byte >> 4) & 0xf;
+	return status_byte & 0xf;
 }
 
 extern void midi_init(void);
 extern void midi_driver_init(void);
 extern void midi_receive_byte(uint8_t data);
+extern void midi_task(void);
+extern void midi_get_stats(struct midi_stats *stats);
 extern int midi_register_cb(int event_type, void *private_data,
 			    uint8_t listen_chan, void (*cb)(struct midi *midi));
 
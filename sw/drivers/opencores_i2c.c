@@ -1,8 +1,19 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <config.h>
+#include <irq.h>
+#include <io.h>
+#include <timer.h>
+#include <i2c.h>
 
-#define OCI2C_BASE_ADDR	0xa0000000
+/* Number of transactions that can be queued, must be a power of 2 */
+#define OCI2C_QUEUE_SIZE	16
+
+/*
+ * Time without progress after which oci2c_task() steps in, a byte takes
+ * ~90 us at 100 kHz
+ */
+#define OCI2C_TIMEOUT_US	10000
 
 #define OCI2C_PRERLO	0x0
 #define OCI2C_PRERHI	0x1
@@ -28,20 +39,194 @@
 #define OCI2C_SR_TIP	(1<<1)
 #define OCI2C_SR_IF	(1<<0)
 
+/*
+ * The step of the transaction at the head of the queue that the core is
+ * working on, each step ends with an interrupt.
+ */
+enum {
+	OCI2C_IDLE,
+	OCI2C_WRITE,		/* sending the address or a data byte */
+	OCI2C_READ_ADDR,	/* sending the address for the read */
+	OCI2C_READ,		/* receiving a data byte */
+	OCI2C_STOP,		/* releasing the bus after a NACK */
+};
+
+/*
+ * The queued transactions, added by oci2c_submit() and taken off by the
+ * interrupt when they have finished. Both sides run with interrupts
+ * disabled.
+ */
+static struct i2c_xfer oci2c_queue[OCI2C_QUEUE_SIZE];
+static volatile uint32_t oci2c_queue_head;
+static volatile uint32_t oci2c_queue_tail;
+static int oci2c_state;
+static int oci2c_pos;
+/* Error of the transaction that is waiting for its stop */
+static int oci2c_err;
+
+/*
+ * Failed transactions, counted by the interrupt and reported from the main
+ * loop by oci2c_task()
+ */
+static volatile uint32_t oci2c_errors;
+static volatile uint8_t oci2c_error_addr;
+static uint32_t oci2c_errors_reported;
+
+/*
+ * Watchdog of oci2c_task(), the transactions started and steps taken, the
+ * count it last saw and the time it changed. When the core has finished a step that the interrupt
+ * hasn't picked up, BOARD_I2C_IRQ is taken to be wrong and the core is
+ * polled from then on.
+ */
+static volatile uint32_t oci2c_steps;
+static uint32_t oci2c_watch_steps;
+static uint64_t oci2c_watch_ticks;
+static int oci2c_polled;
+static int oci2c_polled_reported;
+
 static void oci2c_write_reg(uint32_t reg, uint8_t value)
 {
-	*((volatile uint8_t *)(OCI2C_BASE_ADDR + reg)) = value;
+	io_write8((void *)(uintptr_t)(BOARD_I2C_BASE + reg), value);
 }
 
 static uint8_t oci2c_read_reg(uint32_t reg)
 {
-	return *((volatile uint8_t *)(OCI2C_BASE_ADDR + reg));
+	return io_read8((void *)(uintptr_t)(BOARD_I2C_BASE + reg));
+}
+
+/* Send the address byte of xfer, with a (repeated) start */
+static void oci2c_send_addr(struct i2c_xfer *xfer, uint8_t rw)
+{
+	/* bit 0: 0 = write, 1 = read*/
+	oci2c_write_reg(OCI2C_TXR, xfer->address << 1 | rw);
+	oci2c_write_reg(OCI2C_CR, OCI2C_CR_STA | OCI2C_CR_WR | OCI2C_CR_IACK);
+	oci2c_state = rw ? OCI2C_READ_ADDR : OCI2C_WRITE;
+	oci2c_pos = 0;
+}
+
+static void oci2c_start(void)
+{
+	struct i2c_xfer *xfer;
+
+	if (oci2c_queue_tail == oci2c_queue_head)
+		return;
+
+	oci2c_steps++;
+	xfer = &oci2c_queue[oci2c_queue_tail & (OCI2C_QUEUE_SIZE - 1)];
+	oci2c_send_addr(xfer, !xfer->write_len);
+}
+
+/* Read the next byte, with a stop and no ack on the last one */
+static void oci2c_read_next(struct i2c_xfer *xfer)
+{
+	uint8_t control_reg = OCI2C_CR_RD | OCI2C_CR_IACK;
+
+	if (oci2c_pos == xfer->read_len - 1)
+		control_reg |= OCI2C_CR_STO | OCI2C_CR_ACK;
+	oci2c_write_reg(OCI2C_CR, control_reg);
+	oci2c_state = OCI2C_READ;
+}
+
+/* Take the transaction off the queue, report it and start the next one */
+static void oci2c_finish(struct i2c_xfer *xfer, int err)
+{
+	void (*done)(void *private_data, int err) = xfer->done;
+	void *private_data = xfer->private_data;
+
+	if (err) {
+		oci2c_errors++;
+		oci2c_error_addr = xfer->address;
+	}
+
+	oci2c_write_reg(OCI2C_CR, OCI2C_CR_IACK);
+	oci2c_state = OCI2C_IDLE;
+	oci2c_queue_tail++;
+	if (done)
+		done(private_data, err);
+	if (oci2c_state == OCI2C_IDLE)
+		oci2c_start();
+}
+
+/*
+ * A NACKed transaction still holds the bus, send the stop and finish it on
+ * the interrupt that ends the stop.
+ */
+static void oci2c_stop(int err)
+{
+	oci2c_write_reg(OCI2C_CR, OCI2C_CR_STO | OCI2C_CR_IACK);
+	oci2c_err = err;
+	oci2c_state = OCI2C_STOP;
+}
+
+/* Move the transaction on when the core has finished a byte */
+static void oci2c_step(void)
+{
+	struct i2c_xfer *xfer;
+	uint8_t control_reg;
+	uint8_t status;
+
+	oci2c_steps++;
+	xfer = &oci2c_queue[oci2c_queue_tail & (OCI2C_QUEUE_SIZE - 1)];
+	status = oci2c_read_reg(OCI2C_SR);
+	/* The bus belongs to the other master, no stop is sent */
+	if (status & OCI2C_SR_AL) {
+		oci2c_finish(xfer, -1);
+		return;
+	}
+
+	switch (oci2c_state) {
+	case OCI2C_WRITE:
+		if (status & OCI2C_SR_RXACK) {
+			oci2c_stop(-2);
+			break;
+		}
+
+		if (oci2c_pos < xfer->write_len) {
+			oci2c_write_reg(OCI2C_TXR,
+					xfer->write_buf[oci2c_pos++]);
+			control_reg = OCI2C_CR_WR | OCI2C_CR_IACK;
+			/* generate stop on last xfer */
+			if (oci2c_pos == xfer->write_len && !xfer->read_len)
+				control_reg |= OCI2C_CR_STO;
+			oci2c_write_reg(OCI2C_CR, control_reg);
+		} else if (xfer->read_len) {
+			oci2c_send_addr(xfer, 1);
+		} else {
+			oci2c_finish(xfer, 0);
+		}
+		break;
+
+	case OCI2C_READ_ADDR:
+		if (status & OCI2C_SR_RXACK) {
+			oci2c_stop(-2);
+			break;
+		}
+
+		oci2c_read_next(xfer);
+		break;
+
+	case OCI2C_READ:
+		xfer->read_buf[oci2c_pos++] = oci2c_read_reg(OCI2C_RXR);
+		if (oci2c_pos < xfer->read_len)
+			oci2c_read_next(xfer);
+		else
+			oci2c_finish(xfer, 0);
+		break;
+
+	case OCI2C_STOP:
+		oci2c_finish(xfer, oci2c_err);
+		break;
+
+	default:
+		oci2c_write_reg(OCI2C_CR, OCI2C_CR_IACK);
+		break;
+	}
 }
 
-static void wait_for_transfer(void)
+static void oci2c_isr(void *private_data)
 {
-	while (oci2c_read_reg(OCI2C_SR) & OCI2C_SR_TIP)
-		;
+	if (oci2c_read_reg(OCI2C_SR) & OCI2C_SR_IF)
+		oci2c_step();
 }
 
 void oci2c_init(void)
@@ -49,57 +234,123 @@ void oci2c_init(void)
 	/* TODO: make this configurable... */
 	uint16_t prescaler = BOARD_CLK_FREQ/(5*100e3) - 1;
 
+	oci2c_queue_head = 0;
+	oci2c_queue_tail = 0;
+	oci2c_state = OCI2C_IDLE;
+
 	/* Set prescaler */
 	oci2c_write_reg(OCI2C_PRERHI, prescaler >> 8);
 	oci2c_write_reg(OCI2C_PRERLO, prescaler & 0xff);
 
-	/* Enable core */
-	oci2c_write_reg(OCI2C_CTR, OCI2C_CTR_EN);
+	/* Enable core and its interrupt */
+	oci2c_write_reg(OCI2C_CTR, OCI2C_CTR_EN | OCI2C_CTR_IEN);
+
+	irq_install_isr(BOARD_I2C_IRQ, oci2c_isr);
+	irq_set_mask(irq_get_mask() | (1<<BOARD_I2C_IRQ));
 }
 
-void oci2c_write_addr(uint8_t address, uint8_t rw)
+/*
+ * Queue up a transaction, it is started right away if the bus is idle.
+ * Returns 0 on success, -1 if the queue is full or the transaction is
+ * invalid.
+ */
+int oci2c_submit(const struct i2c_xfer *xfer)
 {
-	/* bit 0: 0 = write, 1 = read*/
-	oci2c_write_reg(OCI2C_TXR, address << 1 | rw);
-	oci2c_write_reg(OCI2C_CR, OCI2C_CR_STA | OCI2C_CR_WR);
-	wait_for_transfer();
-	if (oci2c_read_reg(OCI2C_SR) & OCI2C_SR_RXACK)
-		printf("oci2c_write_addr: Error writing  0x%x\r\n", address);
+	unsigned long flags;
+	uint32_t head;
+
+	if (xfer->write_len > I2C_MAX_WRITE ||
+	    (!xfer->write_len && !xfer->read_len))
+		return -1;
+
+	flags = irq_save();
+	head = oci2c_queue_head;
+	if (head - oci2c_queue_tail >= OCI2C_QUEUE_SIZE) {
+		irq_restore(flags);
+		return -1;
+	}
+
+	oci2c_queue[head & (OCI2C_QUEUE_SIZE - 1)] = *xfer;
+	oci2c_queue_head = head + 1;
+	if (oci2c_state == OCI2C_IDLE)
+		oci2c_start();
+	irq_restore(flags);
+
+	return 0;
 }
 
-void oci2c_write(uint8_t address, uint8_t *buf, uint32_t len, int stop)
+/*
+ * Wait until all queued transactions, and the ones their callbacks queue
+ * up, have finished. The core is polled, so this also works before the
+ * interrupts are enabled.
+ */
+void oci2c_flush(void)
 {
-	uint8_t control_reg = OCI2C_CR_WR;
-
-	oci2c_write_addr(address, 0);
-	while (len--) {
-		oci2c_write_reg(OCI2C_TXR, *buf++);
-		/* generate stop on last xfer */
-		if (!len && stop)
-			control_reg |= OCI2C_CR_STO;
-		oci2c_write_reg(OCI2C_CR, control_reg);
-		wait_for_transfer();
-
-		if (oci2c_read_reg(OCI2C_SR) & OCI2C_SR_RXACK) {
-			printf("oci2c_write: Error writing data to 0x%x\r\n",
-			       address);
-			return;
-		}
+	unsigned long flags;
+
+	while (oci2c_queue_tail != oci2c_queue_head) {
+		flags = irq_save();
+		if (oci2c_read_reg(OCI2C_SR) & OCI2C_SR_IF)
+			oci2c_step();
+		irq_restore(flags);
 	}
 }
 
-void oci2c_read(uint8_t address, uint8_t *buf, uint32_t len, int stop)
+/*
+ * Keep the queue moving when the interrupt doesn't: a step the core has
+ * finished is taken from here, and a transaction that the core hasn't
+ * finished a step of within OCI2C_TIMEOUT_US fails with -3.
+ */
+static void oci2c_watchdog(void)
 {
-	uint8_t control_reg = OCI2C_CR_RD;
+	struct i2c_xfer *xfer;
+	unsigned long flags;
+	uint64_t now = timer_get_ticks();
+	int stalled;
 
-	oci2c_write_addr(address, 1);
-	while (len--) {
-		/* generate stop and ack on last xfer */
-		if (!len && stop)
-			control_reg |= OCI2C_CR_STO | OCI2C_CR_ACK;
-		oci2c_write_reg(OCI2C_CR, control_reg);
-		wait_for_transfer();
+	flags = irq_save();
+	stalled = timer_ticks_to_us(now - oci2c_watch_ticks) >=
+		  OCI2C_TIMEOUT_US;
+	if (oci2c_queue_tail != oci2c_queue_head &&
+	    (oci2c_polled || stalled) &&
+	    (oci2c_read_reg(OCI2C_SR) & OCI2C_SR_IF)) {
+		oci2c_polled = 1;
+		oci2c_step();
+	}
 
-		*buf++ = oci2c_read_reg(OCI2C_RXR);
+	if (oci2c_queue_tail == oci2c_queue_head ||
+	    oci2c_steps != oci2c_watch_steps) {
+		oci2c_watch_steps = oci2c_steps;
+		oci2c_watch_ticks = now;
+	} else if (stalled) {
+		xfer = &oci2c_queue[oci2c_queue_tail & (OCI2C_QUEUE_SIZE - 1)];
+		oci2c_finish(xfer, -3);
 	}
+	irq_restore(flags);
+}
+
+/*
+ * Watch over the queue and print the transactions that have failed since
+ * the last call
+ */
+void oci2c_task(void)
+{
+	uint32_t errors;
+
+	oci2c_watchdog();
+
+	if (oci2c_polled && !oci2c_polled_reported) {
+		printf("oci2c: no interrupt on line %d, polling the core\r\n",
+		       BOARD_I2C_IRQ);
+		oci2c_polled_reported = 1;
+	}
+
+	errors = oci2c_errors;
+	if (errors == oci2c_errors_reported)
+		return;
+
+	printf("oci2c: %u failed transfers, the last to 0x%x\r\n",
+	       (unsigned int)(errors - oci2c_errors_reported),
+	       oci2c_error_addr);
+	oci2c_errors_reported = errors;
 }
@@ -1,5 +1,8 @@
+#include <stdio.h>
 #include <stdint.h>
+#include <irq.h>
 #include <i2c.h>
+#include <codec.h>
 #include <delay.h>
 
 #define SSM2603_DEVICE_ADDR		0x1a
@@ -66,6 +69,10 @@
 #define SSM2603_WL_24BIT		SSM2603_WL(2)
 #define SSM2603_WL_32BIT		SSM2603_WL(3)
 #define SSM2603_FORMAT(x)		((x & 0x3) << 0)
+#define SSM2603_FORMAT_RJ		SSM2603_FORMAT(0)
+#define SSM2603_FORMAT_LJ		SSM2603_FORMAT(1)
+#define SSM2603_FORMAT_I2S		SSM2603_FORMAT(2)
+#define SSM2603_FORMAT_DSP		SSM2603_FORMAT(3)
 
 /* Sampling rate */
 #define SSM2603_SAMPLING_RATE_REG	0x08
@@ -100,62 +107,261 @@
 #define SSM2603_NGG(x)			((x & 0x3) << 1)
 #define SSM2603_NGAT			(1 << 0)
 
+#define SSM2603_NUM_REGS		0x13
+
+/* Number of register writes that can be pending, must be a power of 2 */
+#define SSM2603_QUEUE_SIZE		32
+
+/*
+ * Registers whose writes sequence the codec power up, every write to them
+ * goes out in the order it was made
+ */
+#define SSM2603_ORDERED_REGS		(1 << SSM2603_POWER_MANAGEMENT_REG | \
+					 1 << SSM2603_ACTIVE_REG | \
+					 1 << SSM2603_SW_RESET_REG)
+
+struct ssm2603_write {
+	uint8_t address;
+	uint16_t data;
+};
+
+/*
+ * Shadow copy of the codec registers. Updates go to the shadow and are
+ * queued up, the queue is written one register at a time in the
+ * background in the order the updates were made. A register that is
+ * changed again before its write has gone out is only written once, with
+ * the new value in the place of the old one, except for the registers in
+ * SSM2603_ORDERED_REGS.
+ */
+static uint16_t ssm2603_regs[SSM2603_NUM_REGS];
+static struct ssm2603_write ssm2603_queue[SSM2603_QUEUE_SIZE];
+static volatile uint32_t ssm2603_queue_head;
+static volatile uint32_t ssm2603_queue_tail;
+static volatile int ssm2603_busy;
+
+/*
+ * Failed register writes, counted from the I2C interrupt and reported from
+ * the main loop by ssm2603_task()
+ */
+static volatile uint32_t ssm2603_errors;
+static volatile uint8_t ssm2603_error_reg;
+static uint32_t ssm2603_errors_reported;
+
+/* Registers read at init, that the driver only changes some bits in */
+static const uint8_t ssm2603_read_regs[] = {
+	SSM2603_ANALOG_AUDIO_PATH_REG,
+	SSM2603_DIGITAL_AUDIO_PATH_REG,
+	SSM2603_DIGITAL_AUDIO_IF_REG,
+	SSM2603_SAMPLING_RATE_REG,
+};
+
+static void ssm2603_sync(void);
+
+static void ssm2603_write_done(void *private_data, int err)
+{
+	if (err) {
+		ssm2603_errors++;
+		ssm2603_error_reg = (uintptr_t)private_data;
+	}
+	ssm2603_busy = 0;
+	ssm2603_sync();
+}
+
 /*
  * Registers are 9-bit wide and address is 7-bit wide.
  * A write consists of two 8 bit i2c writes:
  * write 1: [7:1] = address[6:0], [0] = data[8]
  * write 2: [7:0] = data[7:0]
+ *
+ * Submit the oldest queued register write, unless a write is already on
+ * its way, its completion submits the next one.
+ */
+static void ssm2603_sync(void)
+{
+	struct ssm2603_write *write;
+	struct i2c_xfer xfer;
+	unsigned long flags;
+	uint8_t address;
+	uint16_t data;
+
+	flags = irq_save();
+	if (!ssm2603_busy && ssm2603_queue_tail != ssm2603_queue_head) {
+		write = &ssm2603_queue[ssm2603_queue_tail &
+				       (SSM2603_QUEUE_SIZE - 1)];
+		address = write->address;
+		data = write->data;
+
+		xfer.address = SSM2603_DEVICE_ADDR;
+		xfer.write_len = 2;
+		xfer.write_buf[0] = (address << 1) | ((data >> 8) & 0x1);
+		xfer.write_buf[1] = data & 0xff;
+		xfer.read_len = 0;
+		xfer.read_buf = NULL;
+		xfer.done = ssm2603_write_done;
+		xfer.private_data = (void *)(uintptr_t)address;
+
+		if (!i2c_submit(&xfer)) {
+			ssm2603_queue_tail++;
+			ssm2603_busy = 1;
+		}
+	}
+	irq_restore(flags);
+}
+
+/* Wait for the register updates to go out */
+static void ssm2603_flush(void)
+{
+	while (ssm2603_queue_tail != ssm2603_queue_head || ssm2603_busy) {
+		ssm2603_sync();
+		i2c_flush();
+	}
+}
+
+/*
+ * Give a queued write of the register the new value, returns 0 if there is
+ * none that hasn't been submitted yet
  */
+static int ssm2603_merge_write(uint8_t address, uint16_t data)
+{
+	uint32_t i;
+
+	for (i = ssm2603_queue_tail; i != ssm2603_queue_head; i++) {
+		if (ssm2603_queue[i & (SSM2603_QUEUE_SIZE - 1)].address ==
+		    address) {
+			ssm2603_queue[i & (SSM2603_QUEUE_SIZE - 1)].data = data;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Update a register in the background */
 void ssm2603_write_reg(uint8_t address, uint16_t data)
 {
-	uint8_t buf[2];
+	struct ssm2603_write *write;
+	unsigned long flags;
+
+	/* The queue only fills up with writes to the ordered registers */
+	while (ssm2603_queue_head - ssm2603_queue_tail >= SSM2603_QUEUE_SIZE)
+		ssm2603_flush();
 
-	buf[0] = (address << 1) | ((data >> 8) & 0x1);
-	buf[1] = data & 0xff;
-	i2c_write(SSM2603_DEVICE_ADDR, buf, /*len =*/ 2, /*stop =*/ 1);
+	flags = irq_save();
+	ssm2603_regs[address] = data;
+	if ((SSM2603_ORDERED_REGS & (1 << address)) ||
+	    !ssm2603_merge_write(address, data)) {
+		write = &ssm2603_queue[ssm2603_queue_head &
+				       (SSM2603_QUEUE_SIZE - 1)];
+		write->address = address;
+		write->data = data;
+		ssm2603_queue_head++;
+	}
+	irq_restore(flags);
+
+	ssm2603_sync();
 }
 
-uint16_t ssm2603_read_reg(uint8_t address)
+/*
+ * Read the registers in ssm2603_read_regs into the shadow, all reads are
+ * queued up at once.
+ */
+static void ssm2603_read_shadow(void)
 {
-	uint8_t buf[2];
+	uint8_t buf[sizeof(ssm2603_read_regs)][2];
+	struct i2c_xfer xfer;
+	int i;
 
-	buf[0] = address << 1;
-	i2c_write(SSM2603_DEVICE_ADDR, buf,  /*len =*/ 1, /*stop =*/ 0);
-	i2c_read(SSM2603_DEVICE_ADDR, buf, /*len =*/ 2, /*stop =*/ 1);
+	xfer.address = SSM2603_DEVICE_ADDR;
+	xfer.write_len = 1;
+	xfer.read_len = 2;
+	xfer.done = NULL;
+	xfer.private_data = NULL;
+	for (i = 0; i < sizeof(ssm2603_read_regs); i++) {
+		xfer.write_buf[0] = ssm2603_read_regs[i] << 1;
+		xfer.read_buf = buf[i];
+		while (i2c_submit(&xfer))
+			i2c_flush();
+	}
+	i2c_flush();
 
-	return (uint16_t)buf[1] << 8 | buf[0];
+	for (i = 0; i < sizeof(ssm2603_read_regs); i++)
+		ssm2603_regs[ssm2603_read_regs[i]] =
+			(uint16_t)buf[i][1] << 8 | buf[i][0];
 }
 
+/* Set the headphone output volume of both channels, 0x7f is +6 dB */
+void ssm2603_set_volume(uint8_t volume)
+{
+	ssm2603_write_reg(SSM2603_LEFT_DAC_VOL_REG,
+			  SSM2603_LRHPBOTH | SSM2603_LHPVOL(volume));
+}
+
+void ssm2603_set_mute(int mute)
+{
+	uint16_t reg = ssm2603_regs[SSM2603_DIGITAL_AUDIO_PATH_REG];
+
+	if (mute)
+		reg |= SSM2603_DACMU;
+	else
+		reg &= ~SSM2603_DACMU;
+	ssm2603_write_reg(SSM2603_DIGITAL_AUDIO_PATH_REG, reg);
+}
+
+/*
+ * The interrupts are not enabled yet, the queued transactions are run by
+ * polling the I2C core in the flushes.
+ */
 void ssm2603_init(void)
 {
 	uint16_t reg;
 
-
 	/* Reset all registers to default */
 	ssm2603_write_reg(SSM2603_SW_RESET_REG, 0);
+	ssm2603_flush();
 
 	ssm2603_write_reg(SSM2603_POWER_MANAGEMENT_REG, SSM2603_OUT);
+	ssm2603_read_shadow();
 
 	/* Select DAC to the analog output path */
-	reg = ssm2603_read_reg(SSM2603_ANALOG_AUDIO_PATH_REG) | SSM2603_DACSEL;
+	reg = ssm2603_regs[SSM2603_ANALOG_AUDIO_PATH_REG] | SSM2603_DACSEL;
 	ssm2603_write_reg(SSM2603_ANALOG_AUDIO_PATH_REG, reg);
 
 	/* Unmute DAC */
-	reg = ssm2603_read_reg(SSM2603_DIGITAL_AUDIO_PATH_REG) & ~SSM2603_DACMU;
-	ssm2603_write_reg(SSM2603_DIGITAL_AUDIO_PATH_REG, reg);
+	ssm2603_set_mute(0);
 
-	/* Set word length */
-	reg = ssm2603_read_reg(SSM2603_DIGITAL_AUDIO_IF_REG);
-	reg = (reg & ~SSM2603_WL(0xffff)) | SSM2603_WL_32BIT;
+	/*
+	 * Set word length and format, slave mode to match the I2S transmitter
+	 * in the synth core.
+	 */
+	reg = ssm2603_regs[SSM2603_DIGITAL_AUDIO_IF_REG];
+	reg &= ~(SSM2603_WL(0xffff) | SSM2603_FORMAT(0xffff) | SSM2603_MS);
+	reg |= SSM2603_WL_32BIT | SSM2603_FORMAT_I2S;
 	ssm2603_write_reg(SSM2603_DIGITAL_AUDIO_IF_REG, reg);
 
 	/* Set sampling rate (mclk/128)*/
-	reg = ssm2603_read_reg(SSM2603_SAMPLING_RATE_REG);
+	reg = ssm2603_regs[SSM2603_SAMPLING_RATE_REG];
 	reg = (reg & ~SSM2603_SR(0xffff)) | SSM2603_SR(7);
 	ssm2603_write_reg(SSM2603_SAMPLING_RATE_REG, reg);
+	ssm2603_flush();
 
 	delay_ms(100);
 	ssm2603_write_reg(SSM2603_ACTIVE_REG, SSM2603_ACTIVE);
+	ssm2603_flush();
 
 	ssm2603_write_reg(SSM2603_POWER_MANAGEMENT_REG, 0);
+	ssm2603_flush();
+}
+
+/* Print the register writes that have failed since the last call */
+void ssm2603_task(void)
+{
+	uint32_t errors = ssm2603_errors;
+
+	if (errors == ssm2603_errors_reported)
+		return;
+
+	printf("ssm2603: %u failed writes, the last to register %d\r\n",
+	       (unsigned int)(errors - ssm2603_errors_reported),
+	       ssm2603_error_reg);
+	ssm2603_errors_reported = errors;
 }
@@ -0,0 +1,544 @@
+/*
+ * Micro-benchmarks of the synth firmware, built for the host with
+ * 'make host'. Reports the time and the number of register accesses
+ * per operation.
+ *
+ * Usage: sublime_bench [-s] [-b] [-m] [-v voices] [-n iterations]
+ *   -s  use the firmware envelopes instead of the hardware envelopes
+ *   -b  bend the voice frequencies instead of using the hardware pitch bend
+ *   -m  write the voice wavetable registers instead of the wavetable map
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <midi.h>
+#include <sublime.h>
+#include <host.h>
+
+/* Virtual time that passes for each pass of the main loop */
+#define LOOP_TIME_US	1000
+
+/* Size of the synthesized MIDI stream and the number of times it is parsed */
+#define STREAM_SIZE	65536
+#define STREAM_PASSES	16
+
+/* Bytes received between each call to midi_task() in the stream benchmark */
+#define STREAM_TASK_BYTES	16
+
+/* MIDI wire rate, 31250 baud with 10 bits per byte */
+#define MIDI_WIRE_BYTES_PER_S	3125
+
+/* Wavetable entries per SYSEX_WAVETABLE_DATA message of the upload */
+#define UPLOAD_BLOCK	64
+
+struct bench {
+	const char *name;
+	void (*setup)(void);
+	void (*run)(uint32_t i);
+};
+
+static struct sublime sublime_synth;
+static volatile uint32_t sink;
+
+static uint8_t stream[STREAM_SIZE];
+static uint32_t stream_len;
+static uint32_t stream_events;
+static uint32_t stream_sysex_bytes;
+static uint8_t sysex_sum;
+
+static void send(uint8_t status, uint8_t data1, uint8_t data2)
+{
+	midi_receive_byte(status);
+	midi_receive_byte(data1);
+	midi_receive_byte(data2);
+}
+
+/* One pass of the firmware main loop */
+static void loop(void)
+{
+	host_timer_advance(LOOP_TIME_US);
+	midi_task();
+	sublime_task(&sublime_synth);
+}
+
+static uint8_t held_key(int i)
+{
+	return (24 + i) % NUM_MIDI_KEYS;
+}
+
+static void hold_all_voices(void)
+{
+	int i;
+
+	for (i = 0; i < sublime_synth.num_voices; i++) {
+		send(NOTE_ON, held_key(i), 100);
+		loop();
+	}
+}
+
+static void release_all_voices(void)
+{
+	int i;
+
+	for (i = 0; i < NUM_MIDI_KEYS; i++)
+		send(NOTE_OFF, i, 0);
+	loop();
+
+	/* Let the releases run out */
+	for (i = 0; i < 1000; i++)
+		loop();
+}
+
+static void run_note_on_off(uint32_t i)
+{
+	uint8_t key = 36 + i % 48;
+
+	send(NOTE_ON, key, 100);
+	loop();
+	send(NOTE_OFF, key, 0);
+	loop();
+}
+
+static void run_detune_sweep(uint32_t i)
+{
+	send(CONTROL_CHANGE, CC_OSC0_DETUNE_CENTS, i & 0x7f);
+	loop();
+}
+
+static void run_parts_note_on_off(uint32_t i)
+{
+	uint8_t chan = i % MIDI_NUM_CHANNELS;
+	uint8_t key = 36 + i % 48;
+
+	send(NOTE_ON | chan, key, 100);
+	loop();
+	send(NOTE_OFF | chan, key, 0);
+	loop();
+}
+
+static void run_attack_sweep(uint32_t i)
+{
+	send(CONTROL_CHANGE, CC_AMP_ATTACK, i & 0x7f);
+	loop();
+}
+
+static void run_waveform_sweep(uint32_t i)
+{
+	send(CONTROL_CHANGE, CC_OSC0_WAVEFORM, i % (WAVEFORM_SINE + 1));
+	loop();
+}
+
+static void run_cutoff_sweep(uint32_t i)
+{
+	send(CONTROL_CHANGE, CC_FILTER_CUTOFF, i & 0x7f);
+	loop();
+}
+
+static void run_pitchwheel_sweep(uint32_t i)
+{
+	uint16_t value = (i*64) & 0x3fff;
+
+	send(PITCHWHEEL_CHANGE, value & 0x7f, value >> 7);
+	loop();
+}
+
+static void run_task(uint32_t i)
+{
+	loop();
+}
+
+/* A controller that no one listens to, measures the parse and dispatch */
+static void run_midi_parse(uint32_t i)
+{
+	send(CONTROL_CHANGE, 102, i & 0x7f);
+	midi_task();
+}
+
+static void run_get_freq(uint32_t i)
+{
+	sink += sublime_get_freq(i % 120, (int32_t)(i % 200) - 100);
+}
+
+/*
+ * Append a byte to the synthesized stream, with a timing clock in front of
+ * every 24th byte, which often lands in the middle of a message.
+ */
+static void stream_put(uint8_t byte)
+{
+	if (stream_len % 24 == 23)
+		stream[stream_len++] = 0xf8;
+	stream[stream_len++] = byte;
+}
+
+/*
+ * Synthesize a dense stream with the traits of sequencer output: chords
+ * and controller sweeps with running status on all channels, note offs as
+ * note ons with zero velocity and now and then a SysEx message. It is not
+ * a recording, the event mix of real sequencer output may differ.
+ */
+static void build_stream(void)
+{
+	uint32_t beat;
+	uint8_t chan;
+	int i;
+
+	stream_len = 0;
+	for (beat = 0; stream_len < STREAM_SIZE - 256; beat++) {
+		chan = beat % MIDI_NUM_CHANNELS;
+
+		stream_put(NOTE_ON | chan);
+		for (i = 0; i < 4; i++) {
+			stream_put(36 + (beat*7 + i*4) % 48);
+			stream_put(64 + i);
+		}
+
+		stream_put(CONTROL_CHANGE | chan);
+		for (i = 0; i < 8; i++) {
+			stream_put(CC_FILTER_CUTOFF);
+			stream_put((beat + i*16) & 0x7f);
+		}
+
+		stream_put(PITCHWHEEL_CHANGE | chan);
+		for (i = 0; i < 8; i++) {
+			stream_put((beat*i) & 0x7f);
+			stream_put(0x40 + i);
+		}
+
+		stream_put(NOTE_ON | chan);
+		for (i = 0; i < 4; i++) {
+			stream_put(36 + (beat*7 + i*4) % 48);
+			stream_put(0);
+		}
+
+		if (beat % 16 == 15) {
+			stream_put(SYSEX_MSG);
+			for (i = 0; i < 100; i++)
+				stream_put(i & 0x7f);
+			stream_put(SYSEX_END);
+		}
+	}
+}
+
+static void sysex_begin(uint8_t command)
+{
+	stream[stream_len++] = SYSEX_MSG;
+	stream[stream_len++] = SYSEX_ID;
+	stream[stream_len++] = command;
+	sysex_sum = command;
+}
+
+static void sysex_put(uint8_t byte)
+{
+	stream[stream_len++] = byte;
+	sysex_sum += byte;
+}
+
+static void sysex_put_21(uint32_t value)
+{
+	sysex_put(value & 0x7f);
+	sysex_put((value >> 7) & 0x7f);
+	sysex_put((value >> 14) & 0x7f);
+}
+
+/* Pack the bytes in groups of seven, behind a byte with their top bits */
+static void sysex_put_packed(const uint8_t *data, int len)
+{
+	uint8_t msbs;
+	int n;
+	int i;
+	int j;
+
+	for (i = 0; i < len; i += 7) {
+		n = len - i < 7 ? len - i : 7;
+		msbs = 0;
+		for (j = 0; j < n; j++)
+			msbs |= (data[i + j] >> 7) << j;
+		sysex_put(msbs);
+		for (j = 0; j < n; j++)
+			sysex_put(data[i + j] & 0x7f);
+	}
+}
+
+static void sysex_end(void)
+{
+	stream[stream_len++] = -sysex_sum & 0x7f;
+	stream[stream_len++] = SYSEX_END;
+}
+
+/* Notes on all channels, each played by a part of its own, set over SysEx */
+static void play_parts(void)
+{
+	uint32_t i;
+
+	stream_len = 0;
+	sysex_begin(SYSEX_PARTS);
+	sysex_put(MIDI_NUM_CHANNELS);
+	sysex_end();
+
+	for (i = 0; i < stream_len; i++)
+		midi_receive_byte(stream[i]);
+	midi_task();
+
+	if (sublime_synth.num_parts != MIDI_NUM_CHANNELS)
+		fprintf(stderr, "sysex parts: %d parts\n",
+			sublime_synth.num_parts);
+}
+
+static uint32_t upload_entry(int32_t i)
+{
+	return i*0x9e3779b9;
+}
+
+/* The SysEx messages that upload a whole user waveform */
+static void build_upload(uint8_t waveform, int32_t len)
+{
+	uint8_t bytes[UPLOAD_BLOCK*4];
+	uint32_t entry;
+	int32_t offset;
+	int n;
+	int i;
+
+	stream_len = 0;
+	sysex_begin(SYSEX_WAVETABLE_BEGIN);
+	sysex_put(waveform);
+	sysex_put_21(len);
+	sysex_end();
+
+	for (offset = 0; offset < len; offset += n) {
+		n = len - offset < UPLOAD_BLOCK ? len - offset : UPLOAD_BLOCK;
+		for (i = 0; i < n; i++) {
+			entry = upload_entry(offset + i);
+			bytes[4*i] = entry;
+			bytes[4*i + 1] = entry >> 8;
+			bytes[4*i + 2] = entry >> 16;
+			bytes[4*i + 3] = entry >> 24;
+		}
+		sysex_begin(SYSEX_WAVETABLE_DATA);
+		sysex_put_21(offset);
+		sysex_put_packed(bytes, 4*n);
+		sysex_end();
+	}
+
+	sysex_begin(SYSEX_WAVETABLE_COMMIT);
+	sysex_put(waveform);
+	sysex_end();
+}
+
+/*
+ * Upload a user waveform over SysEx and check that it landed in the
+ * wavetable that the waveform now maps to.
+ */
+static void run_upload(void)
+{
+	int32_t len = sublime_synth.wavetable_len;
+	uint32_t errors = sublime_synth.stats.sysex_errors;
+	uint32_t *table;
+	uint64_t writes;
+	uint64_t start;
+	uint64_t ns;
+	int32_t bad = 0;
+	uint32_t i;
+
+	build_upload(0, len);
+
+	writes = host_mmio_writes;
+	start = host_time_ns();
+	for (i = 0; i < stream_len; i++) {
+		midi_receive_byte(stream[i]);
+		if (i % STREAM_TASK_BYTES == STREAM_TASK_BYTES - 1)
+			midi_task();
+	}
+	midi_task();
+	ns = host_time_ns() - start;
+	writes = host_mmio_writes - writes;
+
+	if (sublime_synth.user_wavetable[0] == WAVETABLE_NONE) {
+		printf("sysex upload: not committed\n");
+		return;
+	}
+
+	table = &host_regs[(WAVETABLES + sublime_synth.user_wavetable[0]*
+			    sublime_synth.wavetable_stride)/4];
+	for (i = 0; i < len; i++)
+		if (table[i] != upload_entry(i))
+			bad++;
+
+	printf("sysex upload: %d entries in %u bytes, %.2f writes/entry, "
+	       "%u errors, %d bad entries\n", len, stream_len,
+	       (double)writes/len, sublime_synth.stats.sysex_errors - errors,
+	       bad);
+	printf("sysex upload: %.1f bytes/us, %.0f ms on the wire, "
+	       "%.0f times the wire rate\n", (double)stream_len*1000/ns,
+	       (double)stream_len*1000/MIDI_WIRE_BYTES_PER_S,
+	       (double)stream_len*1e9/ns/MIDI_WIRE_BYTES_PER_S);
+}
+
+static void count_event(struct midi *midi)
+{
+	stream_events++;
+}
+
+static void count_sysex(struct midi *midi)
+{
+	stream_events++;
+	if (midi->sysex.flags & MIDI_SYSEX_ERROR)
+		fprintf(stderr, "sysex error\n");
+	stream_sysex_bytes += midi->sysex.len;
+}
+
+/*
+ * Parse the synthesized stream with callbacks that only count the events,
+ * so the synth is left out of the measurement.
+ */
+static void run_stream(void)
+{
+	struct midi_stats before;
+	struct midi_stats stats;
+	uint64_t start;
+	uint64_t ns;
+	uint64_t bytes;
+	int event;
+	int pass;
+	uint32_t i;
+
+	build_stream();
+	for (event = 0; event < MIDI_EVENT_MAX; event++)
+		midi_register_cb(event, NULL, MIDI_ALL_CHANNELS,
+				 event == MIDI_EVENT_SYSEX ? count_sysex :
+				 count_event);
+
+	midi_get_stats(&before);
+	start = host_time_ns();
+	for (pass = 0; pass < STREAM_PASSES; pass++) {
+		for (i = 0; i < stream_len; i++) {
+			midi_receive_byte(stream[i]);
+			if (i % STREAM_TASK_BYTES == STREAM_TASK_BYTES - 1)
+				midi_task();
+		}
+		midi_task();
+	}
+	ns = host_time_ns() - start;
+	bytes = (uint64_t)stream_len*STREAM_PASSES;
+
+	midi_get_stats(&stats);
+	printf("midi stream: %llu bytes, %u events, %u sysex bytes, "
+	       "%u queue overflows\n", (unsigned long long)bytes,
+	       stream_events, stream_sysex_bytes,
+	       stats.queue_overflows - before.queue_overflows);
+	printf("midi stream: %.1f bytes/us, %.0f times the wire rate\n",
+	       (double)bytes*1000/ns,
+	       (double)bytes*1e9/ns/MIDI_WIRE_BYTES_PER_S);
+}
+
+static const struct bench benches[] = {
+	{ "note on/off",		NULL,		 run_note_on_off },
+	{ "detune cc sweep",		hold_all_voices, run_detune_sweep },
+	{ "attack cc sweep",		hold_all_voices, run_attack_sweep },
+	{ "waveform cc sweep",		hold_all_voices, run_waveform_sweep },
+	{ "cutoff cc sweep",		hold_all_voices, run_cutoff_sweep },
+	{ "pitchwheel sweep",		hold_all_voices, run_pitchwheel_sweep },
+	{ "task, full polyphony",	hold_all_voices, run_task },
+	{ "midi parse",			NULL,		 run_midi_parse },
+	{ "sublime_get_freq",		NULL,		 run_get_freq },
+	{ "note on/off, 16 parts",	play_parts,	 run_parts_note_on_off },
+};
+
+static void run_bench(const struct bench *bench, uint32_t iterations)
+{
+	uint64_t writes;
+	uint64_t reads;
+	uint64_t start;
+	uint64_t ns;
+	uint32_t i;
+
+	if (bench->setup)
+		bench->setup();
+
+	writes = host_mmio_writes;
+	reads = host_mmio_reads;
+	start = host_time_ns();
+	for (i = 0; i < iterations; i++)
+		bench->run(i);
+	ns = host_time_ns() - start;
+	writes = host_mmio_writes - writes;
+	reads = host_mmio_reads - reads;
+
+	printf("%-24s %10.1f %12.2f %12.2f\n", bench->name,
+	       (double)ns/iterations, (double)writes/iterations,
+	       (double)reads/iterations);
+
+	release_all_voices();
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t iterations = 100000;
+	int num_voices = 32;
+	int hw_envelope = 1;
+	int hw_bend = 1;
+	int hw_table_map = 1;
+	uint64_t start;
+	uint64_t init_ns;
+	uint64_t upload_ns;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "sbmv:n:")) != -1) {
+		switch (opt) {
+		case 's':
+			hw_envelope = 0;
+			break;
+		case 'b':
+			hw_bend = 0;
+			break;
+		case 'm':
+			hw_table_map = 0;
+			break;
+		case 'v':
+			num_voices = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s] [-b] [-m] [-v voices] "
+				"[-n iterations]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (num_voices < 1 || num_voices > MAX_NUM_VOICES || !iterations) {
+		fprintf(stderr, "invalid voice count or iterations\n");
+		return 1;
+	}
+
+	host_regs_init(num_voices, hw_envelope, hw_bend, hw_table_map);
+	midi_init();
+	start = host_time_ns();
+	sublime_init(&sublime_synth, host_regs);
+	init_ns = host_time_ns() - start;
+
+	/* Upload the built in wavetables */
+	start = host_time_ns();
+	for (i = 0; i < WAVEFORM_SINE*(sublime_synth.wavetable_len/
+				       WAVETABLE_CHUNK + 1); i++)
+		loop();
+	upload_ns = host_time_ns() - start;
+
+	printf("%d voices, %s envelopes, %s pitch bend, %s, %u iterations\n",
+	       num_voices, hw_envelope ? "hardware" : "firmware",
+	       hw_bend ? "hardware" : "firmware",
+	       hw_table_map ? "wavetable map" : "no wavetable map", iterations);
+	printf("boot: sublime_init %.1f us, wavetable upload %.1f us\n",
+	       init_ns/1e3, upload_ns/1e3);
+	printf("%-24s %10s %12s %12s\n", "benchmark", "ns/op", "writes/op",
+	       "reads/op");
+	for (i = 0; i < sizeof(benches)/sizeof(benches[0]); i++)
+		run_bench(&benches[i], iterations);
+
+	run_upload();
+	run_stream();
+
+	return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * Host stand-ins for the hardware the synth firmware talks to: a register
+ * file in place of the sublime core, a virtual tick timer and the
+ * interrupt controller.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <spr-defs.h>
+#include <or1k-support.h>
+#include <config.h>
+#include <timer.h>
+#include <host.h>
+
+#define HOST_MAX_TIMERS		8
+#define HOST_TICKS_PER_US	((uint32_t)(BOARD_CLK_FREQ/1e6))
+
+struct timer {
+	int mode;
+	int running;
+	uint64_t period;
+	uint64_t deadline;
+	void (*isr_cb)(void *private_data);
+	void *private_data;
+};
+
+uint32_t host_regs[HOST_REGS_SIZE/4];
+uint64_t host_mmio_writes;
+uint64_t host_mmio_reads;
+
+static unsigned long host_sr;
+static unsigned long host_picmr;
+
+static struct timer host_timers[HOST_MAX_TIMERS];
+static int host_num_timers;
+static uint64_t host_ticks;
+
+/*
+ * The configuration register reflects the requested setup, the wavetable
+ * bank with mipmaps, the output stage, the voice filters and the pitch
+ * conversion are present.
+ */
+void host_regs_init(int num_voices, int hw_envelope, int hw_bend,
+		    int hw_table_map)
+{
+	memset(host_regs, 0, sizeof(host_regs));
+	host_regs[SUBLIME_CONFIG/4] =
+		(__builtin_ctz(HOST_WAVETABLE_COUNT) << 17) |
+		SUBLIME_CONFIG_MIPMAP | SUBLIME_CONFIG_OUTPUT |
+		SUBLIME_CONFIG_FILTER | SUBLIME_CONFIG_PITCH |
+		(hw_envelope ? SUBLIME_CONFIG_ENVELOPE : 0) |
+		(hw_bend ? SUBLIME_CONFIG_BEND : 0) |
+		(hw_table_map ? SUBLIME_CONFIG_TABLE_MAP : 0) |
+		(__builtin_ctz(WAVETABLE_SIZE) << 7) | num_voices;
+	host_regs[SAMPLE_PERIOD/4] = SUBLIME_VOICE_CYCLES*num_voices;
+}
+
+void host_io_write32(void *addr, uint32_t value)
+{
+	uint32_t *reg = addr;
+
+	host_mmio_writes++;
+	if (reg == &host_regs[SUBLIME_CONFIG/4])
+		return;
+
+	*((volatile uint32_t *)reg) = value;
+}
+
+uint32_t host_io_read32(void *addr)
+{
+	host_mmio_reads++;
+
+	return *((volatile uint32_t *)addr);
+}
+
+unsigned long or1k_mfspr(unsigned long spr)
+{
+	switch (spr) {
+	case SPR_SR:
+		return host_sr;
+	case SPR_PICMR:
+		return host_picmr;
+	}
+
+	return 0;
+}
+
+void or1k_mtspr(unsigned long spr, unsigned long value)
+{
+	switch (spr) {
+	case SPR_SR:
+		host_sr = value;
+		break;
+	case SPR_PICMR:
+		host_picmr = value;
+		break;
+	}
+}
+
+void or1k_interrupt_handler_add(int irq, void (*fn)(void *))
+{
+}
+
+void mmiomidi_init(void)
+{
+}
+
+struct timer *timer_alloc(void (*isr_cb)(void *private_data),
+			  void *private_data)
+{
+	struct timer *timer;
+
+	if (host_num_timers >= HOST_MAX_TIMERS)
+		return NULL;
+
+	timer = &host_timers[host_num_timers++];
+	timer->running = 0;
+	timer->isr_cb = isr_cb;
+	timer->private_data = private_data;
+
+	return timer;
+}
+
+void timer_start(struct timer *timer, int mode, uint32_t time_us)
+{
+	timer->mode = mode;
+	timer->period = (uint64_t)time_us*HOST_TICKS_PER_US;
+	timer->deadline = host_ticks + timer->period;
+	timer->running = 1;
+}
+
+uint64_t timer_get_ticks(void)
+{
+	return host_ticks;
+}
+
+uint64_t timer_ticks_to_us(uint64_t ticks)
+{
+	return ticks/HOST_TICKS_PER_US;
+}
+
+void timer_init(void)
+{
+}
+
+/*
+ * Advance the virtual time, the timers that expire on the way are run
+ * in deadline order, as the tick timer interrupt would have.
+ */
+void host_timer_advance(uint32_t time_us)
+{
+	uint64_t end = host_ticks + (uint64_t)time_us*HOST_TICKS_PER_US;
+	struct timer *next;
+	int i;
+
+	for (;;) {
+		next = NULL;
+		for (i = 0; i < host_num_timers; i++) {
+			if (host_timers[i].running &&
+			    host_timers[i].deadline <= end &&
+			    (!next || host_timers[i].deadline < next->deadline))
+				next = &host_timers[i];
+		}
+
+		if (!next)
+			break;
+
+		host_ticks = next->deadline;
+		if (next->mode == TMR_CONTINOUS)
+			next->deadline += next->period;
+		else
+			next->running = 0;
+		next->isr_cb(next->private_data);
+	}
+
+	host_ticks = end;
+}
+
+uint64_t host_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
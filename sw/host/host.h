@@ -0,0 +1,19 @@
+#ifndef _HOST_H_
+#define _HOST_H_
+#include <stdint.h>
+#include <sublime.h>
+
+#define HOST_WAVETABLE_COUNT	8
+
+/* Covers the sublime registers and the mipmapped wavetables */
+#define HOST_REGS_SIZE	(WAVETABLES + HOST_WAVETABLE_COUNT*2*WAVETABLE_SIZE*4)
+
+extern uint32_t host_regs[HOST_REGS_SIZE/4];
+extern uint64_t host_mmio_writes;
+extern uint64_t host_mmio_reads;
+
+extern void host_regs_init(int num_voices, int hw_envelope, int hw_bend,
+			   int hw_table_map);
+extern void host_timer_advance(uint32_t time_us);
+extern uint64_t host_time_ns(void);
+#endif
@@ -0,0 +1,392 @@
+/*
+ * Runs the OpenCores I2C and the SSM2603 drivers on the host against a
+ * model of the I2C core with an SSM2603 on the bus, built with
+ * 'make i2c_test'.
+ *
+ * Every command completes at once and raises the interrupt flag. The
+ * interrupt is never taken, the transactions are moved on by polling in
+ * i2c_flush(), which runs the same state machine, or by the watchdog in
+ * i2c_task() as on a board with the wrong interrupt line. The model checks
+ * the command sequence on the bus, and can NACK an address, lose the
+ * arbitration or hang on the next command.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <config.h>
+#include <i2c.h>
+#include <codec.h>
+#include <host.h>
+
+#define MOCK_DEVICE_ADDR	0x1a
+#define MOCK_NUM_REGS		0x13
+#define MOCK_LOG_SIZE		64
+
+#define MOCK_CTR		0x2
+#define MOCK_TXR		0x3
+#define MOCK_CR			0x4
+
+#define MOCK_CTR_EN		(1<<7)
+
+#define MOCK_CR_STA		(1<<7)
+#define MOCK_CR_STO		(1<<6)
+#define MOCK_CR_RD		(1<<5)
+#define MOCK_CR_WR		(1<<4)
+#define MOCK_CR_ACK		(1<<3)
+#define MOCK_CR_IACK		(1<<0)
+
+#define MOCK_SR_RXACK		(1<<7)
+#define MOCK_SR_BUSY		(1<<6)
+#define MOCK_SR_AL		(1<<5)
+#define MOCK_SR_IF		(1<<0)
+
+/* Codec registers after reset, as far as the driver cares */
+static const uint16_t mock_reset_regs[MOCK_NUM_REGS] = {
+	[0x04] = 0x00a,
+	[0x05] = 0x008,
+	[0x06] = 0x09f,
+	[0x07] = 0x00a,
+};
+
+static uint8_t mock_ctr;
+static uint8_t mock_txr;
+static uint8_t mock_rxr;
+static uint8_t mock_sr;
+
+/* Bus state of the transaction in progress */
+static int mock_expect_addr;
+static int mock_addressed;
+static int mock_reading;
+static int mock_byte;
+static uint8_t mock_pointer;
+static uint8_t mock_first;
+
+static uint16_t mock_regs[MOCK_NUM_REGS];
+
+/* The register writes in the order they reached the codec */
+static uint16_t mock_log[MOCK_LOG_SIZE];
+static int mock_log_len;
+
+/* Faults to inject on the next address byte and the next command */
+static int mock_nack;
+static int mock_lose;
+static int mock_hang;
+
+static uint32_t mock_stops;
+static uint32_t mock_reg_writes;
+static uint32_t mock_violations;
+
+static int xfer_done;
+static int xfer_err;
+static int errors;
+
+extern void ssm2603_write_reg(uint8_t address, uint16_t data);
+
+static void mock_violation(const char *what)
+{
+	printf("bus: %s\n", what);
+	mock_violations++;
+}
+
+static void mock_reset(void)
+{
+	int i;
+
+	for (i = 0; i < MOCK_NUM_REGS; i++)
+		mock_regs[i] = mock_reset_regs[i];
+}
+
+static void mock_write_byte(void)
+{
+	int ack = 1;
+
+	if (mock_expect_addr) {
+		mock_expect_addr = 0;
+		mock_reading = mock_txr & 1;
+		mock_byte = 0;
+		ack = (mock_txr >> 1) == MOCK_DEVICE_ADDR && !mock_nack;
+		mock_addressed = ack;
+		mock_nack = 0;
+	} else if (!mock_addressed || mock_reading) {
+		mock_violation("data write without a write address");
+		ack = 0;
+	} else if (mock_byte == 0) {
+		mock_first = mock_txr;
+		mock_pointer = mock_txr >> 1;
+		mock_byte++;
+	} else if (mock_byte == 1) {
+		if (mock_pointer == 0x0f)
+			mock_reset();
+		else if (mock_pointer < MOCK_NUM_REGS)
+			mock_regs[mock_pointer] = (mock_first & 1) << 8 |
+						  mock_txr;
+		if (mock_log_len < MOCK_LOG_SIZE)
+			mock_log[mock_log_len++] = mock_pointer << 9 |
+				(mock_first & 1) << 8 | mock_txr;
+		mock_reg_writes++;
+		mock_byte++;
+	} else {
+		mock_violation("more than two bytes written");
+	}
+
+	if (ack)
+		mock_sr &= ~MOCK_SR_RXACK;
+	else
+		mock_sr |= MOCK_SR_RXACK;
+}
+
+/* The codec sends the low byte of the register first */
+static void mock_read_byte(uint8_t cmd)
+{
+	uint16_t reg = mock_pointer < MOCK_NUM_REGS ? mock_regs[mock_pointer] :
+		       0;
+
+	if (!mock_addressed || !mock_reading)
+		mock_violation("read without a read address");
+	if (!(cmd & MOCK_CR_STO) != !(cmd & MOCK_CR_ACK))
+		mock_violation("last read byte not NACKed with a stop");
+
+	mock_rxr = mock_byte++ ? reg >> 8 : reg & 0xff;
+}
+
+static void mock_command(uint8_t cmd)
+{
+	if (cmd & MOCK_CR_IACK)
+		mock_sr &= ~MOCK_SR_IF;
+	if (cmd & MOCK_CR_STA)
+		mock_sr &= ~MOCK_SR_AL;
+
+	cmd &= MOCK_CR_STA | MOCK_CR_STO | MOCK_CR_RD | MOCK_CR_WR |
+	       MOCK_CR_ACK;
+	if (!cmd || !(mock_ctr & MOCK_CTR_EN))
+		return;
+
+	if (mock_hang) {
+		mock_hang = 0;
+		return;
+	}
+
+	if (mock_lose) {
+		mock_lose = 0;
+		mock_sr = (mock_sr | MOCK_SR_AL | MOCK_SR_IF) & ~MOCK_SR_BUSY;
+		mock_addressed = 0;
+		return;
+	}
+
+	if (cmd & MOCK_CR_STA) {
+		if (!(cmd & MOCK_CR_WR))
+			mock_violation("start without an address");
+		mock_sr |= MOCK_SR_BUSY;
+		mock_expect_addr = 1;
+		mock_addressed = 0;
+	} else if (!(mock_sr & MOCK_SR_BUSY)) {
+		mock_violation("command without a start");
+	}
+
+	if (cmd & MOCK_CR_WR)
+		mock_write_byte();
+	if (cmd & MOCK_CR_RD)
+		mock_read_byte(cmd);
+
+	if (cmd & MOCK_CR_STO) {
+		mock_sr &= ~MOCK_SR_BUSY;
+		mock_addressed = 0;
+		mock_stops++;
+	}
+
+	mock_sr |= MOCK_SR_IF;
+}
+
+void host_io_write8(void *addr, uint8_t value)
+{
+	switch ((uintptr_t)addr - BOARD_I2C_BASE) {
+	case MOCK_CTR:
+		mock_ctr = value;
+		break;
+	case MOCK_TXR:
+		mock_txr = value;
+		break;
+	case MOCK_CR:
+		mock_command(value);
+		break;
+	}
+}
+
+uint8_t host_io_read8(void *addr)
+{
+	switch ((uintptr_t)addr - BOARD_I2C_BASE) {
+	case MOCK_CTR:
+		return mock_ctr;
+	case MOCK_TXR:
+		return mock_rxr;
+	case MOCK_CR:
+		return mock_sr;
+	}
+
+	return 0;
+}
+
+static void check(int ok, const char *what)
+{
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		errors++;
+	}
+}
+
+static void done(void *private_data, int err)
+{
+	xfer_done++;
+	xfer_err = err;
+}
+
+/* Queue up the write of a byte to the codec */
+static int submit_xfer(uint8_t address)
+{
+	struct i2c_xfer xfer = {
+		.address = address,
+		.write_len = 2,
+		.write_buf = { 0x0a << 1, 0x55 },
+		.done = done,
+	};
+
+	xfer_done = 0;
+	xfer_err = 1;
+
+	return i2c_submit(&xfer);
+}
+
+/* Write a byte to the codec and flush, returns the error of the write */
+static int write_xfer(uint8_t address)
+{
+	if (submit_xfer(address))
+		return 1;
+	i2c_flush();
+
+	return xfer_done == 1 ? xfer_err : 1;
+}
+
+/*
+ * Run the main loop for time_ms without flushing, returns the error of the
+ * queued write or 1 if it hasn't finished
+ */
+static int run_tasks(int time_ms)
+{
+	int ms;
+
+	for (ms = 0; ms < time_ms && !xfer_done; ms++) {
+		host_timer_advance(1000);
+		i2c_task();
+	}
+
+	return xfer_done == 1 ? xfer_err : 1;
+}
+
+static void check_log(const uint16_t *expected, int len, const char *what)
+{
+	int ok = mock_log_len == len;
+	int i;
+
+	for (i = 0; ok && i < len; i++)
+		ok = mock_log[i] == expected[i];
+	check(ok, what);
+}
+
+int main(void)
+{
+	uint32_t stops;
+
+	mock_reset();
+	i2c_init();
+
+	/* The init sequence, with its reads of the registers it changes */
+	codec_init();
+	check(mock_regs[0x04] == 0x01a, "analog path has DACSEL");
+	check(mock_regs[0x05] == 0x000, "DAC unmuted");
+	check(mock_regs[0x07] == 0x00e, "32 bit I2S slave");
+	check(mock_regs[0x08] == 0x01c, "sampling rate");
+	check(mock_regs[0x09] == 0x001, "codec active");
+	check(mock_regs[0x06] == 0x000, "codec powered up");
+
+	/* Runtime updates, a register changed twice is written once more */
+	mock_reg_writes = 0;
+	codec_set_volume(0x70);
+	codec_set_mute(1);
+	codec_set_volume(0x71);
+	i2c_flush();
+	check(mock_regs[0x02] == 0x171, "volume");
+	check(mock_regs[0x05] == 0x008, "DAC muted");
+	check(mock_reg_writes == 3, "coalesced volume writes");
+
+	/* A NACKed address is stopped and reported once the stop is done */
+	stops = mock_stops;
+	mock_nack = 1;
+	check(write_xfer(MOCK_DEVICE_ADDR) == -2, "NACK reported");
+	check(mock_stops == stops + 1, "stop sent after a NACK");
+	check(!(mock_sr & MOCK_SR_BUSY), "bus released after a NACK");
+	check(write_xfer(MOCK_DEVICE_ADDR) == 0, "write after a NACK");
+
+	/* No stop on lost arbitration, the bus isn't ours */
+	stops = mock_stops;
+	mock_lose = 1;
+	check(write_xfer(MOCK_DEVICE_ADDR) == -1, "lost arbitration reported");
+	check(mock_stops == stops, "no stop after lost arbitration");
+	check(write_xfer(MOCK_DEVICE_ADDR) == 0,
+	      "write after lost arbitration");
+
+	/* No interrupt, the task steps in after the timeout and then polls */
+	submit_xfer(MOCK_DEVICE_ADDR);
+	check(run_tasks(5) == 1, "no progress before the timeout");
+	check(run_tasks(50) == 0, "write finished by the task");
+	submit_xfer(MOCK_DEVICE_ADDR);
+	check(run_tasks(5) == 0, "write polled by the task");
+
+	/* A core that never finishes a step fails the transaction */
+	mock_hang = 1;
+	submit_xfer(MOCK_DEVICE_ADDR);
+	check(run_tasks(5) == 1, "hung core waited for");
+	check(run_tasks(50) == -3, "hung core reported");
+	submit_xfer(MOCK_DEVICE_ADDR);
+	check(run_tasks(5) == 0, "write after a hung core");
+
+	/*
+	 * The power sequencing registers are written in order, every time,
+	 * the others once, with their last value
+	 */
+	{
+		static const uint16_t expected[] = {
+			0x06 << 9 | 0x010,
+			0x09 << 9 | 0x000,
+			0x02 << 9 | 0x172,
+			0x06 << 9 | 0x000,
+			0x09 << 9 | 0x001,
+			0x06 << 9 | 0x002,
+		};
+
+		mock_log_len = 0;
+		ssm2603_write_reg(0x06, 0x010);
+		ssm2603_write_reg(0x09, 0x000);
+		codec_set_volume(0x70);
+		ssm2603_write_reg(0x06, 0x000);
+		codec_set_volume(0x72);
+		ssm2603_write_reg(0x09, 0x001);
+		ssm2603_write_reg(0x06, 0x002);
+		i2c_flush();
+		check_log(expected, sizeof(expected)/sizeof(expected[0]),
+			  "write order");
+	}
+
+	/* A failed codec write is counted and reported by the tasks */
+	mock_nack = 1;
+	codec_set_volume(0x10);
+	i2c_flush();
+	i2c_task();
+	codec_task();
+
+	check(!mock_violations, "bus protocol");
+	if (errors)
+		printf("FAIL: %d errors\n", errors);
+	else
+		printf("PASS\n");
+
+	return !!errors;
+}
@@ -0,0 +1,30 @@
+#ifndef _IO_H_
+#define _IO_H_
+#include <stdint.h>
+/* Host version of the register accessors, every access is counted */
+extern void host_io_write32(void *addr, uint32_t value);
+extern uint32_t host_io_read32(void *addr);
+/* The byte accessors are only provided by the I2C mock */
+extern void host_io_write8(void *addr, uint8_t value);
+extern uint8_t host_io_read8(void *addr);
+
+static inline void io_write32(void *addr, uint32_t value)
+{
+	host_io_write32(addr, value);
+}
+
+static inline uint32_t io_read32(void *addr)
+{
+	return host_io_read32(addr);
+}
+
+static inline void io_write8(void *addr, uint8_t value)
+{
+	host_io_write8(addr, value);
+}
+
+static inline uint8_t io_read8(void *addr)
+{
+	return host_io_read8(addr);
+}
+#endif
@@ -0,0 +1,10 @@
+#ifndef _HOST_OR1K_SUPPORT_H_
+#define _HOST_OR1K_SUPPORT_H_
+/*
+ * Stand-ins for the newlib or1k support functions, the special purpose
+ * registers are plain variables and interrupts are never taken.
+ */
+extern unsigned long or1k_mfspr(unsigned long spr);
+extern void or1k_mtspr(unsigned long spr, unsigned long value);
+extern void or1k_interrupt_handler_add(int irq, void (*fn)(void *));
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Checks that changing the number of parts over SysEx doesn't leave notes
+ * hanging, built for the host with 'make parts_test'. Notes are held on
+ * some channels, the parts are changed and the note offs are sent on the
+ * same channels, after which no voice may still be gated.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <midi.h>
+#include <sublime.h>
+#include <host.h>
+
+#define NUM_VOICES	32
+#define LOOP_TIME_US	1000
+
+static struct sublime sublime_synth;
+static int errors;
+
+static void send(uint8_t status, uint8_t data1, uint8_t data2)
+{
+	midi_receive_byte(status);
+	midi_receive_byte(data1);
+	midi_receive_byte(data2);
+}
+
+static void loop(void)
+{
+	host_timer_advance(LOOP_TIME_US);
+	midi_task();
+	sublime_task(&sublime_synth);
+}
+
+static void set_parts(uint8_t num_parts)
+{
+	midi_receive_byte(SYSEX_MSG);
+	midi_receive_byte(SYSEX_ID);
+	midi_receive_byte(SYSEX_PARTS);
+	midi_receive_byte(num_parts);
+	midi_receive_byte(-(SYSEX_PARTS + num_parts) & 0x7f);
+	midi_receive_byte(SYSEX_END);
+	loop();
+
+	if (sublime_synth.num_parts != num_parts) {
+		printf("FAIL: %d parts, expected %d\n", sublime_synth.num_parts,
+		       num_parts);
+		errors++;
+	}
+}
+
+static uint8_t chan_key(uint8_t chan)
+{
+	return 60 + chan;
+}
+
+static void note_on(uint8_t chan)
+{
+	send(NOTE_ON | chan, chan_key(chan), 100);
+	loop();
+}
+
+static void note_off(uint8_t chan)
+{
+	send(NOTE_OFF | chan, chan_key(chan), 0);
+	loop();
+}
+
+static int gated_voices(void)
+{
+	int gated = 0;
+	int i;
+
+	for (i = 0; i < sublime_synth.num_voices; i++)
+		gated += sublime_synth.voices[i].gate;
+
+	return gated;
+}
+
+static void check_gated(const char *what, int expected)
+{
+	int gated = gated_voices();
+
+	if (gated != expected) {
+		printf("FAIL: %s: %d voices gated, expected %d\n", what, gated,
+		       expected);
+		errors++;
+	}
+}
+
+int main(void)
+{
+	uint8_t chan;
+
+	host_regs_init(NUM_VOICES, 1, 1, 1);
+	midi_init();
+	sublime_init(&sublime_synth, host_regs);
+
+	/* One part playing all channels, split up into one part per channel */
+	for (chan = 0; chan < 4; chan++)
+		note_on(chan);
+	check_gated("1 part", 4);
+	set_parts(MIDI_NUM_CHANNELS);
+	for (chan = 0; chan < 4; chan++)
+		note_off(chan);
+	check_gated("1 to 16 parts", 0);
+
+	/* Parts 2 and 5, only part 5 loses its channel */
+	note_on(2);
+	note_on(5);
+	set_parts(4);
+	check_gated("16 to 4 parts, held", 1);
+	note_off(2);
+	note_off(5);
+	check_gated("16 to 4 parts", 0);
+
+	/* Back to a single part, part 3 loses its channel to part 0 */
+	note_on(0);
+	note_on(3);
+	set_parts(1);
+	note_off(0);
+	note_off(3);
+	check_gated("4 to 1 part", 0);
+
+	if (errors)
+		printf("FAIL: %d errors\n", errors);
+	else
+		printf("PASS\n");
+
+	return !!errors;
+}
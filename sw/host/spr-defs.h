@@ -0,0 +1,9 @@
+#ifndef _HOST_SPR_DEFS_H_
+#define _HOST_SPR_DEFS_H_
+/* The subset of the or1k special purpose registers used by the host build */
+#define SPR_SR		17
+#define SPR_PICMR	((9 << 11) + 0)
+
+#define SPR_SR_TEE	0x00000002
+#define SPR_SR_IEE	0x00000004
+#endif
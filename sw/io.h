@@ -0,0 +1,27 @@
+#ifndef _IO_H_
+#define _IO_H_
+#include <stdint.h>
+/*
+ * Register accessors, the host build substitutes its own version of this
+ * file to count the accesses.
+ */
+static inline void io_write32(void *addr, uint32_t value)
+{
+	*((volatile uint32_t *)addr) = value;
+}
+
+static inline uint32_t io_read32(void *addr)
+{
+	return *((volatile uint32_t *)addr);
+}
+
+static inline void io_write8(void *addr, uint8_t value)
+{
+	*((volatile uint8_t *)addr) = value;
+}
+
+static inline uint8_t io_read8(void *addr)
+{
+	return *((volatile uint8_t *)addr);
+}
+#endif
@@ -20,6 +20,24 @@ static void irq_disable(void)
 	or1k_mtspr(SPR_SR, or1k_mfspr(SPR_SR) & ~SPR_SR_IEE);
 }
 
+/*
+ * Disable both external and tick timer interrupts,
+ * returns the previous state to be passed to irq_restore().
+ */
+static unsigned long irq_save(void)
+{
+	unsigned long sr = or1k_mfspr(SPR_SR);
+
+	or1k_mtspr(SPR_SR, sr & ~(SPR_SR_IEE | SPR_SR_TEE));
+
+	return sr;
+}
+
+static void irq_restore(unsigned long sr)
+{
+	or1k_mtspr(SPR_SR, sr);
+}
+
 static unsigned long irq_get_mask(void)
 {
 	return or1k_mfspr(SPR_PICMR);
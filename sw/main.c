@@ -12,6 +12,9 @@ static struct sublime sublime_synth;
 
 static void init(void)
 {
+	uint64_t boot_start;
+	uint64_t start;
+
 	irq_init();
 
 #ifdef I2C_DRIVER
@@ -28,14 +31,20 @@ static void init(void)
 	printf("Initializing tick timer..");
 	timer_init();
 	printf("done\r\n");
+	boot_start = timer_get_ticks();
 
 	printf("Initializing MIDI..");
 	midi_init();
 	printf("done\r\n");
 
 	printf("Initializing sublime..");
+	start = timer_get_ticks();
 	sublime_init(&sublime_synth, (void *)BOARD_SUBLIME_BASE);
-	printf("done\r\n");
+	printf("done (%lu us)\r\n",
+	       (unsigned long)timer_ticks_to_us(timer_get_ticks() - start));
+
+	printf("Boot took %lu us from timer init\r\n",
+	       (unsigned long)timer_ticks_to_us(timer_get_ticks() - boot_start));
 
 	irq_enable();
 }
@@ -45,6 +54,13 @@ int main(void)
 	init();
 
 	for(;;) {
+		midi_task();
 		sublime_task(&sublime_synth);
+#ifdef I2C_DRIVER
+		i2c_task();
+#endif
+#ifdef CODEC_DRIVER
+		codec_task();
+#endif
 	}
 }
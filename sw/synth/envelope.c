@@ -1,13 +1,29 @@
 /*
- * Each envelope stage (except sustain) set up a timer that trigger an interrupt
- * when it is time to increase/decrease the output.
- * The increase/decrease steps are limited so that the time between interrupts
- * is always greater or equal to 1 ms (1 kHz).
+ * All envelopes are stepped together from a single timer running at a fixed
+ * control rate.
+ * The envelope state is kept in arrays indexed by the envelope slot, and
+ * only the envelopes that are in their attack, decay or release stage are
+ * visited by the timer isr.
+ * The levels are 8.24 fixed point values and the per tick increments are
+ * calculated when the envelope parameters change, so the stepping itself
+ * only consists of additions and comparisons.
  */
+#include <stdio.h>
 #include <stdint.h>
+#include <irq.h>
 #include <timer.h>
 #include <envelope.h>
 
+#define MAX_ENVELOPES		128
+
+/* Control rate, 1 kHz */
+#define ENVELOPE_TICK_US	1000
+
+#define LEVEL_SHIFT		24
+#define LEVEL_MAX		(0xffu << LEVEL_SHIFT)
+
+#define NOT_RUNNING		0xff
+
 enum {
 	ENVELOPE_IDLE,
 	ENVELOPE_ATTACK,
@@ -16,153 +32,221 @@ enum {
 	ENVELOPE_RELEASE,
 };
 
-/* Helper function to limit interrupt rate to 1kHz */
-static uint8_t get_step(uint32_t wait_us)
+static struct envelope *env_handle[MAX_ENVELOPES];
+static uint32_t env_level[MAX_ENVELOPES];
+static uint32_t env_sustain_level[MAX_ENVELOPES];
+static uint32_t env_attack_inc[MAX_ENVELOPES];
+static uint32_t env_decay_inc[MAX_ENVELOPES];
+static uint32_t env_release_inc[MAX_ENVELOPES];
+static uint8_t env_state[MAX_ENVELOPES];
+static uint8_t env_output[MAX_ENVELOPES];
+static int num_envelopes;
+
+/* The envelopes that are stepped by the timer isr */
+static uint8_t env_running[MAX_ENVELOPES];
+static uint8_t env_running_pos[MAX_ENVELOPES];
+static int num_running;
+
+static struct timer *envelope_timer;
+
+/* Per tick increment needed to cover range in time_us */
+static uint32_t get_inc(uint32_t range, uint32_t time_us)
 {
-	uint32_t step;
-
-	if (wait_us >= 1000)
-		return 1;
+	uint32_t ticks = time_us / ENVELOPE_TICK_US;
+	uint32_t inc;
 
-	if (wait_us == 0)
-		return 0xff;
+	if (ticks == 0)
+		return LEVEL_MAX;
 
-	step = 1000/wait_us;
+	inc = range / ticks;
 
-	return step > 0xff ? 0xff : step;
+	return inc ? inc : 1;
 }
 
-static int do_release(struct envelope *envelope)
+static void envelope_start_running(int idx)
 {
-	uint32_t wait_us;
-
-	if (envelope->output == 0)
-		return ENVELOPE_IDLE;
+	if (env_running_pos[idx] != NOT_RUNNING)
+		return;
 
-	/*
-	 * Scale the release time according to the output value when
-	 * release was initiated
-	 */
-	wait_us = envelope->release / envelope->release_output;
-
-	envelope->step = get_step(wait_us);
-	wait_us *= envelope->step;
-
-	if (envelope->step > envelope->output)
-		envelope->output = 0;
-	else
-		envelope->output -= envelope->step;
-
-	if (wait_us == 0)
-		return ENVELOPE_IDLE;
-
-	timer_start(envelope->timer, TMR_ONESHOT, wait_us);
-
-	return ENVELOPE_RELEASE;
+	env_running_pos[idx] = num_running;
+	env_running[num_running++] = idx;
 }
 
-static int do_decay(struct envelope *envelope)
+static void envelope_stop_running(int idx)
 {
-	uint32_t wait_us;
-
-	envelope->release_output = envelope->output;
-	if (!envelope->gate)
-		return do_release(envelope);
+	int pos = env_running_pos[idx];
+	int last = env_running[--num_running];
 
-	if (envelope->output == envelope->sustain)
-		return ENVELOPE_SUSTAIN;
-
-	wait_us = envelope->decay / (0xff - envelope->sustain);
-	envelope->step = get_step(wait_us);
-	wait_us *= envelope->step;
-
-	if (envelope->step > (envelope->output - envelope->sustain))
-		envelope->output = envelope->sustain;
-	else
-		envelope->output -= envelope->step;
-
-	if (wait_us == 0)
-		return ENVELOPE_SUSTAIN;
-
-	timer_start(envelope->timer, TMR_ONESHOT, wait_us);
-
-	return ENVELOPE_DECAY;
+	env_running[pos] = last;
+	env_running_pos[last] = pos;
+	env_running_pos[idx] = NOT_RUNNING;
 }
 
-static int do_attack(struct envelope *envelope)
+static void envelope_update(struct envelope *envelope)
 {
-	uint32_t wait_us;
-
-	envelope->release_output = envelope->output;
-	if (!envelope->gate)
-		return do_release(envelope);
+	if (envelope->update_cb)
+		envelope->update_cb(envelope->private_data);
+}
 
-	/* Attack phase done */
-	if (envelope->output == 0xff)
-		return do_decay(envelope);
+static void envelope_tick(void *private_data)
+{
+	int i = 0;
+	int idx;
+	int done;
+	uint32_t level;
+
+	while (i < num_running) {
+		idx = env_running[i];
+		level = env_level[idx];
+		done = 0;
+
+		switch (env_state[idx]) {
+		case ENVELOPE_ATTACK:
+			if (LEVEL_MAX - level > env_attack_inc[idx]) {
+				level += env_attack_inc[idx];
+			} else {
+				level = LEVEL_MAX;
+				env_state[idx] = ENVELOPE_DECAY;
+			}
+			break;
+
+		case ENVELOPE_DECAY:
+			if (level > env_sustain_level[idx] &&
+			    level - env_sustain_level[idx] > env_decay_inc[idx]) {
+				level -= env_decay_inc[idx];
+			} else {
+				level = env_sustain_level[idx];
+				env_state[idx] = ENVELOPE_SUSTAIN;
+				done = 1;
+			}
+			break;
+
+		case ENVELOPE_RELEASE:
+			if (level > env_release_inc[idx]) {
+				level -= env_release_inc[idx];
+			} else {
+				level = 0;
+				env_state[idx] = ENVELOPE_IDLE;
+				done = 1;
+			}
+			break;
+
+		default:
+			done = 1;
+			break;
+		}
+
+		env_level[idx] = level;
+
+		/* The last entry takes the place of the stopped one */
+		if (done)
+			envelope_stop_running(idx);
+		else
+			i++;
+
+		if (done || env_output[idx] != level >> LEVEL_SHIFT) {
+			env_output[idx] = level >> LEVEL_SHIFT;
+			envelope_update(env_handle[idx]);
+		}
+	}
+}
 
-	wait_us = envelope->attack/256;
-	envelope->step = get_step(wait_us);
-	wait_us *= envelope->step;
+int envelope_isactive(struct envelope *envelope)
+{
+	return env_state[envelope->idx] != ENVELOPE_IDLE;
+}
 
-	if (envelope->step > (0xff - envelope->output))
-		envelope->output = 0xff;
-	else
-		envelope->output += envelope->step;
+uint8_t envelope_get_output(struct envelope *envelope)
+{
+	return env_output[envelope->idx];
+}
 
-	if (wait_us == 0)
-		return do_decay(envelope);
+/*
+ * The gate functions are called outside of interrupt context, so the
+ * timer isr is kept out while the envelope state is changed.
+ */
+void envelope_gate_on(struct envelope *envelope)
+{
+	unsigned long flags = irq_save();
 
-	timer_start(envelope->timer, TMR_ONESHOT, wait_us);
+	envelope->gate = 1;
+	env_state[envelope->idx] = ENVELOPE_ATTACK;
+	envelope_start_running(envelope->idx);
+	envelope_update(envelope);
 
-	return ENVELOPE_ATTACK;
+	irq_restore(flags);
 }
 
-static void envelope_timer_isr(void *private_data)
+void envelope_gate_off(struct envelope *envelope)
 {
-	struct envelope *envelope = private_data;
+	unsigned long flags = irq_save();
 
-	switch (envelope->state) {
-	case ENVELOPE_ATTACK:
-		envelope->state = do_attack(envelope);
-		break;
-
-	case ENVELOPE_DECAY:
-		envelope->state = do_decay(envelope);
-		break;
+	envelope->gate = 0;
+	if (env_state[envelope->idx] != ENVELOPE_IDLE) {
+		env_state[envelope->idx] = ENVELOPE_RELEASE;
+		envelope_start_running(envelope->idx);
+	}
 
-	case ENVELOPE_RELEASE:
-		envelope->state = do_release(envelope);
-		break;
+	irq_restore(flags);
+}
 
-	default:
-	case ENVELOPE_SUSTAIN:
-	case ENVELOPE_IDLE:
-		break;
-	}
+void envelope_set_attack(struct envelope *envelope, uint32_t attack)
+{
+	envelope->attack = attack;
+	env_attack_inc[envelope->idx] = get_inc(LEVEL_MAX, attack);
 }
 
-int envelope_isactive(struct envelope *envelope)
+/* The decay time is the time it takes to decay from max to sustain level */
+void envelope_set_decay(struct envelope *envelope, uint32_t decay)
 {
-	return envelope->state != ENVELOPE_IDLE;
+	envelope->decay = decay;
+	env_decay_inc[envelope->idx] =
+		get_inc(LEVEL_MAX - env_sustain_level[envelope->idx], decay);
 }
 
-void envelope_gate_on(struct envelope *envelope)
+void envelope_set_sustain(struct envelope *envelope, uint8_t sustain)
 {
-	envelope->gate = 1;
-	envelope->state = do_attack(envelope);
+	envelope->sustain = sustain;
+	env_sustain_level[envelope->idx] = (uint32_t)sustain << LEVEL_SHIFT;
+	envelope_set_decay(envelope, envelope->decay);
 }
 
-void envelope_gate_off(struct envelope *envelope)
+/* The release time is the time it takes to release from max level */
+void envelope_set_release(struct envelope *envelope, uint32_t release)
 {
-	envelope->gate = 0;
-	/* Gate off will be handled in all the other cases by the timer isr */
-	if (envelope->state == ENVELOPE_SUSTAIN)
-		envelope->state	= do_release(envelope);
+	envelope->release = release;
+	env_release_inc[envelope->idx] = get_inc(LEVEL_MAX, release);
 }
 
-void envelope_init(struct envelope *envelope)
+void envelope_init(struct envelope *envelope,
+		   void (*update_cb)(void *private_data),
+		   void *private_data)
 {
+	int idx = num_envelopes;
+
+	if (idx >= MAX_ENVELOPES) {
+		printf("Error: Could not allocate envelope\r\n");
+		return;
+	}
+
+	envelope->idx = idx;
 	envelope->gate = 0;
-	envelope->timer = timer_alloc(envelope_timer_isr, envelope);
+	envelope->update_cb = update_cb;
+	envelope->private_data = private_data;
+
+	env_handle[idx] = envelope;
+	env_level[idx] = 0;
+	env_state[idx] = ENVELOPE_IDLE;
+	env_output[idx] = 0;
+	env_running_pos[idx] = NOT_RUNNING;
+	envelope_set_attack(envelope, 0);
+	envelope_set_sustain(envelope, 0xff);
+	envelope_set_release(envelope, 0);
+	num_envelopes++;
+
+	/* All envelopes share the same control rate timer */
+	if (!envelope_timer) {
+		envelope_timer = timer_alloc(envelope_tick, 0);
+		timer_start(envelope_timer, TMR_CONTINOUS, ENVELOPE_TICK_US);
+	}
 }
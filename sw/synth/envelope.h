@@ -3,23 +3,31 @@
 
 /*
  * attack, decay and release values are expressed in micro seconds.
+ * The envelope state itself is kept by the envelope engine, the idx
+ * field is the envelope's slot in it.
  */
 struct envelope {
+	int idx;
 	int gate;
-	int state;
 	uint32_t attack;
 	uint32_t decay;
 	uint8_t sustain;
 	uint32_t release;
-	uint8_t release_output;
-	uint8_t output;
-	uint8_t step;
-	struct timer *timer;
+	/* Called every time the envelope has stepped */
+	void (*update_cb)(void *private_data);
+	void *private_data;
 };
 
 extern int envelope_isactive(struct envelope *envelope);
+extern uint8_t envelope_get_output(struct envelope *envelope);
 extern void envelope_gate_on(struct envelope *envelope);
 extern void envelope_gate_off(struct envelope *envelope);
-extern void envelope_init(struct envelope *envelope);
+extern void envelope_set_attack(struct envelope *envelope, uint32_t attack);
+extern void envelope_set_decay(struct envelope *envelope, uint32_t decay);
+extern void envelope_set_sustain(struct envelope *envelope, uint8_t sustain);
+extern void envelope_set_release(struct envelope *envelope, uint32_t release);
+extern void envelope_init(struct envelope *envelope,
+			  void (*update_cb)(void *private_data),
+			  void *private_data);
 
 #endif
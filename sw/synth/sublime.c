@@ -1,122 +1,143 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <limits.h>
-#include <math.h>
 #include <config.h>
+#include <io.h>
+#include <irq.h>
 #include <midi.h>
 #include <sublime.h>
+#include <tables.h>
 
-#define PI 3.14159265
+#if TABLES_WAVETABLE_SIZE != WAVETABLE_SIZE
+#error "tables.h is generated for a different WAVETABLE_SIZE"
+#endif
 
-static uint32_t note_table[129];
-static uint32_t cent_table[101];
+static const int32_t *const waveforms[] = {
+	[WAVEFORM_SAW] = wave_saw,
+	[WAVEFORM_SQUARE] = wave_square,
+	[WAVEFORM_TRIANGLE] = wave_triangle,
+	[WAVEFORM_SINE] = wave_sine,
+};
 
 void sublime_write_reg(struct sublime *sublime, uint32_t reg, uint32_t value)
 {
-	*((uint32_t *)(sublime->base + reg)) = value;
+	io_write32(sublime->base + reg, value);
 }
 
-uint32_t sublime_read_reg(struct sublime *sublime, uint32_t reg)
+/*
+ * Write len consecutive registers starting at reg. Each word is still a
+ * single bus write, this only saves recomputing the address and comparing
+ * the shadow for every register.
+ */
+void sublime_write_block(struct sublime *sublime, uint32_t reg,
+			 const uint32_t *data, int len)
 {
-	return *((uint32_t *)(sublime->base + reg));
+	void *dest = sublime->base + reg;
+
+	while (len--) {
+		io_write32(dest, *data++);
+		dest += 4;
+	}
 }
 
-/* Translate 0-127 to 1ms-16s (127-255 = 16s) */
-static uint32_t to_us(uint32_t value)
+uint32_t sublime_read_reg(struct sublime *sublime, uint32_t reg)
 {
-	if (value <= 10)
-		return 1000*(value);
-	else if (value <= 100)
-		return 10000*(value-10);
-	else if (value < 127)
-		return 100000*(value-100)*5;
-	else
-		return 16e6;
+	return io_read32(sublime->base + reg);
 }
 
-static void gen_triangle(int32_t *dest)
+/*
+ * Write a voice register through its shadow copy, the write is only issued
+ * when the value differs from what was last written.
+ */
+static void sublime_update_voice_reg(struct sublime *sublime, int voice,
+				     uint32_t reg, uint32_t *shadow,
+				     uint32_t value)
 {
-	int32_t i;
-
-	for (i = 0; i < WAVETABLE_SIZE/4; i++)
-		*dest++ = i*(INT_MAX/WAVETABLE_SIZE);
-
-	for (i = 0; i < WAVETABLE_SIZE/4; i++)
-		*dest++ = INT_MAX/4 - i*(INT_MAX/WAVETABLE_SIZE);
-
-	for (i = 0; i < WAVETABLE_SIZE/4; i++)
-		*dest++ = -i*(INT_MAX/WAVETABLE_SIZE);
+	if (*shadow == value)
+		return;
 
-	for (i = 0; i < WAVETABLE_SIZE/4; i++)
-		*dest++ = i*(INT_MAX/WAVETABLE_SIZE) - INT_MAX;
+	*shadow = value;
+	sublime_write_reg(sublime, VOICE_REG(voice, reg), value);
+	sublime->stats.writes_issued++;
 }
 
-static void gen_saw(int32_t *dest)
+/*
+ * Write the voice registers that differ from the shadow copy. The CPU does
+ * every store as a single bus write, so writing the whole voice block would
+ * only add the writes of the unchanged registers.
+ */
+static void sublime_commit_voice_regs(struct sublime *sublime, int voice,
+				      struct voice_regs *regs)
 {
-	int32_t i;
-
-	for (i = 0; i < WAVETABLE_SIZE; i++)
-		*dest++ = INT_MAX/4 - i*(INT_MAX/(WAVETABLE_SIZE*2));
+	uint32_t *shadow = (uint32_t *)&sublime->voices[voice].shadow;
+	uint32_t *value = (uint32_t *)regs;
+	int i;
 
+	for (i = 0; i < VOICE_REG_WORDS; i++)
+		sublime_update_voice_reg(sublime, voice, i*4, &shadow[i],
+					 value[i]);
 }
 
-static void gen_square(int32_t *dest)
+/* Dirty bits are set both from the main loop and from the timer isr */
+static void sublime_mark_dirty(uint32_t *dirty, int voice)
 {
-	int32_t i;
-
-	for (i = 0; i < WAVETABLE_SIZE/2; i++)
-		*dest++ = INT_MAX/4;
+	unsigned long flags = irq_save();
 
-	for (i = 0; i < WAVETABLE_SIZE/2; i++)
-		*dest++ = -(INT_MAX/4);
+	dirty[voice/32] |= 1u << (voice%32);
+	irq_restore(flags);
 }
 
-static void gen_sine(int32_t *dest)
+static void sublime_mark_all_dirty(uint32_t *dirty)
 {
-	int32_t i;
-	double wave;
+	int i;
 
-	for (i = 0; i < WAVETABLE_SIZE; i++) {
-		wave = sin((((double)i)*360/WAVETABLE_SIZE)*PI/180);
-		*dest++ = wave*(INT_MAX/4);
-	}
+	for (i = 0; i < VOICE_DIRTY_WORDS; i++)
+		dirty[i] = 0xffffffff;
 }
 
-static void gen_note_table(void)
+/* Translate 0-127 to 1ms-16s (127-255 = 16s) */
+static uint32_t to_us(uint32_t value)
 {
-	double notes[129];
-	int i;
+	if (value <= 10)
+		return 1000*(value);
+	else if (value <= 100)
+		return 10000*(value-10);
+	else if (value < 127)
+		return 100000*(value-100)*5;
+	else
+		return 16e6;
+}
 
-	notes[69] = 440; /* #A4 */
-	for (i = 70; i <= 80; i++)
-		notes[i] = notes[i-1] * pow(2, 1.0f/12);
+/*
+ * Translate a time in us to a rate for the hardware envelope, i.e. the
+ * increment needed to cover range in that time, encoded as exponent and
+ * mantissa (see sublime_envelope.v).
+ */
+static uint8_t to_envelope_rate(uint32_t range, uint32_t us)
+{
+	uint32_t steps = us*(uint32_t)(BOARD_CLK_FREQ/1e6)/ENVELOPE_CLK_DIV;
+	uint32_t inc;
+	int exp = 0;
 
-	for (i = 68; i >= 0; i--)
-		notes[i] = notes[i+12]/2;
+	if (steps == 0)
+		return 0xff;
 
-	for(i = 81; i <= 128; i++)
-		notes[i] = notes[i-12]*2;
+	inc = range/steps;
+	if (inc < 0x10)
+		return 0;
 
-	/*
-	 * The nco phase acc is 32-bit, so the formula for the value to
-	 * to write into the freq reg is:
-	 * 2^32/(BOARD_CLK_FREQ/note_freq)
-	 */
-	for (i = 0; i <= 128; i++)
-		note_table[i] = ((1ull<<32)*notes[i])/BOARD_CLK_FREQ + 0.5f;
-}
+	while ((inc >> exp) > 0x1f)
+		exp++;
 
-static void gen_cent_table(void)
-{
-	int i;
+	if (exp > 0xf)
+		return 0xff;
 
-	for (i = 0; i <= 100; i++)
-		cent_table[i] = (1<<16) / pow(2, (float)i/1200) + 0.5f;
+	return exp << 4 | ((inc >> exp) & 0xf);
 }
 
 int32_t sublime_read_left(struct sublime *sublime)
 {
-	return *((int32_t *)(sublime->base + LEFT_SAMPLE));
+	return io_read32(sublime->base + LEFT_SAMPLE);
 }
 
 /*
@@ -148,238 +169,1472 @@ uint32_t sublime_get_freq(int8_t note, int32_t cents)
 	return (uint32_t) freq_val;
 }
 
+/*
+ * Value for the oscillator frequency registers, with the pitch conversion
+ * in hardware the note and cents are written as is.
+ */
+static uint32_t sublime_osc_freq(struct sublime *sublime, int8_t note,
+				 int32_t cents)
+{
+	if (!sublime->hw_pitch)
+		return sublime_get_freq(note, cents);
+
+	if (note < 0) {
+		cents += note*100;
+		note = 0;
+	}
+	if (cents > INT16_MAX)
+		cents = INT16_MAX;
+	else if (cents < INT16_MIN)
+		cents = INT16_MIN;
+
+	return VOICE_FREQ_NOTE(note, cents);
+}
+
 void sublime_set_note(struct sublime *sublime, int voice, int osc,
 		      int8_t note, int32_t cents)
 {
-	uint32_t freq_val = sublime_get_freq(note, cents);
+	uint32_t freq_val = sublime_osc_freq(sublime, note, cents);
+	struct voice_regs *shadow = &sublime->voices[voice].shadow;
 
-	osc = (osc == 0) ? VOICE_OSC0_FREQ : VOICE_OSC1_FREQ;
-	sublime_write_reg(sublime, VOICE_REG(voice, osc), freq_val);
+	if (osc == 0)
+		sublime_update_voice_reg(sublime, voice, VOICE_OSC0_FREQ,
+					 &shadow->osc0_freq, freq_val);
+	else
+		sublime_update_voice_reg(sublime, voice, VOICE_OSC1_FREQ,
+					 &shadow->osc1_freq, freq_val);
 }
 
-void sublime_set_waveform(uint8_t waveform, int32_t *dest)
+/*
+ * Select the waveform of one of the oscillators, the waveforms all have a
+ * wavetable of their own, so only the voice wavetable registers have to be
+ * rewritten. User waveforms that have not been uploaded are ignored.
+ */
+static uint32_t sublime_patch_wavetables(struct patch *patch)
 {
-	switch (waveform) {
-	case 0:
-		break;
-	case 1:
-		gen_saw(dest);
-		break;
-	case 2:
-		gen_square(dest);
+	return VOICE_WAVETABLE_OSC0(patch->osc[0].wavetable) |
+	       VOICE_WAVETABLE_OSC1(patch->osc[1].wavetable);
+}
+
+/*
+ * Bring the voices over to the wavetables of a patch, with the wavetable map
+ * that is a write to the map entry, otherwise every voice is rewritten.
+ */
+static void sublime_update_wavetables(struct sublime *sublime,
+				      struct patch *patch)
+{
+	if (!sublime->hw_table_map) {
+		sublime_mark_all_dirty(sublime->dirty_ctrl);
+		return;
+	}
+
+	sublime_write_reg(sublime, WAVETABLE_MAP(patch->table_map),
+			  sublime_patch_wavetables(patch));
+	sublime->stats.writes_issued++;
+}
+
+void sublime_set_waveform(struct sublime *sublime, struct patch *patch,
+			  int osc, uint8_t waveform)
+{
+	uint8_t table;
+
+	if (waveform == WAVEFORM_NONE)
+		return;
+
+	if (waveform >= WAVEFORM_USER) {
+		if (waveform - WAVEFORM_USER >= MAX_USER_WAVEFORMS)
+			return;
+		table = sublime->user_wavetable[waveform - WAVEFORM_USER];
+	} else {
+		table = WAVEFORM_TABLE(waveform);
+	}
+
+	if (table >= sublime->num_wavetables)
+		return;
+
+	patch->osc[osc].wavetable = table;
+	sublime_update_wavetables(sublime, patch);
+}
+
+/*
+ * Upload WAVETABLE_CHUNK entries of the built in waveforms into their
+ * wavetables, until all of them are loaded.
+ */
+static void sublime_wavetable_task(struct sublime *sublime)
+{
+	int table = sublime->wavetables_loaded;
+	int32_t pos = sublime->wavetable_pos;
+	int32_t len;
+
+	if (table > WAVEFORM_TABLE(WAVEFORM_SINE) ||
+	    table >= sublime->num_wavetables)
+		return;
+
+	len = sublime->wavetable_len - pos;
+	if (len > WAVETABLE_CHUNK)
+		len = WAVETABLE_CHUNK;
+	sublime_write_block(sublime, WAVETABLES +
+			    table*sublime->wavetable_stride + pos*4,
+			    (const uint32_t *)&waveforms[table + 1][pos], len);
+	sublime->wavetable_pos += len;
+	if (sublime->wavetable_pos < sublime->wavetable_len)
+		return;
+
+	sublime->wavetable_pos = 0;
+	sublime->wavetables_loaded++;
+}
+
+/*
+ * Append a voice to the end (newest) of the allocated voices list and
+ * account it to its part.
+ */
+static void sublime_link_voice(struct sublime *sublime, int idx)
+{
+	struct voice *voice = &sublime->voices[idx];
+	struct part *part = voice->part;
+
+	if (part->num_voices < part->reserved_voices)
+		sublime->reserved_free--;
+	part->num_voices++;
+
+	voice->prev = sublime->newest_voice;
+	voice->next = VOICE_NONE;
+
+	if (sublime->newest_voice == VOICE_NONE)
+		sublime->oldest_voice = idx;
+	else
+		sublime->voices[sublime->newest_voice].next = idx;
+	sublime->newest_voice = idx;
+}
+
+static void sublime_unlink_voice(struct sublime *sublime, int idx)
+{
+	struct voice *voice = &sublime->voices[idx];
+	struct part *part = voice->part;
+
+	part->num_voices--;
+	if (part->num_voices < part->reserved_voices)
+		sublime->reserved_free++;
+
+	if (voice->prev == VOICE_NONE)
+		sublime->oldest_voice = voice->next;
+	else
+		sublime->voices[voice->prev].next = voice->next;
+
+	if (voice->next == VOICE_NONE)
+		sublime->newest_voice = voice->prev;
+	else
+		sublime->voices[voice->next].prev = voice->prev;
+}
+
+/*
+ * Remove a voice from the allocated list and the key map,
+ * the caller is responsible for putting it to new use.
+ */
+static void sublime_detach_voice(struct sublime *sublime, int idx)
+{
+	struct voice *voice = &sublime->voices[idx];
+
+	sublime_unlink_voice(sublime, idx);
+	if (voice->part->key_voice[voice->note] == idx)
+		voice->part->key_voice[voice->note] = VOICE_NONE;
+}
+
+static void sublime_free_voice(struct sublime *sublime, int idx)
+{
+	sublime_detach_voice(sublime, idx);
+	sublime->voices[idx].active = 0;
+	sublime->free_voices[sublime->num_free_voices++] = idx;
+}
+
+/*
+ * The hardware envelope register is rewritten for all voices by
+ * sublime_task(). The firmware envelopes pick up the change when their
+ * voice is gated or written out, which happens on every envelope step.
+ */
+static void sublime_update_amp_envelope(struct sublime *sublime,
+					struct patch *patch)
+{
+	patch->amp_env_gen++;
+	if (!sublime->hw_envelope)
+		return;
+
+	patch->envelope_reg =
+		(uint32_t)to_envelope_rate(1 << 24, patch->amp_attack) << 24 |
+		to_envelope_rate((0xff - patch->amp_sustain) << 16,
+				 patch->amp_decay) << 16 |
+		patch->amp_sustain << 8 |
+		to_envelope_rate(1 << 24, patch->amp_release);
+	sublime_mark_all_dirty(sublime->dirty_ctrl);
+}
+
+/* Set up the firmware envelope of a voice from its patch */
+static void sublime_voice_envelope(struct voice *voice)
+{
+	struct patch *patch = voice->patch;
+	struct envelope *env = &voice->amp_env;
+
+	if (voice->amp_env_gen == patch->amp_env_gen)
+		return;
+
+	voice->amp_env_gen = patch->amp_env_gen;
+	envelope_set_attack(env, patch->amp_attack);
+	envelope_set_sustain(env, patch->amp_sustain);
+	envelope_set_decay(env, patch->amp_decay);
+	envelope_set_release(env, patch->amp_release);
+}
+
+/*
+ * Voice envelope handling, either done by the hardware envelopes or by
+ * the voice's amp_env.
+ */
+static void sublime_voice_gate_on(struct sublime *sublime, int idx)
+{
+	struct voice *voice = &sublime->voices[idx];
+
+	voice->gate = 1;
+	if (!sublime->hw_envelope) {
+		sublime_voice_envelope(voice);
+		envelope_gate_on(&voice->amp_env);
+		return;
+	}
+
+	/*
+	 * The note on bit might already be set in the hardware,
+	 * so the attack is explicitly (re)started.
+	 */
+	sublime->releasing[idx/32] &= ~(1u << (idx%32));
+	sublime_write_reg(sublime, ENVELOPE_TRIGGER, idx);
+	sublime_mark_dirty(sublime->dirty_ctrl, idx);
+}
+
+static void sublime_voice_gate_off(struct sublime *sublime, int idx)
+{
+	struct voice *voice = &sublime->voices[idx];
+
+	voice->gate = 0;
+	if (!sublime->hw_envelope) {
+		sublime_voice_envelope(voice);
+		envelope_gate_off(&voice->amp_env);
+		return;
+	}
+
+	sublime->releasing[idx/32] |= 1u << (idx%32);
+	sublime_mark_dirty(sublime->dirty_ctrl, idx);
+}
+
+/*
+ * The hardware envelope levels can not be read back, a released voice is
+ * considered to be quieter than a held one.
+ */
+static uint8_t sublime_voice_level(struct sublime *sublime, int idx)
+{
+	struct voice *voice = &sublime->voices[idx];
+
+	if (!sublime->hw_envelope)
+		return envelope_get_output(&voice->amp_env);
+
+	return voice->gate ? 0xff : 0;
+}
+
+/*
+ * Return the released voices whose hardware envelope have finished to the
+ * free voices.
+ */
+static void sublime_poll_envelopes(struct sublime *sublime)
+{
+	uint32_t done;
+	uint32_t mask;
+	int i;
+
+	for (i = 0; i < VOICE_DIRTY_WORDS; i++) {
+		if (!sublime->releasing[i])
+			continue;
+
+		done = sublime->releasing[i] &
+			~sublime_read_reg(sublime, ENVELOPE_ACTIVE + 4*i);
+		sublime->releasing[i] &= ~done;
+		while (done) {
+			mask = done & -done;
+			done &= ~mask;
+			sublime_free_voice(sublime, i*32 + __builtin_ctz(mask));
+		}
+	}
+}
+
+/*
+ * Set up the filter register of a patch, sublime_task() writes it to the
+ * voices that play the patch.
+ * The cutoff coefficient f = 2*sin(pi*cutoff/fs) is approximated by
+ * 2*pi*cutoff/fs. With the cutoff frequency given as a phase increment,
+ * 2^32*cutoff/clk, and fs = clk/sample_period this gives
+ * f = 2*pi*inc*sample_period/2^32, here in 0.16 fixed point.
+ *
+ * fs drops with the number of voices, to ~78 kHz with 128 voices, so the
+ * top cutoffs come close to fs. The filter is only stable for
+ * f^2 + 2*f*q < 4, so f is clamped below the tangent of that bound at
+ * q = 2, f < 1.41 - 0.29*q, less a margin, and below 1. With 128 voices
+ * this caps the cutoff at ~12.4 kHz with full resonance and at ~9.5 kHz
+ * with none, where the approximation reads up to ~5% sharp.
+ */
+static void sublime_update_filter(struct sublime *sublime,
+				  struct patch *patch)
+{
+	uint64_t f;
+	uint32_t f_max;
+	uint32_t q;
+
+	if (!sublime->hw_filter)
+		return;
+
+	/* Damping from 2 down to ~0.08, i.e. a resonance of ~13 */
+	q = 0xfff - patch->filter_resonance*31;
+
+	/* q is in 1.11 fixed point, 1.35 - 0.293*q in 0.16 */
+	f_max = 88474 - (q*75 >> 3);
+	if (f_max > 0xffff)
+		f_max = 0xffff;
+
+	f = (uint64_t)sublime_get_freq(patch->filter_cutoff, 0) *
+		sublime->sample_period * 102944 >> 30;
+	if (f > f_max)
+		f = f_max;
+
+	patch->filter_reg = FILTER_F((uint32_t)f) | FILTER_Q(q) |
+			    FILTER_MODE(patch->filter_mode);
+	sublime_mark_all_dirty(sublime->dirty_ctrl);
+}
+
+/*
+ * Hand a voice over to a part, its registers are rewritten from the patch of
+ * the part on the next sublime_task() pass.
+ */
+static void sublime_voice_set_part(struct sublime *sublime, int idx,
+				   struct part *part)
+{
+	struct voice *voice = &sublime->voices[idx];
+
+	voice->part = part;
+	if (voice->patch == &part->patch)
+		return;
+
+	voice->patch = &part->patch;
+	/* Stale, so that the firmware envelope is set up from the patch */
+	voice->amp_env_gen = part->patch.amp_env_gen - 1;
+	sublime_mark_dirty(sublime->dirty_ctrl, idx);
+}
+
+/*
+ * A part may steal its own voices, and the voices of the parts that play
+ * more than they have reserved as long as it is below its own limit.
+ */
+static int sublime_may_steal(struct part *part, struct voice *voice)
+{
+	if (voice->part == part)
+		return 1;
+
+	return part->num_voices < part->max_voices &&
+		voice->part->num_voices > voice->part->reserved_voices;
+}
+
+/*
+ * Pick a voice to take over according to the steal policy.
+ * Finding the quietest voice requires a walk through all the allocated
+ * voices, the oldest voice is found at the head of the list unless other
+ * parts are protected by their reservations.
+ */
+static int sublime_steal_voice(struct sublime *sublime, struct part *part)
+{
+	uint8_t min = 0xff;
+	uint8_t output;
+	int voice = VOICE_NONE;
+	int i;
+
+	switch (sublime->steal_policy) {
+	case VOICE_STEAL_OLDEST:
+		for (i = sublime->oldest_voice; i != VOICE_NONE;
+		     i = sublime->voices[i].next) {
+			if (sublime_may_steal(part, &sublime->voices[i])) {
+				voice = i;
+				break;
+			}
+		}
 		break;
-	case 3:
-		gen_triangle(dest);
+
+	case VOICE_STEAL_QUIETEST:
+		for (i = sublime->oldest_voice; i != VOICE_NONE;
+		     i = sublime->voices[i].next) {
+			if (!sublime_may_steal(part, &sublime->voices[i]))
+				continue;
+			output = sublime_voice_level(sublime, i);
+			if (voice == VOICE_NONE || output < min) {
+				min = output;
+				voice = i;
+			}
+		}
 		break;
-	case 4:
-		gen_sine(dest);
+
+	case VOICE_STEAL_NONE:
+	default:
 		break;
 	}
+
+	if (voice == VOICE_NONE)
+		return -1;
+
+	sublime_detach_voice(sublime, voice);
+	sublime->stats.voices_stolen++;
+
+	return voice;
 }
 
-int sublime_get_free_voice(struct sublime *sublime)
+/*
+ * Returns a voice for the part that is neither allocated nor present in a
+ * key map. A playing voice is stolen when the part has reached its limit,
+ * or when the free voices left are held back for the reservations of the
+ * other parts.
+ */
+int sublime_get_free_voice(struct sublime *sublime, struct part *part)
 {
-	for (int i = 0; i < sublime->num_voices; i++) {
-		if (!sublime->voices[i].active)
-			return i;
-	}
+	int held = sublime->reserved_free;
+	int voice;
 
-	return -1;
+	if (part->num_voices < part->reserved_voices)
+		held--;
+
+	if (part->num_voices < part->max_voices &&
+	    sublime->num_free_voices > held)
+		voice = sublime->free_voices[--sublime->num_free_voices];
+	else
+		voice = sublime_steal_voice(sublime, part);
+
+	if (voice >= 0)
+		sublime_voice_set_part(sublime, voice, part);
+
+	return voice;
 }
 
-int sublime_get_voice_by_note(struct sublime *sublime, uint8_t note)
+int sublime_get_voice_by_note(struct part *part, uint8_t note)
 {
-	for (int i = 0; i < sublime->num_voices; i++) {
-		if (sublime->voices[i].amp_env.gate &&
-		    sublime->voices[i].note == note)
-			return i;
-	}
+	uint8_t voice = part->key_voice[note & 0x7f];
 
-	return -1;
+	return voice == VOICE_NONE ? -1 : voice;
 }
 
 /*
- * MIDI callbacks
+ * MIDI callbacks, they are registered with the part that plays the
+ * channel as private data.
  */
 void sublime_note_on_cb(struct midi *midi)
 {
-	struct sublime *sublime = midi->private_data;
+	struct part *part = midi->private_data;
+	struct sublime *sublime = part->sublime;
 	int voice;
 
-	voice = sublime_get_free_voice(sublime);
+	voice = sublime_get_voice_by_note(part, midi->note.key);
+	if (voice >= 0) {
+		/*
+		 * The key is still sounding, either retrigger the voice that
+		 * plays it, or release it and give the key a new voice.
+		 */
+		if (sublime->retrigger) {
+			sublime_unlink_voice(sublime, voice);
+		} else {
+			sublime_voice_gate_off(sublime, voice);
+			voice = sublime_get_free_voice(sublime, part);
+		}
+	} else {
+		voice = sublime_get_free_voice(sublime, part);
+	}
+
 	if (voice < 0)
 		return;
 
-	sublime->voices[voice].note = midi->note.key;
+	sublime_link_voice(sublime, voice);
+	part->key_voice[midi->note.key & 0x7f] = voice;
+	sublime->voices[voice].note = midi->note.key & 0x7f;
 	sublime->voices[voice].velocity = midi->note.velocity;
 	sublime->voices[voice].active = 1;
-	envelope_gate_on(&sublime->voices[voice].amp_env);
+	sublime_mark_dirty(sublime->dirty_freq, voice);
+	sublime_voice_gate_on(sublime, voice);
 }
 
 void sublime_note_off_cb(struct midi *midi)
 {
-	struct sublime *sublime = midi->private_data;
+	struct part *part = midi->private_data;
+	struct sublime *sublime = part->sublime;
 	int voice;
 
-	voice = sublime_get_voice_by_note(sublime, midi->note.key);
-	if (voice < 0)
+	voice = sublime_get_voice_by_note(part, midi->note.key);
+	if (voice < 0 || !sublime->voices[voice].gate)
 		return;
 
-	if (midi->note.velocity)
+	if (midi->note.velocity) {
 		sublime->voices[voice].velocity = midi->note.velocity;
-	envelope_gate_off(&sublime->voices[voice].amp_env);
+		sublime_mark_dirty(sublime->dirty_ctrl, voice);
+	}
+	sublime_voice_gate_off(sublime, voice);
+}
+
+/*
+ * Multiplier for the pitch bend register, the ratio between two note
+ * frequencies taken high up in the note table where they are the most
+ * precise. The range of the register covers +-2 octaves.
+ */
+#define BEND_REF_NOTE	96
+
+static uint32_t sublime_get_bend(int32_t cents)
+{
+	if (cents > 2400)
+		cents = 2400;
+	else if (cents < -2400)
+		cents = -2400;
+
+	return ((uint64_t)sublime_get_freq(BEND_REF_NOTE, cents) <<
+		16) / sublime_get_freq(BEND_REF_NOTE, 0);
+}
+
+/* Whether the pitchwheel of the parts is applied by the hardware */
+static int sublime_hw_pitchwheel(struct sublime *sublime)
+{
+	return sublime->hw_bend && sublime->num_parts == 1;
+}
+
+/* The bend in cents that goes into the voice frequencies of a part */
+static int32_t sublime_part_bend(struct sublime *sublime, struct part *part)
+{
+	if (!sublime->hw_bend)
+		return part->pitchwheel + sublime->master_tune;
+
+	return sublime_hw_pitchwheel(sublime) ? 0 : part->pitchwheel;
+}
+
+static void sublime_write_bend(struct sublime *sublime)
+{
+	int32_t cents = sublime->master_tune;
+
+	if (!sublime->hw_bend)
+		return;
+
+	if (sublime_hw_pitchwheel(sublime))
+		cents += sublime->parts[0].pitchwheel;
+	sublime_write_reg(sublime, PITCH_BEND, sublime_get_bend(cents));
+	sublime->stats.writes_issued++;
+}
+
+/*
+ * A change of the master tuning, or of the pitchwheel with a single part,
+ * is a single register write with the pitch bend in hardware, otherwise
+ * all voice frequencies have to be rewritten.
+ */
+void sublime_set_master_tune(struct sublime *sublime, int16_t cents)
+{
+	if (cents == sublime->master_tune)
+		return;
+
+	sublime->master_tune = cents;
+	if (sublime->hw_bend)
+		sublime_write_bend(sublime);
+	else
+		sublime_mark_all_dirty(sublime->dirty_freq);
+}
+
+/* The policy is shared by all parts, it applies from the next note on */
+int sublime_set_steal_policy(struct sublime *sublime, int policy)
+{
+	if (policy < 0 || policy >= VOICE_STEAL_POLICIES)
+		return -1;
+
+	sublime->steal_policy = policy;
+	return 0;
 }
 
 void sublime_pitchwheel_cb(struct midi *midi)
 {
-	struct sublime *sublime = midi->private_data;
+	struct part *part = midi->private_data;
+	struct sublime *sublime = part->sublime;
+	int16_t pitchwheel = 200*midi->pitchwheel/8192;
+
+	if (pitchwheel == part->pitchwheel)
+		return;
 
-	sublime->pitchwheel = 200*midi->pitchwheel/8192;
+	part->pitchwheel = pitchwheel;
+	if (sublime_hw_pitchwheel(sublime))
+		sublime_write_bend(sublime);
+	else
+		sublime_mark_all_dirty(sublime->dirty_freq);
+}
+
+/* Called from the envelope when its output has changed */
+void sublime_envelope_update_cb(void *private_data)
+{
+	struct voice *voice = private_data;
+	struct sublime *sublime = voice->sublime;
+
+	sublime_mark_dirty(sublime->dirty_ctrl, voice - sublime->voices);
 }
 
 void sublime_control_change_cb(struct midi *midi)
 {
-	int i;
-	struct sublime *sublime = midi->private_data;
+	struct part *part = midi->private_data;
+	struct sublime *sublime = part->sublime;
+	struct patch *patch = &part->patch;
 	uint8_t value = midi->cc.value;
 
 	switch (midi->cc.controller) {
 	case CC_OSC0_DETUNE_NOTES:
-		for (i = 0; i < sublime->num_voices; i++)
-			sublime->voices[i].osc[0].detune_notes = value - 64;
+		patch->osc[0].detune_notes = value - 64;
+		sublime_mark_all_dirty(sublime->dirty_freq);
 		break;
 
 	case CC_OSC0_DETUNE_CENTS:
-		for (i = 0; i < sublime->num_voices; i++)
-			sublime->voices[i].osc[0].detune_cents = value - 64;
+		patch->osc[0].detune_cents = value - 64;
+		sublime_mark_all_dirty(sublime->dirty_freq);
 		break;
 
 	case CC_OSC0_WAVEFORM:
-		sublime_set_waveform(value, sublime->wavetable0);
+		sublime_set_waveform(sublime, patch, 0, value);
 		break;
 
 	case CC_OSC1_DETUNE_NOTES:
-		for (i = 0; i < sublime->num_voices; i++)
-			sublime->voices[i].osc[1].detune_notes = value - 64;
+		patch->osc[1].detune_notes = value - 64;
+		sublime_mark_all_dirty(sublime->dirty_freq);
 		break;
 
 	case CC_OSC1_DETUNE_CENTS:
-		for (i = 0; i < sublime->num_voices; i++)
-			sublime->voices[i].osc[1].detune_cents = value - 64;
+		patch->osc[1].detune_cents = value - 64;
+		sublime_mark_all_dirty(sublime->dirty_freq);
 		break;
 
 	case CC_OSC1_WAVEFORM:
-		sublime_set_waveform(value, sublime->wavetable1);
+		sublime_set_waveform(sublime, patch, 1, value);
 		break;
 
 	case CC_OSC_MIXMODE:
-		for (i = 0; i < sublime->num_voices; i++)
-			sublime->voices[i].osc_mixmode = value;
+		patch->osc_mixmode = value;
+		sublime_mark_all_dirty(sublime->dirty_ctrl);
+		break;
+
+	case CC_FILTER_MODE:
+		patch->filter_mode = value >> 5;
+		sublime_update_filter(sublime, patch);
+		break;
+
+	case CC_FILTER_CUTOFF:
+		patch->filter_cutoff = value;
+		sublime_update_filter(sublime, patch);
+		break;
+
+	case CC_FILTER_RESONANCE:
+		patch->filter_resonance = value;
+		sublime_update_filter(sublime, patch);
 		break;
 
 	case CC_AMP_ATTACK:
-		for (i = 0; i < sublime->num_voices; i++)
-			sublime->voices[i].amp_env.attack = to_us(value);
+		patch->amp_attack = to_us(value);
+		sublime_update_amp_envelope(sublime, patch);
 		break;
 
 	case CC_AMP_DECAY:
-		for (i = 0; i < sublime->num_voices; i++)
-			sublime->voices[i].amp_env.decay = to_us(value);;
+		patch->amp_decay = to_us(value);
+		sublime_update_amp_envelope(sublime, patch);
 		break;
 
 	case CC_AMP_SUSTAIN:
-		for (i = 0; i < sublime->num_voices; i++)
-			sublime->voices[i].amp_env.sustain = value * 2;
+		patch->amp_sustain = value * 2;
+		sublime_update_amp_envelope(sublime, patch);
 		break;
 
 	case CC_AMP_RELEASE:
-		for (i = 0; i < sublime->num_voices; i++)
-			sublime->voices[i].amp_env.release = to_us(value);;
+		patch->amp_release = to_us(value);
+		sublime_update_amp_envelope(sublime, patch);
+		break;
+
+	case CC_VOICE_STEAL:
+		sublime_set_steal_policy(sublime, value >> 5);
+		break;
 
 	default:
 		break;
 	}
 }
 
-void sublime_write_voice(struct sublime *sublime, int voice_idx)
+/* The control changes set by SYSEX_PATCH, in the order of its values */
+static const uint8_t sysex_patch_cc[SYSEX_PATCH_VALUES] = {
+	CC_OSC0_WAVEFORM,
+	CC_OSC0_DETUNE_NOTES,
+	CC_OSC0_DETUNE_CENTS,
+	CC_OSC1_WAVEFORM,
+	CC_OSC1_DETUNE_NOTES,
+	CC_OSC1_DETUNE_CENTS,
+	CC_OSC_MIXMODE,
+	CC_FILTER_MODE,
+	CC_FILTER_CUTOFF,
+	CC_FILTER_RESONANCE,
+	CC_AMP_ATTACK,
+	CC_AMP_DECAY,
+	CC_AMP_SUSTAIN,
+	CC_AMP_RELEASE,
+};
+
+/* Header bytes that follow each SysEx command */
+static const uint8_t sysex_header_len[SYSEX_COMMANDS] = {
+	[SYSEX_WAVETABLE_BEGIN] = 4,
+	[SYSEX_WAVETABLE_DATA] = 3,
+	[SYSEX_WAVETABLE_COMMIT] = 1,
+	[SYSEX_PATCH] = 1,
+	[SYSEX_PARTS] = 1,
+	[SYSEX_PART_VOICES] = 3,
+};
+
+/* Number of user waveforms, leaving one user wavetable spare */
+static int sublime_user_waveforms(struct sublime *sublime)
+{
+	int num = sublime->num_wavetables - WAVEFORM_TABLE(WAVEFORM_USER) - 1;
+
+	if (num < 0)
+		return 0;
+	return num > MAX_USER_WAVEFORMS ? MAX_USER_WAVEFORMS : num;
+}
+
+static int sublime_wavetable_in_use(struct sublime *sublime, uint8_t table)
+{
+	uint32_t wavetable;
+	int i;
+
+	for (i = 0; i < MAX_USER_WAVEFORMS; i++)
+		if (sublime->user_wavetable[i] == table)
+			return 1;
+
+	/* The map entries only ever hold the tables the waveforms map to */
+	if (sublime->hw_table_map)
+		return 0;
+
+	for (i = 0; i < sublime->num_voices; i++) {
+		wavetable = sublime->voices[i].wavetable;
+		if ((wavetable & 0xff) == table ||
+		    ((wavetable >> 8) & 0xff) == table)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Find a user wavetable that no waveform maps to and no voice plays, so that
+ * it can be uploaded into while the synth plays on.
+ */
+static uint8_t sublime_spare_wavetable(struct sublime *sublime)
+{
+	int table;
+
+	for (table = WAVEFORM_TABLE(WAVEFORM_USER);
+	     table < sublime->num_wavetables; table++)
+		if (!sublime_wavetable_in_use(sublime, table))
+			return table;
+
+	return WAVETABLE_NONE;
+}
+
+/*
+ * Switch a user waveform over to a freshly uploaded wavetable, along with the
+ * patches that play it. The voices pick it up through the wavetable map, or
+ * on their next write without it.
+ */
+static void sublime_commit_wavetable(struct sublime *sublime,
+				     uint8_t waveform, uint8_t table)
+{
+	uint8_t old = sublime->user_wavetable[waveform];
+	struct patch *patch;
+	int changed;
+	int i;
+
+	sublime->user_wavetable[waveform] = table;
+	for (i = 0; i < MAX_PARTS && old != WAVETABLE_NONE; i++) {
+		patch = &sublime->parts[i].patch;
+		changed = 0;
+		if (patch->osc[0].wavetable == old) {
+			patch->osc[0].wavetable = table;
+			changed = 1;
+		}
+		if (patch->osc[1].wavetable == old) {
+			patch->osc[1].wavetable = table;
+			changed = 1;
+		}
+		if (changed)
+			sublime_update_wavetables(sublime, patch);
+	}
+}
+
+static void sublime_apply_patch(struct sublime *sublime, struct part *part,
+				const uint8_t *values)
+{
+	struct midi midi;
+	int i;
+
+	midi.chan = 0;
+	midi.private_data = part;
+	for (i = 0; i < SYSEX_PATCH_VALUES; i++) {
+		midi.cc.controller = sysex_patch_cc[i];
+		midi.cc.value = values[i];
+		sublime_control_change_cb(&midi);
+	}
+}
+
+static int32_t sysex_get_21(const uint8_t *data)
+{
+	return data[0] | data[1] << 7 | data[2] << 14;
+}
+
+/* Write out the wavetable entries collected so far */
+static void sublime_sysex_flush(struct sublime *sublime,
+				struct sysex_upload *upload)
+{
+	if (!upload->block_len)
+		return;
+
+	sublime_write_block(sublime, WAVETABLES +
+			    upload->table*sublime->wavetable_stride +
+			    upload->offset*4, upload->block, upload->block_len);
+	upload->offset += upload->block_len;
+	upload->block_len = 0;
+}
+
+/* Unpack one byte of wavetable entries */
+static void sublime_sysex_unpack(struct sublime *sublime,
+				 struct sysex_upload *upload, uint32_t data)
+{
+	if (!upload->group_pos) {
+		upload->msbs = data;
+		upload->group_pos = 1;
+		return;
+	}
+
+	data |= ((upload->msbs >> (upload->group_pos - 1)) & 1) << 7;
+	if (++upload->group_pos == 8)
+		upload->group_pos = 0;
+
+	upload->entry |= data << (8*upload->entry_bytes);
+	if (++upload->entry_bytes < 4)
+		return;
+
+	if (upload->offset + upload->block_len < sublime->wavetable_len)
+		upload->block[upload->block_len++] = upload->entry;
+	else
+		upload->error = 1;
+	upload->entry = 0;
+	upload->entry_bytes = 0;
+
+	if (upload->block_len == SYSEX_BLOCK)
+		sublime_sysex_flush(sublime, upload);
+}
+
+/* Called with the header of a message once it is complete */
+static void sublime_sysex_header(struct sublime *sublime,
+				 struct sysex_upload *upload)
+{
+	if (upload->command != SYSEX_WAVETABLE_DATA)
+		return;
+
+	/* The block has to follow on from the good blocks */
+	upload->offset = sysex_get_21(upload->header);
+	if (upload->table == WAVETABLE_NONE || upload->offset > upload->next)
+		upload->error = 1;
+}
+
+static void sublime_sysex_byte(struct sublime *sublime,
+			       struct sysex_upload *upload, uint8_t data)
+{
+	int pos = upload->pos++;
+
+	if (pos == 0) {
+		upload->ignore = data != SYSEX_ID;
+		return;
+	}
+
+	upload->sum += data;
+	if (pos == 1) {
+		upload->command = data;
+		if (data == SYSEX_NONE || data >= SYSEX_COMMANDS)
+			upload->ignore = 1;
+		return;
+	}
+
+	pos -= 2;
+	if (pos < sysex_header_len[upload->command]) {
+		upload->header[pos] = data;
+		if (pos == sysex_header_len[upload->command] - 1)
+			sublime_sysex_header(sublime, upload);
+		return;
+	}
+
+	if (upload->error)
+		return;
+
+	if (upload->command == SYSEX_WAVETABLE_DATA)
+		sublime_sysex_unpack(sublime, upload, data);
+	else if (upload->command == SYSEX_PATCH &&
+		 upload->num_values < SYSEX_PATCH_VALUES)
+		upload->patch[upload->num_values++] = data;
+	else
+		upload->error = 1;
+}
+
+/* Carry out a complete message, the held byte is its checksum */
+static int sublime_sysex_end(struct sublime *sublime,
+			     struct sysex_upload *upload)
+{
+	/* The waveform, the part or the number of parts */
+	uint8_t idx = upload->header[0];
+	uint8_t table;
+
+	if (upload->held < 0 ||
+	    upload->pos < 2 + sysex_header_len[upload->command])
+		return -1;
+
+	if (upload->command == SYSEX_WAVETABLE_DATA)
+		sublime_sysex_flush(sublime, upload);
+
+	upload->sum += upload->held;
+	if (upload->error || upload->sum & 0x7f)
+		return -1;
+
+	switch (upload->command) {
+	case SYSEX_WAVETABLE_BEGIN:
+		if (idx >= sublime_user_waveforms(sublime) ||
+		    sysex_get_21(&upload->header[1]) != sublime->wavetable_len)
+			return -1;
+
+		table = sublime_spare_wavetable(sublime);
+		if (table == WAVETABLE_NONE)
+			return -1;
+
+		upload->waveform = idx;
+		upload->table = table;
+		upload->next = 0;
+		break;
+
+	case SYSEX_WAVETABLE_DATA:
+		if (upload->entry_bytes)
+			return -1;
+		if (upload->offset > upload->next)
+			upload->next = upload->offset;
+		break;
+
+	case SYSEX_WAVETABLE_COMMIT:
+		if (upload->table == WAVETABLE_NONE ||
+		    idx != upload->waveform ||
+		    upload->next < sublime->wavetable_len)
+			return -1;
+
+		sublime_commit_wavetable(sublime, idx, upload->table);
+		upload->table = WAVETABLE_NONE;
+		break;
+
+	case SYSEX_PATCH:
+		if (idx >= MAX_PARTS ||
+		    upload->num_values != SYSEX_PATCH_VALUES)
+			return -1;
+
+		sublime_apply_patch(sublime, &sublime->parts[idx],
+				    upload->patch);
+		break;
+
+	case SYSEX_PARTS:
+		if (idx < 1 || idx > MAX_PARTS)
+			return -1;
+
+		sublime_set_parts(sublime, idx);
+		break;
+
+	case SYSEX_PART_VOICES:
+		return sublime_set_part_voices(sublime, idx,
+					       upload->header[1],
+					       upload->header[2]);
+	}
+
+	return 0;
+}
+
+/*
+ * Receives the SysEx messages a chunk at a time. The wavetable entries are
+ * unpacked and written to the wavetable as they arrive, the checksum only
+ * decides whether the block counts.
+ */
+void sublime_sysex_cb(struct midi *midi)
+{
+	struct sublime *sublime = midi->private_data;
+	struct sysex_upload *upload = &sublime->upload;
+	int i;
+
+	if (midi->sysex.flags & MIDI_SYSEX_START) {
+		upload->ignore = 0;
+		upload->error = 0;
+		upload->command = SYSEX_NONE;
+		upload->pos = 0;
+		upload->held = -1;
+		upload->sum = 0;
+		upload->group_pos = 0;
+		upload->entry_bytes = 0;
+		upload->entry = 0;
+		upload->block_len = 0;
+		upload->num_values = 0;
+	}
+
+	if (midi->sysex.flags & MIDI_SYSEX_ERROR)
+		upload->error = 1;
+
+	for (i = 0; i < midi->sysex.len && !upload->ignore; i++) {
+		/* The ID is checked right away, it can't be the checksum */
+		if (!upload->pos) {
+			sublime_sysex_byte(sublime, upload,
+					   midi->sysex.data[i]);
+			continue;
+		}
+		if (upload->held >= 0)
+			sublime_sysex_byte(sublime, upload, upload->held);
+		upload->held = midi->sysex.data[i];
+	}
+
+	if ((midi->sysex.flags & MIDI_SYSEX_END) && !upload->ignore &&
+	    sublime_sysex_end(sublime, upload))
+		sublime->stats.sysex_errors++;
+}
+
+void sublime_write_voice(struct sublime *sublime, int voice_idx,
+			 int write_ctrl, int write_freq)
 {
 	uint16_t velocity;
 	struct voice *voice = &sublime->voices[voice_idx];
+	struct patch *patch = voice->patch;
+	struct voice_regs regs = voice->shadow;
 	int32_t cents;
+	int32_t bend;
 	uint32_t ctrl = 0;
+	uint32_t wavetable;
+
+	if (write_ctrl && sublime->hw_envelope) {
+		ctrl |= voice->velocity << 8;
+		if (voice->gate)
+			ctrl |= VOICE_CTRL_NOTE_ON;
+		regs.envelope = patch->envelope_reg;
+	} else if (write_ctrl) {
+		sublime_voice_envelope(voice);
+
+		/* Return the voice to the free voices when it has finished */
+		if (voice->active && !envelope_isactive(&voice->amp_env))
+			sublime_free_voice(sublime, voice_idx);
+
+		velocity = (voice->velocity *
+			    envelope_get_output(&voice->amp_env))/256;
+		ctrl |= velocity << 8;
+	}
+
+	if (write_ctrl) {
+		ctrl |= (patch->osc_mixmode & 0x7) << 3;
+		ctrl |= (patch->osc[1].enable << 1) | patch->osc[0].enable;
+		regs.ctrl = ctrl;
+
+		if (sublime->hw_table_map)
+			wavetable = VOICE_WAVETABLE_MAP(patch->table_map);
+		else
+			wavetable = sublime_patch_wavetables(patch);
+		if (voice->wavetable != wavetable) {
+			voice->wavetable = wavetable;
+			sublime_write_reg(sublime, VOICE_WAVETABLE(voice_idx),
+					  wavetable);
+			sublime->stats.writes_issued++;
+		}
+
+		if (sublime->hw_filter && voice->filter != patch->filter_reg) {
+			voice->filter = patch->filter_reg;
+			sublime_write_reg(sublime, VOICE_FILTER(voice_idx),
+					  voice->filter);
+			sublime->stats.writes_issued++;
+		}
+	}
+
+	/* The frequencies of idle voices are updated on note on */
+	if (write_freq && voice->active) {
+		bend = sublime_part_bend(sublime, voice->part);
 
-	if (!envelope_isactive(&voice->amp_env))
-		voice->active = 0;
+		cents = bend + patch->osc[0].detune_notes*100 +
+			patch->osc[0].detune_cents;
+		regs.osc0_freq = sublime_osc_freq(sublime, voice->note, cents);
 
-	velocity = (voice->velocity * voice->amp_env.output)/256;
+		cents = bend + patch->osc[1].detune_notes*100 +
+			patch->osc[1].detune_cents;
+		regs.osc1_freq = sublime_osc_freq(sublime, voice->note, cents);
+	}
+
+	sublime_commit_voice_regs(sublime, voice_idx, &regs);
+}
+
+/*
+ * Set up the output stage to produce samples at the codec rate.
+ * The low pass filter cutoff, roughly synth rate/(2*pi*2^shift), is placed
+ * at or below half the output rate.
+ */
+static void sublime_init_output(struct sublime *sublime)
+{
+	uint32_t synth_rate = (uint32_t)BOARD_CLK_FREQ/sublime->sample_period;
+	uint32_t rate_inc = (1u << 28)*(SUBLIME_OUTPUT_RATE/BOARD_CLK_FREQ) +
+			    0.5f;
+	uint32_t shift = 0;
 
-	ctrl |= velocity << 8;
-	ctrl |= (voice->osc_mixmode & 0x7) << 3;
-	ctrl |= (voice->osc[1].enable << 1) | voice->osc[0].enable;
-	sublime_write_reg(sublime, VOICE_REG(voice_idx, VOICE_CTRL), ctrl);
+	while (shift < 15 && (3*(uint32_t)SUBLIME_OUTPUT_RATE << shift) <
+	       synth_rate)
+		shift++;
 
-	cents = sublime->pitchwheel + voice->osc[0].detune_notes*100 +
-		voice->osc[0].detune_cents;
-	sublime_set_note(sublime, voice_idx, 0, voice->note, cents);
+	sublime_write_reg(sublime, OUTPUT_RATE,
+			  OUTPUT_RATE_LPF_SHIFT(shift) | rate_inc);
+}
 
-	cents = sublime->pitchwheel + voice->osc[1].detune_notes*100 +
-		voice->osc[1].detune_cents;
-	sublime_set_note(sublime, voice_idx, 1, voice->note, cents);
+/*
+ * Set up the wavetable mipmaps. Level L of a wavetable has harmonics up to
+ * WAVETABLE_SIZE/2^(L+1) and is played for frequencies up to
+ * 2^(shift+L), the shift is picked so that those harmonics stay below half
+ * the output rate, or half the synth rate when that is lower, as it is with
+ * many voices.
+ */
+static void sublime_init_mipmap(struct sublime *sublime)
+{
+	uint32_t rate = (uint32_t)BOARD_CLK_FREQ/sublime->sample_period;
+	uint32_t freq;
+	uint32_t shift;
+
+	if (rate > SUBLIME_OUTPUT_RATE)
+		rate = SUBLIME_OUTPUT_RATE;
+	freq = (rate/2)*(2.0f*(1ull << 32)/WAVETABLE_SIZE)/BOARD_CLK_FREQ;
+	shift = freq > 1 ? 31 - __builtin_clz(freq) : 1;
+
+	sublime->main_ctrl |= MAIN_CTRL_MIP_SHIFT(shift);
+	sublime->wavetable_len = TABLES_WAVETABLE_LEN;
+	sublime->wavetable_stride = 2*WAVETABLE_SIZE*4;
+}
+
+void sublime_get_output_stats(struct sublime *sublime, uint32_t *underruns,
+			      uint32_t *overruns)
+{
+	*underruns = sublime_read_reg(sublime, OUTPUT_UNDERRUNS);
+	*overruns = sublime_read_reg(sublime, OUTPUT_OVERRUNS);
 }
 
+/*
+ * Write out the voices that have been marked as dirty since the last pass.
+ * The dirty bits are also set from the timer isr, so they are fetched and
+ * cleared with interrupts disabled.
+ */
 void sublime_task(struct sublime *sublime)
 {
-	for (int i = 0; i < sublime->num_voices; i++) {
-		sublime_write_voice(sublime, i);
+	uint32_t dirty_ctrl[VOICE_DIRTY_WORDS];
+	uint32_t dirty_freq[VOICE_DIRTY_WORDS];
+	uint64_t issued = sublime->stats.writes_issued;
+	uint64_t full;
+	unsigned long flags;
+	uint32_t pending;
+	uint32_t mask;
+	int voice;
+	int i;
+
+	flags = irq_save();
+	for (i = 0; i < VOICE_DIRTY_WORDS; i++) {
+		dirty_ctrl[i] = sublime->dirty_ctrl[i];
+		dirty_freq[i] = sublime->dirty_freq[i];
+		sublime->dirty_ctrl[i] = 0;
+		sublime->dirty_freq[i] = 0;
+	}
+	irq_restore(flags);
+
+	if (sublime->hw_envelope)
+		sublime_poll_envelopes(sublime);
+
+	for (i = 0; i < VOICE_DIRTY_WORDS; i++) {
+		pending = dirty_ctrl[i] | dirty_freq[i];
+		while (pending) {
+			mask = pending & -pending;
+			pending &= ~mask;
+			voice = i*32 + __builtin_ctz(mask);
+			if (voice >= sublime->num_voices)
+				break;
+
+			sublime_write_voice(sublime, voice,
+					    dirty_ctrl[i] & mask,
+					    dirty_freq[i] & mask);
+		}
 	}
+
+	/*
+	 * Account the writes that would have been done without the shadow,
+	 * the voice block, the wavetable and the filter register of every
+	 * voice.
+	 */
+	issued = sublime->stats.writes_issued - issued;
+	full = (VOICE_REG_WORDS + 1 + sublime->hw_filter)*sublime->num_voices;
+	if (issued < full)
+		sublime->stats.writes_skipped += full - issued;
+
+	sublime_wavetable_task(sublime);
 }
 
-void sublime_init(struct sublime *sublime, void *base)
+/*
+ * Set up a patch with the defaults: saw and square, the filters bypassed
+ * and fully open.
+ */
+static void sublime_init_patch(struct sublime *sublime, struct patch *patch)
+{
+	patch->osc[0].enable = 1;
+	patch->osc[0].detune_notes = 0;
+	patch->osc[0].detune_cents = 0;
+	patch->osc[0].wavetable = 0;
+	patch->osc[1] = patch->osc[0];
+	patch->osc_mixmode = 0;
+	sublime_set_waveform(sublime, patch, 0, WAVEFORM_SAW);
+	sublime_set_waveform(sublime, patch, 1, WAVEFORM_SQUARE);
+
+	patch->amp_attack = 50000;
+	patch->amp_decay = 100000;
+	patch->amp_sustain = 0x7f;
+	patch->amp_release = 100000;
+	sublime_update_amp_envelope(sublime, patch);
+
+	patch->filter_mode = FILTER_BYPASS;
+	patch->filter_cutoff = 127;
+	patch->filter_resonance = 0;
+	sublime_update_filter(sublime, patch);
+}
+
+/* The part that plays a MIDI channel with num_parts parts, -1 for none */
+static int sublime_channel_part(int num_parts, int chan)
+{
+	if (num_parts == 1)
+		return 0;
+
+	return chan < num_parts ? chan : -1;
+}
+
+/*
+ * Route the MIDI channels to the parts, with a single part it plays all
+ * channels, otherwise part N plays channel N and the channels without a
+ * part are ignored. The held notes of a part that loses a channel are
+ * released, their note offs would no longer reach it.
+ */
+void sublime_set_parts(struct sublime *sublime, int num_parts)
 {
+	struct part *part;
+	struct voice *voice;
+	uint32_t moved = 0;
+	int old_part;
+	int chan;
 	int i;
 
-	/* Generate the lookup tables */
-	gen_note_table();
-	gen_cent_table();
+	if (num_parts < 1)
+		num_parts = 1;
+	else if (num_parts > MAX_PARTS)
+		num_parts = MAX_PARTS;
+
+	for (chan = 0; chan < MIDI_NUM_CHANNELS; chan++) {
+		old_part = sublime_channel_part(sublime->num_parts, chan);
+		if (old_part >= 0 &&
+		    old_part != sublime_channel_part(num_parts, chan))
+			moved |= 1u << old_part;
+	}
+
+	for (i = 0; i < sublime->num_voices; i++) {
+		voice = &sublime->voices[i];
+		if (voice->active && voice->gate &&
+		    moved & (1u << (voice->part - sublime->parts)))
+			sublime_voice_gate_off(sublime, i);
+	}
+
+	sublime->num_parts = num_parts;
+
+	for (chan = 0; chan < MIDI_NUM_CHANNELS; chan++) {
+		i = sublime_channel_part(num_parts, chan);
+		part = i >= 0 ? &sublime->parts[i] : NULL;
+
+		midi_register_cb(MIDI_EVENT_NOTE_ON, part, chan,
+				 part ? sublime_note_on_cb : NULL);
+		midi_register_cb(MIDI_EVENT_NOTE_OFF, part, chan,
+				 part ? sublime_note_off_cb : NULL);
+		midi_register_cb(MIDI_EVENT_PW_CHANGE, part, chan,
+				 part ? sublime_pitchwheel_cb : NULL);
+		midi_register_cb(MIDI_EVENT_CC, part, chan,
+				 part ? sublime_control_change_cb : NULL);
+	}
+
+	/* The pitchwheels may move between the hardware and the voices */
+	sublime_write_bend(sublime);
+	sublime_mark_all_dirty(sublime->dirty_freq);
+}
+
+/*
+ * Set the number of voices reserved for a part and the most it may play,
+ * the reservations of all parts can't exceed the number of voices.
+ * Returns 0 on success.
+ */
+int sublime_set_part_voices(struct sublime *sublime, int idx,
+			    int reserved_voices, int max_voices)
+{
+	struct part *part;
+	int reserved = 0;
+	int i;
+
+	if (idx < 0 || idx >= MAX_PARTS || reserved_voices < 0 ||
+	    reserved_voices > max_voices || max_voices > sublime->num_voices)
+		return -1;
+
+	for (i = 0; i < MAX_PARTS; i++)
+		if (i != idx)
+			reserved += sublime->parts[i].reserved_voices;
+	if (reserved + reserved_voices > sublime->num_voices)
+		return -1;
+
+	part = &sublime->parts[idx];
+	part->reserved_voices = reserved_voices;
+	part->max_voices = max_voices;
+
+	sublime->reserved_free = 0;
+	for (i = 0; i < MAX_PARTS; i++) {
+		part = &sublime->parts[i];
+		if (part->num_voices < part->reserved_voices)
+			sublime->reserved_free += part->reserved_voices -
+						  part->num_voices;
+	}
+
+	return 0;
+}
+
+void sublime_init(struct sublime *sublime, void *base)
+{
+	struct part *part;
+	int key;
+	uint32_t config;
+	int mip_levels;
+	int i;
 
 	sublime->base = base;
-	sublime->num_voices = sublime_read_reg(sublime, SUBLIME_CONFIG) & 0x7f;
-	printf("SJK DEBUG: sublime->num_voices = %d\r\n", sublime->num_voices);
+	config = sublime_read_reg(sublime, SUBLIME_CONFIG);
+	sublime->num_voices = config & 0x7f;
+	sublime->hw_envelope = !!(config & SUBLIME_CONFIG_ENVELOPE);
+	sublime->num_wavetables = SUBLIME_CONFIG_WAVETABLES(config);
+	sublime->hw_filter = !!(config & SUBLIME_CONFIG_FILTER);
+	/*
+	 * SAMPLE_PERIOD came with the filter, the cores before it spend a
+	 * clock cycle per voice. The later features imply the register too.
+	 */
+	sublime->sample_period = sublime->num_voices;
+	if (config & (SUBLIME_CONFIG_FILTER | SUBLIME_CONFIG_INTERPOLATE |
+		      SUBLIME_CONFIG_MIPMAP | SUBLIME_CONFIG_PITCH |
+		      SUBLIME_CONFIG_BEND))
+		sublime->sample_period = sublime_read_reg(sublime,
+							  SAMPLE_PERIOD);
+	sublime->hw_pitch = !!(config & SUBLIME_CONFIG_PITCH);
+	if (sublime->hw_pitch)
+		sublime_write_reg(sublime, NOTE_BASE, TABLES_NOTE_BASE);
+	sublime->hw_bend = !!(config & SUBLIME_CONFIG_BEND);
+	sublime->hw_table_map = !!(config & SUBLIME_CONFIG_TABLE_MAP);
+
+	sublime->steal_policy = VOICE_STEAL_OLDEST;
+	sublime->retrigger = 1;
+	sublime->oldest_voice = VOICE_NONE;
+	sublime->newest_voice = VOICE_NONE;
+	sublime->reserved_free = 0;
+	sublime->master_tune = 0;
+
+	/* The parts share all voices until they get reservations or limits */
+	for (i = 0; i < MAX_PARTS; i++) {
+		part = &sublime->parts[i];
+		part->sublime = sublime;
+		part->pitchwheel = 0;
+		part->reserved_voices = 0;
+		part->max_voices = sublime->num_voices;
+		part->num_voices = 0;
+		for (key = 0; key < NUM_MIDI_KEYS; key++)
+			part->key_voice[key] = VOICE_NONE;
+	}
+
+	/* Stack the free voices so that voice 0 is handed out first */
+	sublime->num_free_voices = 0;
+	for (i = sublime->num_voices - 1; i >= 0; i--)
+		sublime->free_voices[sublime->num_free_voices++] = i;
 
 	for (i = 0; i < sublime->num_voices; i++) {
+		sublime->voices[i].sublime = sublime;
+		sublime->voices[i].part = &sublime->parts[0];
+		sublime->voices[i].patch = &sublime->parts[0].patch;
 		sublime->voices[i].active = 0;
-		sublime->voices[i].osc[0].enable = 1;
-		sublime->voices[i].osc[1].enable = 1;
-		envelope_init(&sublime->voices[i].amp_env);
-		sublime->voices[i].amp_env.attack = 50000;
-		sublime->voices[i].amp_env.decay = 100000;
-		sublime->voices[i].amp_env.sustain = 0x7f;
-		sublime->voices[i].amp_env.release = 100000;
+		sublime->voices[i].gate = 0;
+		if (!sublime->hw_envelope)
+			envelope_init(&sublime->voices[i].amp_env,
+				      sublime_envelope_update_cb,
+				      &sublime->voices[i]);
 	}
 
 	/* Reset all voice registers */
 	for (i = 0; i < 4*sublime->num_voices; i++)
 		sublime_write_reg(sublime, i*4, 0);
 
-	/* Set defaults */
-	sublime->wavetable0 = (int32_t *)(base + WAVETABLE0);
-	sublime->wavetable1 = (int32_t *)(base + WAVETABLE1);
-	gen_saw(sublime->wavetable0);
-	gen_square(sublime->wavetable1);
+	for (i = 0; i < sublime->num_voices; i++) {
+		sublime->voices[i].shadow.osc0_freq = 0;
+		sublime->voices[i].shadow.osc1_freq = 0;
+		sublime->voices[i].shadow.ctrl = 0;
+		sublime->voices[i].shadow.envelope = 0;
+		sublime_write_reg(sublime, VOICE_WAVETABLE(i), 0);
+		sublime->voices[i].wavetable = 0;
+		if (sublime->hw_filter)
+			sublime_write_reg(sublime, VOICE_FILTER(i), 0);
+		sublime->voices[i].filter = 0;
+	}
+	for (i = 0; i < VOICE_DIRTY_WORDS; i++)
+		sublime->releasing[i] = 0;
+	sublime->stats.writes_issued = 0;
+	sublime->stats.writes_skipped = 0;
+	sublime->stats.sysex_errors = 0;
+
+	/* Write out the oscillator enables on the first pass */
+	sublime_mark_all_dirty(sublime->dirty_ctrl);
+
+	sublime->main_ctrl = sublime->hw_envelope ? MAIN_CTRL_ENVELOPE_EN : 0;
+
+	sublime->wavetable_len = WAVETABLE_SIZE;
+	sublime->wavetable_stride = WAVETABLE_SIZE*4;
+	mip_levels = 1;
+	if (config & SUBLIME_CONFIG_MIPMAP) {
+		sublime_init_mipmap(sublime);
+		mip_levels = TABLES_MIPMAP_LEVELS;
+	}
+	/* Every lane has a copy of the wavetable bank */
+	printf("sublime: %d wavetables of %d entries, %d mipmap levels, "
+	       "%d bytes upload, %d bytes BRAM per lane\r\n",
+	       sublime->num_wavetables, WAVETABLE_SIZE, mip_levels,
+	       (int)sublime->wavetable_len*4,
+	       (int)(sublime->num_wavetables*sublime->wavetable_stride));
 
 	/* Assert sync to all voices */
-	sublime_write_reg(sublime, MAIN_CTRL, 1);
+	sublime_write_reg(sublime, MAIN_CTRL,
+			  sublime->main_ctrl | MAIN_CTRL_SYNC_ALL);
 
 	/* Deassert sync to all voices */
-	sublime_write_reg(sublime, MAIN_CTRL, 0);
-
-	/* TODO: register on a specific chan... */
-	midi_register_cb(MIDI_EVENT_NOTE_ON, sublime, 0xff,
-			 sublime_note_on_cb);
-	midi_register_cb(MIDI_EVENT_NOTE_OFF, sublime, 0xff,
-			 sublime_note_off_cb);
-	midi_register_cb(MIDI_EVENT_PW_CHANGE, sublime, 0xff,
-			 sublime_pitchwheel_cb);
-	midi_register_cb(MIDI_EVENT_CC, sublime, 0xff,
-			 sublime_control_change_cb);
+	sublime_write_reg(sublime, MAIN_CTRL, sublime->main_ctrl);
+
+	if (config & SUBLIME_CONFIG_OUTPUT)
+		sublime_init_output(sublime);
+
+	/* Set defaults, the tables are uploaded by sublime_task() */
+	sublime->wavetables_loaded = 0;
+	sublime->wavetable_pos = 0;
+	for (i = 0; i < MAX_USER_WAVEFORMS; i++)
+		sublime->user_wavetable[i] = WAVETABLE_NONE;
+	sublime->upload.ignore = 1;
+	sublime->upload.table = WAVETABLE_NONE;
+	for (i = 0; i < MAX_PARTS; i++) {
+		sublime->parts[i].patch.table_map = i;
+		sublime_init_patch(sublime, &sublime->parts[i].patch);
+	}
+
+	/* A single part that plays all MIDI channels */
+	sublime->num_parts = 0;
+	sublime_set_parts(sublime, 1);
+	midi_register_cb(MIDI_EVENT_SYSEX, sublime, 0, sublime_sysex_cb);
 }
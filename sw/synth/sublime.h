@@ -2,8 +2,12 @@
 #define _SUBLIME_H_
 #include <envelope.h>
 
-#define WAVETABLE_SIZE		8192
+#define WAVETABLE_SIZE		2048
 #define MAX_NUM_VOICES		128
+#define VOICE_DIRTY_WORDS	(MAX_NUM_VOICES/32)
+#define VOICE_NONE		0xff
+#define NUM_MIDI_KEYS		128
+#define MAX_PARTS		16
 
 #define VOICE_OSC0_FREQ		0x0
 #define VOICE_OSC1_FREQ		0x4
@@ -16,9 +20,77 @@
 #define RIGHT_SAMPLE		0x804
 #define MAIN_CTRL		0x808
 #define SUBLIME_CONFIG		0x80c
+#define ENVELOPE_TRIGGER	0x810
+#define OUTPUT_RATE		0x814
+#define OUTPUT_UNDERRUNS	0x818
+#define OUTPUT_OVERRUNS		0x81c
+#define ENVELOPE_ACTIVE		0x820
+#define SAMPLE_PERIOD		0x830
+#define NOTE_BASE		0x834
+#define PITCH_BEND		0x838
+#define WAVETABLE_MAP(entry)	(0x840 | (((entry) & 0xf) << 2))
 
-#define WAVETABLE0		0x10000
-#define WAVETABLE1		0x20000
+/*
+ * Clock cycles the synth core spends on each voice (VOICE_CYCLES in
+ * sublime.v), SAMPLE_PERIOD reads back this times the number of voices.
+ */
+#define SUBLIME_VOICE_CYCLES	5
+
+#define VOICE_FILTER(voice)	(0x1000 | ((voice & 0x7f) << 2))
+#define VOICE_WAVETABLE(voice)	(0x1200 | ((voice & 0x7f) << 2))
+
+#define VOICE_CTRL_NOTE_ON	(1 << 2)
+
+/* Oscillator frequency given as a note, converted by the hardware */
+#define VOICE_FREQ_NOTE(note, cents) \
+	((1u << 31) | ((note) & 0x7f) << 24 | ((cents) & 0xffff))
+
+#define MAIN_CTRL_SYNC_ALL	(1 << 0)
+#define MAIN_CTRL_ENVELOPE_EN	(1 << 1)
+#define MAIN_CTRL_MIP_SHIFT(x)		((x) << 8)
+
+#define SUBLIME_CONFIG_ENVELOPE		(1 << 11)
+#define SUBLIME_CONFIG_OUTPUT		(1 << 13)
+#define SUBLIME_CONFIG_FILTER		(1 << 14)
+#define SUBLIME_CONFIG_INTERPOLATE	(1 << 15)
+#define SUBLIME_CONFIG_MIPMAP		(1 << 16)
+#define SUBLIME_CONFIG_WAVETABLES(x)	(1 << (((x) >> 17) & 0xf))
+#define SUBLIME_CONFIG_PITCH		(1 << 21)
+#define SUBLIME_CONFIG_BEND		(1 << 22)
+#define SUBLIME_CONFIG_TABLE_MAP	(1 << 23)
+
+#define VOICE_WAVETABLE_OSC0(x)	((x) << 0)
+#define VOICE_WAVETABLE_OSC1(x)	((x) << 8)
+/* Take the wavetables from a WAVETABLE_MAP entry */
+#define VOICE_WAVETABLE_MAP(entry) \
+	((1u << 23) | ((entry) & 0xf) << 16)
+
+#define FILTER_F(x)		((x) << 16)
+#define FILTER_Q(x)		((x) << 4)
+#define FILTER_MODE(x)		((x) << 0)
+
+#define OUTPUT_RATE_LPF_SHIFT(x)	((x) << 28)
+
+/* Rate of the codec output, the SSM2603 runs at mclk/128 */
+#define SUBLIME_OUTPUT_RATE	(BOARD_CODEC_MCLK_FREQ/128)
+
+/* Clock cycles between each step of the hardware envelopes */
+#define ENVELOPE_CLK_DIV	1024
+
+/* The wavetables follow each other from here */
+#define WAVETABLES		0x10000
+
+/* Wavetable entries uploaded per call to sublime_task() */
+#define WAVETABLE_CHUNK		256
+
+#define WAVETABLE_NONE		0xff
+
+/*
+ * User waveforms are uploaded over SysEx into the wavetables after the
+ * built in ones, one of those wavetables is always kept spare to upload
+ * into. 16 wavetables leave room for 11 of them.
+ */
+#define MAX_USER_WAVEFORMS	11
 
 /* MIDI Control Change defines */
 #define CC_OSC0_DETUNE_NOTES	3
@@ -30,36 +102,317 @@
 
 #define CC_OSC_MIXMODE		18
 
+#define CC_FILTER_MODE		19
+#define CC_FILTER_RESONANCE	71
+#define CC_FILTER_CUTOFF	74
+
 #define CC_AMP_ATTACK		73
 #define CC_AMP_DECAY		75
 #define CC_AMP_SUSTAIN		79
 #define CC_AMP_RELEASE		72
 
+#define CC_VOICE_STEAL		20
+
+/*
+ * Voice stealing policies, used when a note on finds no free voice.
+ * CC_VOICE_STEAL selects one with value/32.
+ */
+enum {
+	VOICE_STEAL_NONE,
+	VOICE_STEAL_OLDEST,
+	VOICE_STEAL_QUIETEST,
+	VOICE_STEAL_POLICIES,
+};
+
+/*
+ * Waveforms, as selected by the waveform control changes. The built in
+ * waveforms are kept in wavetable WAVEFORM_TABLE(waveform).
+ */
+#define WAVEFORM_TABLE(waveform)	((waveform) - 1)
+
+enum {
+	WAVEFORM_NONE,
+	WAVEFORM_SAW,
+	WAVEFORM_SQUARE,
+	WAVEFORM_TRIANGLE,
+	WAVEFORM_SINE,
+	/* The first user waveform */
+	WAVEFORM_USER,
+};
+
+/*
+ * SysEx upload protocol, all messages are
+ *
+ *   F0 7D <command> <header> <payload> <checksum> F7
+ *
+ * The checksum brings the 7 bit sum of the bytes from the command through
+ * the checksum to zero. Lengths and offsets are counted in wavetable
+ * entries and sent as three 7 bit bytes, least significant first.
+ *
+ * SYSEX_WAVETABLE_BEGIN <waveform> <length>
+ *	Start an upload of user waveform WAVEFORM_USER + waveform into a
+ *	spare wavetable. The length is the wavetable_len of the synth,
+ *	WAVETABLE_SIZE entries followed by the band limited octave copies
+ *	when the hardware has mipmaps, laid out as in tables.h.
+ * SYSEX_WAVETABLE_DATA <offset> <entries>
+ *	Entries from offset on, written to the wavetable as they arrive.
+ *	The 32 bit little endian entries are packed into groups of a byte
+ *	that holds the top bits of the next seven bytes, the top bit of the
+ *	first of them in bit 0. A block may start anywhere up to the end of
+ *	the last good block, so a block with a bad checksum can be sent again.
+ * SYSEX_WAVETABLE_COMMIT <waveform>
+ *	Switch the waveform and the patches that play it over to the
+ *	uploaded wavetable, once all entries are in.
+ * SYSEX_PATCH <part> <values>
+ *	Set the patch of a part, with a value for each of the control
+ *	changes osc0 waveform, detune notes and cents, osc1 waveform, detune
+ *	notes and cents, osc mixmode, filter mode, cutoff and resonance and
+ *	amp attack, decay, sustain and release.
+ * SYSEX_PARTS <parts>
+ *	Set the number of parts, as sublime_set_parts().
+ * SYSEX_PART_VOICES <part> <reserved> <max>
+ *	Set the voices reserved for a part and the most it may play, as
+ *	sublime_set_part_voices(). The message is rejected when the
+ *	reservations would exceed the number of voices.
+ */
+#define SYSEX_ID		0x7d	/* non-commercial */
+
+enum {
+	SYSEX_NONE,
+	SYSEX_WAVETABLE_BEGIN,
+	SYSEX_WAVETABLE_DATA,
+	SYSEX_WAVETABLE_COMMIT,
+	SYSEX_PATCH,
+	SYSEX_PARTS,
+	SYSEX_PART_VOICES,
+	SYSEX_COMMANDS
+};
+
+#define SYSEX_HEADER_MAX	4
+#define SYSEX_PATCH_VALUES	14
+/* Decoded wavetable entries collected before they are written out */
+#define SYSEX_BLOCK		8
+
+/* Filter modes, as selected by the filter mode control change */
+enum {
+	FILTER_BYPASS,
+	FILTER_LOW_PASS,
+	FILTER_BAND_PASS,
+	FILTER_HIGH_PASS,
+};
+
 struct osc {
 	int enable;
 	int8_t detune_notes;
 	int8_t detune_cents;
+	/* Wavetable played by the oscillator */
+	uint8_t wavetable;
+};
+
+/*
+ * The sound parameters shared by the voices that play it, the control
+ * changes only update the patch and mark its voices dirty.
+ * The amplitude envelope times are in micro seconds, envelope_reg is the
+ * matching value for the hardware envelope register. amp_env_gen is bumped
+ * on every envelope change, so that the firmware envelopes of the voices
+ * can pick up the new parameters.
+ * The filter cutoff is given as a MIDI note and the resonance as 0-127.
+ */
+struct patch {
+	struct osc osc[2];
+	uint8_t osc_mixmode;
+	uint32_t amp_attack;
+	uint32_t amp_decay;
+	uint8_t amp_sustain;
+	uint32_t amp_release;
+	uint32_t envelope_reg;
+	uint16_t amp_env_gen;
+	uint8_t filter_mode;
+	uint8_t filter_cutoff;
+	uint8_t filter_resonance;
+	/* Value for the voice filter registers */
+	uint32_t filter_reg;
+	/* WAVETABLE_MAP entry that holds the wavetables, one per part */
+	uint8_t table_map;
+};
+
+/*
+ * A part plays one patch from one MIDI channel. reserved_voices are kept
+ * free for the part while it plays fewer voices than that, and it never
+ * plays more than max_voices at once. num_voices counts its allocated
+ * voices, including the ones that are releasing.
+ * The key map points out the voice that currently plays a key.
+ */
+struct part {
+	struct sublime *sublime;
+	struct patch patch;
+	int16_t pitchwheel;
+	uint8_t reserved_voices;
+	uint8_t max_voices;
+	uint8_t num_voices;
+	uint8_t key_voice[NUM_MIDI_KEYS];
+};
+
+/*
+ * The SysEx message being received. Every byte is held back until the next
+ * one arrives, so the checksum at the end is never taken as data.
+ */
+struct sysex_upload {
+	/* The message is not for us or has gone wrong */
+	int ignore;
+	int error;
+	uint8_t command;
+	/* Bytes processed, from the ID on */
+	int pos;
+	int16_t held;
+	uint8_t sum;
+	uint8_t header[SYSEX_HEADER_MAX];
+	/* Unpacking of the wavetable entries */
+	uint8_t msbs;
+	uint8_t group_pos;
+	uint8_t entry_bytes;
+	uint32_t entry;
+	uint32_t block[SYSEX_BLOCK];
+	int block_len;
+	/* Entry offset of the block */
+	int32_t offset;
+	/* The wavetable upload in progress, and the entries in place */
+	uint8_t waveform;
+	uint8_t table;
+	int32_t next;
+	uint8_t patch[SYSEX_PATCH_VALUES];
+	int num_values;
+};
+
+struct sublime;
+
+#define VOICE_REG_WORDS		4
+
+/*
+ * Shadow copy of the last values written to the voice registers,
+ * laid out in the same order as the registers.
+ */
+struct voice_regs {
+	uint32_t osc0_freq;
+	uint32_t osc1_freq;
+	uint32_t ctrl;
+	uint32_t envelope;
 };
 
 struct voice {
+	struct sublime *sublime;
+	/* The part that last played the voice and its patch */
+	struct part *part;
+	struct patch *patch;
 	int active;
+	int gate;
 	uint8_t velocity;
 	uint8_t note;
 	struct envelope amp_env;
-	uint8_t osc_mixmode;
-	struct osc osc[2];
+	/* The patch amp_env_gen that amp_env was last set up from */
+	uint16_t amp_env_gen;
+	struct voice_regs shadow;
+	/* Last value written to the voice wavetable register */
+	uint32_t wavetable;
+	/* Last value written to the voice filter register */
+	uint32_t filter;
+	/* Links in the list of allocated voices */
+	uint8_t prev;
+	uint8_t next;
+};
+
+struct sublime_stats {
+	uint64_t writes_issued;
+	uint64_t writes_skipped;
+	uint32_t voices_stolen;
+	uint32_t sysex_errors;
 };
 
 struct sublime {
 	void *base;
 	int num_voices;
-	int16_t pitchwheel;
-	int32_t *wavetable0;
-	int32_t *wavetable1;
+	/*
+	 * With a single part, part 0 plays all MIDI channels, otherwise
+	 * part N plays channel N.
+	 */
+	int num_parts;
+	struct part parts[MAX_PARTS];
+	/* Master tuning in cents, added to the pitchwheel */
+	int16_t master_tune;
+	/*
+	 * Master tuning is applied to all voices by the hardware pitch bend
+	 * if it is present, and so is the pitchwheel when there is a single
+	 * part. Otherwise they go into the voice frequencies.
+	 */
+	int hw_bend;
+	/*
+	 * Amplitude envelope, run by the hardware if it is present,
+	 * otherwise by the voices' amp_env.
+	 */
+	int hw_envelope;
+	uint32_t releasing[VOICE_DIRTY_WORDS];
+	uint32_t main_ctrl;
+	/* Clock cycles per synth sample */
+	uint32_t sample_period;
+	int hw_filter;
+	/* The hardware converts notes to oscillator frequencies */
+	int hw_pitch;
+	/*
+	 * The voices take their wavetables from the map entry of their
+	 * patch, so a waveform change is a single register write.
+	 */
+	int hw_table_map;
+	/*
+	 * The wavetable bank, wavetable_len entries are uploaded per
+	 * wavetable, the band limited octave copies are only uploaded if the
+	 * hardware picks between them. The built in waveforms are uploaded
+	 * one chunk at a time by sublime_task().
+	 */
+	int num_wavetables;
+	uint32_t wavetable_stride;
+	int32_t wavetable_len;
+	int wavetables_loaded;
+	int32_t wavetable_pos;
+	/* Wavetable of each user waveform, WAVETABLE_NONE until uploaded */
+	uint8_t user_wavetable[MAX_USER_WAVEFORMS];
+	struct sysex_upload upload;
+	/*
+	 * One bit per voice, set when the voice control or the oscillator
+	 * frequencies have to be rewritten by sublime_task()
+	 */
+	uint32_t dirty_ctrl[VOICE_DIRTY_WORDS];
+	uint32_t dirty_freq[VOICE_DIRTY_WORDS];
+	struct sublime_stats stats;
+	/*
+	 * Voice allocation, the free voices are kept on a stack and the
+	 * allocated voices in a list ordered from oldest to newest note on.
+	 * reserved_free is the number of free voices held back for the parts
+	 * that play fewer voices than they have reserved.
+	 */
+	int steal_policy;
+	int retrigger;
+	uint8_t free_voices[MAX_NUM_VOICES];
+	int num_free_voices;
+	int reserved_free;
+	uint8_t oldest_voice;
+	uint8_t newest_voice;
 	struct voice voices[MAX_NUM_VOICES];
 };
 
 extern void sublime_init(struct sublime *sublime, void *base);
 extern void sublime_task(struct sublime *sublime);
+extern void sublime_get_output_stats(struct sublime *sublime,
+				     uint32_t *underruns, uint32_t *overruns);
+extern uint32_t sublime_get_freq(int8_t note, int32_t cents);
+extern void sublime_set_master_tune(struct sublime *sublime, int16_t cents);
+extern int sublime_set_steal_policy(struct sublime *sublime, int policy);
+extern void sublime_set_waveform(struct sublime *sublime,
+				 struct patch *patch, int osc,
+				 uint8_t waveform);
+extern void sublime_set_parts(struct sublime *sublime, int num_parts);
+extern int sublime_set_part_voices(struct sublime *sublime, int part,
+				   int reserved_voices, int max_voices);
+extern void sublime_write_block(struct sublime *sublime, uint32_t reg,
+				const uint32_t *data, int len);
 
 #endif
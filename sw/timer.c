@@ -3,9 +3,22 @@
 #include <config.h>
 #include <spr-defs.h>
 #include <or1k-support.h>
+#include <irq.h>
 #include <timer.h>
 
-#define TMR_MAX_US		((SPR_TTMR_PERIOD*1e6)/BOARD_CLK_FREQ)
+/*
+ * BOARD_CLK_FREQ is a floating point constant, the cast makes sure this is
+ * folded into an integer at compile time.
+ */
+#define TMR_TICKS_PER_US	((uint32_t)(BOARD_CLK_FREQ/1e6))
+
+/*
+ * The tick timer compares the lower 28 bits of the counter against the
+ * period, so that is as far into the future an interrupt can be scheduled.
+ */
+#define TMR_MAX_TICKS		SPR_TTMR_PERIOD
+/* Minimum distance to the counter when scheduling the next interrupt */
+#define TMR_MIN_TICKS		100
 
 #define MAX_TIMERS		128
 
@@ -14,50 +27,148 @@
 
 struct timer {
 	int mode;
-	uint32_t time_us;
-	uint32_t start_time_us;
+	uint32_t period;
+	uint64_t deadline;
 	uint32_t flags;
+	int heap_idx;
 	void (*isr_cb)(void *private_data);
 	void *private_data;
 };
 
 static struct timer timers[MAX_TIMERS];
-/* global running flag */
-static int ticktimer_running;
 
-static void timer_reset_ticktimer(void)
+/* Running timers, ordered as a binary min-heap on their deadlines */
+static struct timer *timer_heap[MAX_TIMERS];
+static int timer_heap_size;
+
+/* The upper half of the 64-bit time base and the last read counter value */
+static uint32_t ticks_hi;
+static uint32_t ticks_last;
+
+/*
+ * Returns the free running 64-bit tick count.
+ * The hardware counter is 32-bit, wraps are detected by comparing against
+ * the previously read value. The tick timer interrupt is never scheduled
+ * further away than TMR_MAX_TICKS, which guarantees that the counter is
+ * read at least once between wraps.
+ */
+uint64_t timer_get_ticks(void)
 {
-	or1k_mtspr(SPR_TTCR, 0);
+	unsigned long flags = irq_save();
+	uint32_t ticks_lo = or1k_mfspr(SPR_TTCR);
+	uint64_t ticks;
+
+	if (ticks_lo < ticks_last)
+		ticks_hi++;
+	ticks_last = ticks_lo;
+	ticks = ((uint64_t)ticks_hi << 32) | ticks_lo;
+
+	irq_restore(flags);
+
+	return ticks;
+}
+
+uint64_t timer_ticks_to_us(uint64_t ticks)
+{
+	return ticks/TMR_TICKS_PER_US;
 }
 
-static void timer_start_ticktimer(uint32_t us)
+static void timer_heap_swap(int a, int b)
 {
-	uint32_t ticks;
+	struct timer *tmp = timer_heap[a];
+
+	timer_heap[a] = timer_heap[b];
+	timer_heap[b] = tmp;
+	timer_heap[a]->heap_idx = a;
+	timer_heap[b]->heap_idx = b;
+}
+
+static void timer_heap_sift_up(int idx)
+{
+	int parent;
+
+	while (idx > 0) {
+		parent = (idx - 1)/2;
+		if (timer_heap[parent]->deadline <= timer_heap[idx]->deadline)
+			break;
+		timer_heap_swap(idx, parent);
+		idx = parent;
+	}
+}
 
-	if (us > TMR_MAX_US)
-		us = TMR_MAX_US;
+static void timer_heap_sift_down(int idx)
+{
+	int child;
 
-	ticks = us*(BOARD_CLK_FREQ/1e6);
+	for (;;) {
+		child = 2*idx + 1;
+		if (child >= timer_heap_size)
+			break;
+		if (child + 1 < timer_heap_size &&
+		    timer_heap[child + 1]->deadline < timer_heap[child]->deadline)
+			child++;
+		if (timer_heap[idx]->deadline <= timer_heap[child]->deadline)
+			break;
+		timer_heap_swap(idx, child);
+		idx = child;
+	}
+}
 
-	or1k_mtspr(SPR_TTMR, SPR_TTMR_IE | SPR_TTMR_SR | ticks);
+static void timer_heap_insert(struct timer *timer)
+{
+	timer->heap_idx = timer_heap_size;
+	timer_heap[timer_heap_size++] = timer;
+	timer_heap_sift_up(timer->heap_idx);
 }
 
-static uint32_t timer_get_ticktimer_us(void)
+static void timer_heap_remove(struct timer *timer)
 {
-	return or1k_mfspr(SPR_TTCR)/(BOARD_CLK_FREQ/1e6);
+	int idx = timer->heap_idx;
+
+	if (--timer_heap_size == idx)
+		return;
+
+	timer_heap[idx] = timer_heap[timer_heap_size];
+	timer_heap[idx]->heap_idx = idx;
+	timer_heap_sift_up(idx);
+	timer_heap_sift_down(timer_heap[idx]->heap_idx);
 }
 
-static uint32_t timer_get_ticktimer_period_us(void)
+/*
+ * Reload the tick timer with the deadline of the first timer in the heap.
+ * When no timers are running, it is still reloaded with the longest possible
+ * period to keep the time base up to date.
+ * The counter is never stopped, the timer runs in continuous mode and the
+ * interrupt triggers when the lower bits of the counter match the period.
+ * If the counter has already passed the match value once it has been
+ * written, the deadline is recalculated.
+ */
+static void timer_program_ticktimer(void)
 {
-	return (or1k_mfspr(SPR_TTMR) & SPR_TTMR_PERIOD)/(BOARD_CLK_FREQ/1e6);
+	uint64_t now;
+	uint64_t next;
+
+	do {
+		now = timer_get_ticks();
+		next = now + TMR_MAX_TICKS;
+		if (timer_heap_size && timer_heap[0]->deadline < next)
+			next = timer_heap[0]->deadline;
+		if (next < now + TMR_MIN_TICKS)
+			next = now + TMR_MIN_TICKS;
+
+		or1k_mtspr(SPR_TTMR, SPR_TTMR_IE | SPR_TTMR_CR |
+			   (next & SPR_TTMR_PERIOD));
+	} while (timer_get_ticks() >= next);
 }
 
 static void timer_do_timeout(struct timer *timer)
 {
-	if (timer->mode == TMR_CONTINOUS)
-		timer->time_us = timer->start_time_us;
-	else if (timer->mode == TMR_ONESHOT)
+	if (timer->mode == TMR_CONTINOUS) {
+		timer->deadline += timer->period;
+		timer_heap_insert(timer);
+	} else if (timer->mode == TMR_ONESHOT) {
 		timer->flags &= ~TMR_RUNNING;
+	}
 
 	if (timer->isr_cb)
 		timer->isr_cb(timer->private_data);
@@ -65,52 +176,27 @@ static void timer_do_timeout(struct timer *timer)
 
 /*
  * Timer interrupt service routine.
- * Iterates through the timers and runs the callback on the
- * timer(s) that are done.
- * The (hardware) timer is reloaded with the value of the
- * timer that has least time left.
+ * Runs the callback on the timer(s) at the top of the heap that have
+ * reached their deadline.
+ * The (hardware) timer is then reloaded with the deadline of the timer
+ * that is next in turn.
  */
 static void timer_isr(void)
 {
-	int i;
-	int next = -1;
-	uint32_t elapsed = timer_get_ticktimer_us();
-	uint32_t min = 0xffffffff;
+	struct timer *timer;
+	uint64_t now;
 
-	or1k_mtspr(SPR_TTMR, 0);
-	timer_reset_ticktimer();
-	for (i = 0; i < MAX_TIMERS; i++) {
-		if ((timers[i].flags & (TMR_ACTIVE | TMR_RUNNING)) ==
-		    (TMR_ACTIVE | TMR_RUNNING)) {
-			if (elapsed > timers[i].time_us)
-				timers[i].time_us = 0;
-			else
-				timers[i].time_us -= elapsed;
-
-			if (timers[i].time_us == 0)
-				timer_do_timeout(&timers[i]);
-
-			/*
-			 * The 'running' flag and time_us might have changed for
-			 * a just timed out timer, so we have to recheck them
-			 * here.
-			 */
-			if ((timers[i].flags & TMR_RUNNING) &&
-			    (timers[i].time_us < min)) {
-				min = timers[i].time_us;
-				next = i;
-			}
-		}
-	}
+	/* Acknowledge the interrupt, the counter keeps running */
+	or1k_mtspr(SPR_TTMR, SPR_TTMR_CR);
 
-	/* No upcoming active and running timers? */
-	if (next < 0) {
-		or1k_mtspr(SPR_TTMR, 0);
-		ticktimer_running = 0;
-		return;
+	now = timer_get_ticks();
+	while (timer_heap_size && timer_heap[0]->deadline <= now) {
+		timer = timer_heap[0];
+		timer_heap_remove(timer);
+		timer_do_timeout(timer);
 	}
 
-	timer_start_ticktimer(timers[next].time_us);
+	timer_program_ticktimer();
 }
 
 /*
@@ -137,25 +223,23 @@ struct timer *timer_alloc(void (*isr_cb)(void *private_data),
 
 void timer_start(struct timer *timer, int mode, uint32_t time_us)
 {
-	timer->start_time_us = timer->time_us = time_us;
+	unsigned long flags = irq_save();
+
+	/* Restarting a running timer moves it to its new place in the heap */
+	if (timer->flags & TMR_RUNNING)
+		timer_heap_remove(timer);
+
+	timer->mode = mode;
+	timer->period = time_us*TMR_TICKS_PER_US;
+	timer->deadline = timer_get_ticks() + (uint64_t)time_us*TMR_TICKS_PER_US;
 	timer->flags |= TMR_RUNNING;
-	/*
-	 * A bit tricky, if the timer is running, we have to add the
-	 * current timer value to the timer we are inserting.
-	 * And if the timer we are inserting should timeout before the
-	 * current ongoing timer, the timer period have to be adjusted by
-	 * (re)starting the timer with the new timer value.
-	 */
-	if (ticktimer_running) {
-		timer->time_us += timer_get_ticktimer_us();
-		if (timer->time_us < timer_get_ticktimer_period_us())
-			timer_start_ticktimer(timer->time_us);
-	} else {
-		timer_reset_ticktimer();
-		timer_start_ticktimer(time_us);
-		ticktimer_running = 1;
-	}
+	timer_heap_insert(timer);
+
+	/* The tick timer only has to be reloaded if this is the next timeout */
+	if (timer_heap[0] == timer)
+		timer_program_ticktimer();
 
+	irq_restore(flags);
 }
 
 void timer_init(void)
@@ -166,6 +250,12 @@ void timer_init(void)
 
 	for (i = 0; i < MAX_TIMERS; i++)
 		timers[i].flags = 0;
+	timer_heap_size = 0;
+
+	ticks_hi = 0;
+	ticks_last = 0;
+	or1k_mtspr(SPR_TTCR, 0);
+	timer_program_ticktimer();
 
 	/* Enable tick timer exception */
 	or1k_mtspr(SPR_SR, or1k_mfspr(SPR_SR) | SPR_SR_TEE);
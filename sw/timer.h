@@ -10,5 +10,7 @@ struct timer;
 extern struct timer *timer_alloc(void (*isr_cb)(void *private_data),
 				 void *private_data);
 extern void timer_start(struct timer *timer, int mode, uint32_t time_us);
+extern uint64_t timer_get_ticks(void);
+extern uint64_t timer_ticks_to_us(uint64_t ticks);
 extern void timer_init(void);
 #endif
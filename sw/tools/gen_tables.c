@@ -0,0 +1,167 @@
+/*
+ * Generates the lookup tables used by the synth firmware as a C header,
+ * so that they don't have to be calculated with soft-float on the target.
+ *
+ * Usage: gen_tables <wavetable size> > tables.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <config.h>
+
+#define PI 3.14159265358979
+
+/* Peak of the fundamental of the naive waveforms */
+#define AMPLITUDE (INT_MAX/4.0)
+
+static int32_t wavetable_size;
+
+/*
+ * The waveforms are built from their harmonics, the amplitude of
+ * harmonic k of a waveform with fundamental amplitude AMPLITUDE.
+ */
+static double saw(int k)
+{
+	return 2*AMPLITUDE/(PI*k);
+}
+
+static double square(int k)
+{
+	return k % 2 ? 4*AMPLITUDE/(PI*k) : 0;
+}
+
+static double triangle(int k)
+{
+	if (!(k % 2))
+		return 0;
+
+	return (k % 4 == 1 ? 8 : -8)*AMPLITUDE/(PI*PI*k*k);
+}
+
+static double sine(int k)
+{
+	return k == 1 ? AMPLITUDE : 0;
+}
+
+/*
+ * Mipmapped wavetable, one band limited copy of the waveform per octave.
+ * Level L holds wavetable_size/2^L entries and the harmonics below its
+ * Nyquist frequency, the levels are stored back to back down to a level
+ * of 4 entries.
+ */
+static void print_wave(const char *name, double (*harmonic)(int k))
+{
+	double *sintab = malloc(wavetable_size*sizeof(*sintab));
+	double wave;
+	int32_t len;
+	int32_t pos = 0;
+	int32_t i;
+	int k;
+
+	printf("static const int32_t %s[%d] = {", name, 2*wavetable_size-4);
+	for (len = wavetable_size; len >= 4; len /= 2) {
+		for (i = 0; i < len; i++)
+			sintab[i] = sin(2*PI*i/len);
+
+		for (i = 0; i < len; i++, pos++) {
+			wave = 0;
+			for (k = 1; k < len/2; k++)
+				wave += harmonic(k)*sintab[(int64_t)k*i % len];
+			printf("%s%d,", pos % 8 ? " " : "\n\t",
+			       (int32_t)lrint(wave));
+		}
+	}
+	printf("\n};\n\n");
+
+	free(sintab);
+}
+
+static void print_table(const char *name, const uint32_t *table, int len)
+{
+	int i;
+
+	printf("static const uint32_t %s[%d] = {", name, len);
+	for (i = 0; i < len; i++)
+		printf("%s0x%08x,", i % 6 ? " " : "\n\t", table[i]);
+	printf("\n};\n\n");
+}
+
+static void print_note_table(void)
+{
+	double notes[129];
+	uint32_t note_table[129];
+	int i;
+
+	notes[69] = 440; /* #A4 */
+	for (i = 70; i <= 80; i++)
+		notes[i] = notes[i-1] * pow(2, 1.0f/12);
+
+	for (i = 68; i >= 0; i--)
+		notes[i] = notes[i+12]/2;
+
+	for(i = 81; i <= 128; i++)
+		notes[i] = notes[i-12]*2;
+
+	/*
+	 * The nco phase acc is 32-bit, so the formula for the value to
+	 * to write into the freq reg is:
+	 * 2^32/(BOARD_CLK_FREQ/note_freq)
+	 */
+	for (i = 0; i <= 128; i++)
+		note_table[i] = ((1ull<<32)*notes[i])/BOARD_CLK_FREQ + 0.5f;
+
+	print_table("note_table", note_table, 129);
+
+	/*
+	 * The phase increment of note 0 in 12.20 fixed point, the hardware
+	 * pitch conversion scales this by 2^(cents/1200).
+	 */
+	printf("#define TABLES_NOTE_BASE\t%u\n\n",
+	       (uint32_t)((double)(1ull<<52)*notes[0]/BOARD_CLK_FREQ + 0.5));
+}
+
+static void print_cent_table(void)
+{
+	uint32_t cent_table[101];
+	int i;
+
+	for (i = 0; i <= 100; i++)
+		cent_table[i] = (1<<16) / pow(2, (float)i/1200) + 0.5f;
+
+	print_table("cent_table", cent_table, 101);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <wavetable size>\n", argv[0]);
+		return 1;
+	}
+
+	wavetable_size = atoi(argv[1]);
+	if (wavetable_size < 4 || wavetable_size & (wavetable_size - 1)) {
+		fprintf(stderr, "wavetable size must be a power of 2\n");
+		return 1;
+	}
+
+	printf("/* Generated by tools/gen_tables, do not edit */\n");
+	printf("#ifndef _TABLES_H_\n");
+	printf("#define _TABLES_H_\n\n");
+	printf("#define TABLES_WAVETABLE_SIZE\t%d\n", wavetable_size);
+	printf("#define TABLES_WAVETABLE_LEN\t%d\n", 2*wavetable_size-4);
+	printf("#define TABLES_MIPMAP_LEVELS\t%d\n\n",
+	       __builtin_ctz(wavetable_size)-1);
+
+	print_wave("wave_saw", saw);
+	print_wave("wave_square", square);
+	print_wave("wave_triangle", triangle);
+	print_wave("wave_sine", sine);
+	print_note_table();
+	print_cent_table();
+
+	printf("#endif\n");
+
+	return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Bit exact model of the wavetable read and the voice mixer, measuring THD
+ * and THD+N of a single sine voice in the same way as
+ * bench/sublime_thd_tb.v, to compare wavetable sizes with and without
+ * interpolation when no simulator is at hand.
+ *
+ * The voice plays at full velocity with unity envelope gain and the
+ * filter bypassed, so the mixer output is the table read scaled by 255/256.
+ *
+ * Usage: thd_model <wavetable size> <interpolate> [num voices]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#define PI 3.14159265358979
+
+/* Parameters of bench/sublime_thd_tb.v */
+#define NUM_SAMPLES	131072
+#define CYCLES		1005
+#define NUM_HARMONICS	9
+#define VOICE_CYCLES	5
+#define INTERP_BITS	12
+
+static double samples[NUM_SAMPLES];
+
+/* sublime_wavetable, level 0 */
+static int32_t wavetable_read(const int32_t *table, int aw, int interpolate,
+			      uint32_t phase)
+{
+	uint32_t mask = (1u << aw) - 1;
+	uint32_t idx = phase >> (32 - aw);
+	uint32_t frac = 0;
+	int64_t diff;
+	int64_t delta;
+
+	if (interpolate)
+		frac = (uint32_t)(((uint64_t)phase << INTERP_BITS) >>
+				  (32 - aw)) & ((1u << INTERP_BITS) - 1);
+
+	diff = (int64_t)table[(idx + 1) & mask] - table[idx];
+	delta = diff * frac;
+
+	return (int32_t)((uint32_t)table[idx] +
+			 (uint32_t)(delta >> INTERP_BITS));
+}
+
+/* sublime_voice_mixer, sign and magnitude scaling by velocity and envelope */
+static int32_t mixer_scale(int32_t x, uint32_t velocity, uint32_t envelope)
+{
+	uint32_t mag = x < 0 ? -(uint32_t)x : (uint32_t)x;
+	uint32_t v = (uint32_t)(((uint64_t)mag * velocity) >> 8);
+
+	v = (uint32_t)(((uint64_t)v * envelope) >> 8);
+
+	return x < 0 ? -(int32_t)v : (int32_t)v;
+}
+
+static double bin_energy(int bin)
+{
+	double re = 0.0;
+	double im = 0.0;
+	int n;
+
+	for (n = 0; n < NUM_SAMPLES; n++) {
+		re += samples[n] * cos(2.0*PI*bin*n/NUM_SAMPLES);
+		im += samples[n] * sin(2.0*PI*bin*n/NUM_SAMPLES);
+	}
+
+	return 2.0*(re*re + im*im)/NUM_SAMPLES;
+}
+
+int main(int argc, char **argv)
+{
+	int32_t *table;
+	uint64_t freq;
+	uint32_t sample_period;
+	uint32_t phase = 0;
+	double mean = 0.0;
+	double energy = 0.0;
+	double fundamental;
+	double harmonics = 0.0;
+	int size;
+	int aw;
+	int interpolate;
+	int num_voices = 8;
+	int i;
+	int h;
+
+	if (argc < 3 || argc > 4) {
+		fprintf(stderr,
+			"usage: %s <wavetable size> <interpolate> [num voices]\n",
+			argv[0]);
+		return 1;
+	}
+
+	size = atoi(argv[1]);
+	interpolate = atoi(argv[2]);
+	if (argc == 4)
+		num_voices = atoi(argv[3]);
+	if (size < 4 || size & (size - 1) || num_voices < 1) {
+		fprintf(stderr, "wavetable size must be a power of 2\n");
+		return 1;
+	}
+	aw = __builtin_ctz(size);
+
+	table = malloc(size * sizeof(*table));
+	if (!table)
+		return 1;
+	for (i = 0; i < size; i++)
+		table[i] = (int32_t)((1 << 30)*sin(2.0*PI*i/size));
+
+	/* Place the tone on a DFT bin, as the bench does */
+	sample_period = VOICE_CYCLES*num_voices;
+	freq = ((1ull << 32)*CYCLES)/((uint64_t)NUM_SAMPLES*sample_period);
+	if (freq*NUM_SAMPLES*sample_period != (1ull << 32)*CYCLES)
+		printf("WARNING: the tone is not on a bin\n");
+
+	for (i = 0; i < NUM_SAMPLES; i++) {
+		samples[i] = mixer_scale(wavetable_read(table, aw, interpolate,
+							phase), 0xff, 256);
+		phase += (uint32_t)freq*sample_period;
+	}
+
+	for (i = 0; i < NUM_SAMPLES; i++)
+		mean += samples[i];
+	mean /= NUM_SAMPLES;
+	for (i = 0; i < NUM_SAMPLES; i++)
+		energy += (samples[i] - mean)*(samples[i] - mean);
+
+	fundamental = bin_energy(CYCLES);
+	for (h = 2; h <= NUM_HARMONICS && h*CYCLES < NUM_SAMPLES/2; h++)
+		harmonics += bin_energy(h*CYCLES);
+
+	printf("wavetable size %d, interpolation %d\n", size, interpolate);
+	printf("THD:   %f dB\n", 10.0*log10(harmonics/fundamental));
+	/* Below ~-140 dB the noise is lost in the rounding of the energies */
+	if (energy > fundamental)
+		printf("THD+N: %f dB\n",
+		       10.0*log10((energy - fundamental)/fundamental));
+	else
+		printf("THD+N: below the measurement floor\n");
+
+	free(table);
+
+	return 0;
+}